@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/*
+ * Benchmark of the batch color conversion functions against the scalar ones.
+ * When the framebuffer cannot be opened, the default XRGB8888 layout is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <tfblib/tfblib.h>
+
+#define N_COLORS     (1 << 20)
+#define N_ROUNDS     20
+
+static struct tfb_hsv hsv[N_COLORS];
+static struct tfb_rgb rgb[N_COLORS];
+static uint32_t ref[N_COLORS];
+static uint32_t out[N_COLORS];
+
+static double now_sec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double t0, double t1)
+{
+   const double mcolors = (double)N_COLORS * N_ROUNDS / 1e6;
+   printf("%-28s %8.1f Mcolors/s\n", name, mcolors / (t1 - t0));
+}
+
+static uint32_t count_mismatches(void)
+{
+   uint32_t n = 0;
+
+   for (uint32_t i = 0; i < N_COLORS; i++)
+      n += out[i] != ref[i];
+
+   return n;
+}
+
+int main(int argc, char **argv)
+{
+   tfb_hsv_palette_t palette;
+   bool acquired;
+   double t0;
+   int rc;
+
+   rc = tfb_acquire_fb(TFB_FL_NO_TTY_KD_GRAPHICS, NULL, NULL);
+   acquired = rc == TFB_SUCCESS;
+
+   if (!acquired) {
+      printf("tfb_acquire_fb() failed: %s\n", tfb_strerror(rc));
+      printf("Using the default XRGB8888 layout\n\n");
+   }
+
+   srand(1234);
+
+   for (uint32_t i = 0; i < N_COLORS; i++) {
+      hsv[i] = (struct tfb_hsv) {
+         rand() % (360 * TFB_HUE_DEGREE), rand() % 256, rand() % 256
+      };
+      rgb[i] = (struct tfb_rgb) { rand() % 256, rand() % 256, rand() % 256 };
+   }
+
+   /* HSV */
+   t0 = now_sec();
+
+   for (int r = 0; r < N_ROUNDS; r++)
+      for (uint32_t i = 0; i < N_COLORS; i++)
+         ref[i] = tfb_make_color_hsv(hsv[i].h, hsv[i].s, hsv[i].v);
+
+   report("tfb_make_color_hsv()", t0, now_sec());
+   t0 = now_sec();
+
+   for (int r = 0; r < N_ROUNDS; r++)
+      tfb_make_colors_hsv(out, hsv, N_COLORS);
+
+   report("tfb_make_colors_hsv()", t0, now_sec());
+   printf("   mismatches: %u\n", count_mismatches());
+
+   if ((rc = tfb_make_hsv_palette(255, &palette)) != TFB_SUCCESS) {
+      fprintf(stderr, "tfb_make_hsv_palette() failed: %s\n", tfb_strerror(rc));
+      return 1;
+   }
+
+   t0 = now_sec();
+
+   for (int r = 0; r < N_ROUNDS; r++)
+      tfb_make_colors_hsv_palette(out, palette, hsv, N_COLORS);
+
+   report("tfb_make_colors_hsv_palette()", t0, now_sec());
+   tfb_free_hsv_palette(palette);
+
+   /* RGB */
+   t0 = now_sec();
+
+   for (int r = 0; r < N_ROUNDS; r++)
+      for (uint32_t i = 0; i < N_COLORS; i++)
+         ref[i] = tfb_make_color(rgb[i].r, rgb[i].g, rgb[i].b);
+
+   report("tfb_make_color()", t0, now_sec());
+   t0 = now_sec();
+
+   for (int r = 0; r < N_ROUNDS; r++)
+      tfb_make_colors(out, rgb, N_COLORS);
+
+   report("tfb_make_colors()", t0, now_sec());
+   printf("   mismatches: %u\n", count_mismatches());
+
+   if (acquired)
+      tfb_release_fb();
+
+   return 0;
+}
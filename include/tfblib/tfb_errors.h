@@ -36,7 +36,7 @@
 /**
  * Unsupported video mode
  *
- * \note Currently the library supports only 32-bit color modes.
+ * \note Currently the library supports only 16, 24 and 32-bit color modes.
  */
 #define TFB_ERR_UNSUPPORTED_VIDEO_MODE    7
 
@@ -67,6 +67,30 @@
 /// Unable to flush the framebuffer with ioctl()
 #define TFB_ERR_FB_FLUSH_IOCTL_FAILED 16
 
+/// Unable to create a thread
+#define TFB_ERR_THREAD_CREATE_FAILED     17
+
+/// Unable to open a suitable input device
+#define TFB_ERR_OPEN_INPUT               18
+
+/// Unable to set up the event loop (epoll or timerfd failed)
+#define TFB_ERR_LOOP_SETUP_FAILED        19
+
+/// Unable to open/write the output file
+#define TFB_ERR_WRITE_FILE_FAILED        20
+
+/// Unable to take control of the VT switches with ioctl(VT_SETMODE)
+#define TFB_ERR_VT_SETMODE_FAILED        21
+
+/// Unable to open/read the input file
+#define TFB_ERR_READ_FILE_FAILED         22
+
+/// Invalid or unsupported image (or video) file
+#define TFB_ERR_INVALID_IMAGE            23
+
+/// Too many nested clip rects
+#define TFB_ERR_CLIP_STACK_FULL          24
+
 /**
  * Returns a human-readable error message.
  *
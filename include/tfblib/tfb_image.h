@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/**
+ * @file tfb_image.h
+ * @brief Tfblib's image decoding and encoding functions and definitions
+ */
+
+#pragma once
+#include <stdint.h>
+
+/**
+ * \addtogroup ImageFormats Image formats
+ * @{
+ */
+
+/// Netpbm: binary PGM (P5), PPM (P6) and PAM (P7) files
+#define TFB_IMG_PNM              1
+
+/// Uncompressed Windows BMP files, with 8 (palette), 24 or 32 bpp
+#define TFB_IMG_BMP              2
+
+/// QOI (Quite OK Image format) files
+#define TFB_IMG_QOI              3
+
+/** @} */
+
+/**
+ * Basic information about an image file
+ */
+struct tfb_image_info {
+
+   uint32_t width;         /**< Width of the image, in pixels */
+   uint32_t height;        /**< Height of the image, in pixels */
+   uint32_t format;        /**< One of the TFB_IMG_* values */
+};
+
+/**
+ * Read the header of an image file
+ *
+ * @param[in]  file     The image file
+ * @param[out] info     Address of the struct to fill
+ *
+ * @return              #TFB_SUCCESS in case of success or one of the
+ *                      following errors:
+ *                          #TFB_ERR_READ_FILE_FAILED,
+ *                          #TFB_ERR_INVALID_IMAGE,
+ *                          #TFB_ERR_OUT_OF_MEMORY.
+ */
+int tfb_get_image_info(const char *file, struct tfb_image_info *info);
+
+/**
+ * Draw an image file at (x, y)
+ *
+ * The image is decoded while reading the file, one row at a time, and each
+ * row is converted to the native pixel format and written directly to the
+ * framebuffer (or to the back buffer, with #TFB_FL_USE_DOUBLE_BUFFER). The
+ * memory used does not depend on the size of the image. Parts of the image
+ * outside the current window are clipped. Alpha channels are ignored.
+ *
+ * @param[in]  x        Window-relative X coordinate of the top-left corner
+ * @param[in]  y        Window-relative Y coordinate of the top-left corner
+ * @param[in]  file     The image file: the format is detected from its header
+ *
+ * @return              #TFB_SUCCESS in case of success or one of the
+ *                      following errors:
+ *                          #TFB_ERR_READ_FILE_FAILED,
+ *                          #TFB_ERR_INVALID_IMAGE,
+ *                          #TFB_ERR_OUT_OF_MEMORY.
+ *
+ * \note In case of a truncated or corrupted file, the rows decoded until
+ *       then are still drawn.
+ */
+int tfb_draw_image(int x, int y, const char *file);
+
+/**
+ * Draw an image read from a file descriptor at (x, y)
+ *
+ * Like tfb_draw_image(), but the image is read from 'fd', which can be a
+ * pipe or a socket as well: it's read sequentially, without seeking. The
+ * file descriptor is not closed.
+ *
+ * @see tfb_draw_image
+ */
+int tfb_draw_image_fd(int x, int y, int fd);
+
+/**
+ * Save a rect of the current window to an image file
+ *
+ * The pixels are read from the framebuffer (or from the back buffer, with
+ * #TFB_FL_USE_DOUBLE_BUFFER) one row at a time and encoded while writing the
+ * file: no copy of the whole frame is made. The rect is clipped to the current
+ * window: to save the whole window, just use its width and height.
+ *
+ * @param[in]  file     The output file (truncated, if it already exists)
+ * @param[in]  x        Window-relative X coordinate of the rect
+ * @param[in]  y        Window-relative Y coordinate of the rect
+ * @param[in]  w        Width of the rect
+ * @param[in]  h        Height of the rect
+ * @param[in]  format   #TFB_IMG_PNM (a binary PPM file) or #TFB_IMG_QOI
+ *
+ * @return              #TFB_SUCCESS in case of success or one of the
+ *                      following errors:
+ *                          #TFB_ERR_WRITE_FILE_FAILED,
+ *                          #TFB_ERR_INVALID_WINDOW (empty rect),
+ *                          #TFB_ERR_INVALID_IMAGE (unsupported format),
+ *                          #TFB_ERR_OUT_OF_MEMORY.
+ */
+int tfb_screenshot(const char *file, int x, int y, int w, int h,
+                   uint32_t format);
+
+/**
+ * Save a rect of the current window to a file descriptor
+ *
+ * Like tfb_screenshot(), but the image is written sequentially to 'fd', which
+ * can be a pipe or a socket as well. The file descriptor is not closed.
+ *
+ * @see tfb_screenshot
+ */
+int tfb_screenshot_fd(int fd, int x, int y, int w, int h, uint32_t format);
@@ -11,6 +11,8 @@ extern int __fb_screen_h;
 extern size_t __fb_size;
 extern size_t __fb_pitch;
 extern size_t __fb_pitch_div4; /* see the comment in drawing.c */
+extern u32 __fb_bytespp;      /* bytes per pixel: 2, 3 or 4 */
+extern void (*__fb_put_pixel)(void *dst, u32 color);
 
 /* Window-related variables */
 extern int __fb_win_w;
@@ -19,6 +21,10 @@ extern int __fb_off_x;
 extern int __fb_off_y;
 extern int __fb_win_end_x;
 extern int __fb_win_end_y;
+extern int __fb_clip_x0;
+extern int __fb_clip_y0;
+extern int __fb_clip_x1;
+extern int __fb_clip_y1;
 
 /* Color-related variables */
 extern u32 __fb_r_mask;
@@ -30,12 +36,18 @@ extern u8 __fb_b_mask_size;
 extern u8 __fb_r_pos;
 extern u8 __fb_g_pos;
 extern u8 __fb_b_pos;
+extern bool __fb_is_xrgb8888;
 
 inline u32 tfb_make_color(u8 r, u8 g, u8 b)
 {
-   return ((r << __fb_r_pos) & __fb_r_mask) |
-          ((g << __fb_g_pos) & __fb_g_mask) |
-          ((b << __fb_b_pos) & __fb_b_mask);
+   /* By far the most common layout: no need to load the channel globals */
+   if (__builtin_expect(__fb_is_xrgb8888, 1))
+      return ((u32)r << 16) | ((u32)g << 8) | b;
+
+   /* Keep the most significant bits, for channels smaller than 8 bits */
+   return (((u32)r >> (8 - __fb_r_mask_size)) << __fb_r_pos) |
+          (((u32)g >> (8 - __fb_g_mask_size)) << __fb_g_pos) |
+          (((u32)b >> (8 - __fb_b_mask_size)) << __fb_b_pos);
 }
 
 inline void tfb_draw_pixel(int x, int y, u32 color)
@@ -43,8 +55,18 @@ inline void tfb_draw_pixel(int x, int y, u32 color)
    x += __fb_off_x;
    y += __fb_off_y;
 
-   if ((u32)x < (u32)__fb_win_end_x && (u32)y < (u32)__fb_win_end_y)
-      ((volatile u32 *)__fb_buffer)[x + y * __fb_pitch_div4] = color;
+   if (x >= __fb_clip_x0 && x < __fb_clip_x1 &&
+       y >= __fb_clip_y0 && y < __fb_clip_y1)
+   {
+
+      if (__builtin_expect(__fb_bytespp == 4, 1)) {
+         ((volatile u32 *)__fb_buffer)[x + y * __fb_pitch_div4] = color;
+         return;
+      }
+
+      __fb_put_pixel((u8 *)__fb_buffer + y * __fb_pitch + x * __fb_bytespp,
+                     color);
+   }
 }
 
 inline u32 tfb_screen_width(void) { return __fb_screen_w; }
@@ -0,0 +1,306 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/**
+ * @file tfb_input.h
+ * @brief Tfblib's evdev input and event loop functions and definitions
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "tfb_kb.h"
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * evdev input functions and definitions
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * \addtogroup flags Flags
+ * @{
+ */
+
+/**
+ * Grab the input devices
+ *
+ * When passed to tfb_open_input_device(), this flag makes the library get
+ * exclusive access to the devices: their events won't reach the TTY or any
+ * other process.
+ */
+#define TFB_FL_INPUT_GRAB (1 << 3)
+
+/** @} */
+
+/**
+ * \addtogroup EventTypes Event types
+ * @{
+ */
+
+/// A key has been pressed. 'code' is a KEY_* value from <linux/input.h>.
+#define TFB_EV_KEY_PRESS         1
+
+/// A key has been released. 'code' is a KEY_* value from <linux/input.h>.
+#define TFB_EV_KEY_RELEASE       2
+
+/// A key is being held down. 'code' is a KEY_* value from <linux/input.h>.
+#define TFB_EV_KEY_REPEAT        3
+
+/// A keystroke read from the TTY. 'key' is a value like the ones returned
+/// by tfb_read_keypress().
+#define TFB_EV_TTY_KEY           4
+
+/// The pointer moved to (x, y), by (dx, dy) since the previous event
+#define TFB_EV_POINTER_MOTION    5
+
+/// A mouse button has been pressed or a touchscreen touched. 'code' is a
+/// BTN_* value from <linux/input.h> (e.g. BTN_LEFT or BTN_TOUCH).
+#define TFB_EV_BUTTON_PRESS      6
+
+/// A mouse button has been released or the touch ended
+#define TFB_EV_BUTTON_RELEASE    7
+
+/// The mouse wheel has been rotated by 'dy' (positive: away from the user)
+#define TFB_EV_WHEEL             8
+
+/** @} */
+
+/**
+ * Input event
+ */
+struct tfb_event {
+
+   uint32_t type;       /**< One of the TFB_EV_* values */
+   uint32_t code;       /**< evdev code of the key or the button */
+   tfb_key_t key;       /**< The TTY keystroke (TFB_EV_TTY_KEY events) */
+   uint64_t time_ns;    /**< CLOCK_MONOTONIC time of the event, in ns. For
+                             evdev events, it's the kernel's timestamp. */
+
+   int32_t x;           /**< Pointer position, in screen coordinates */
+   int32_t y;           /**< Pointer position, in screen coordinates */
+   int32_t dx;          /**< Pointer motion (or wheel rotation, for dy) */
+   int32_t dy;          /**< Pointer motion (or wheel rotation, for dy) */
+};
+
+/**
+ * Open an evdev input device
+ *
+ * Unlike the TTY input, evdev devices report key releases and allow any
+ * number of keys to be held down at the same time, without any escape
+ * sequence parsing. Mice (relative) and touchscreens (absolute) are supported
+ * as well: the events of all the devices go to the same queue and there is a
+ * single pointer position, in screen coordinates.
+ *
+ * Consecutive motion events still in the queue are coalesced into a single
+ * one, so that a high-rate mouse doesn't flood the application. No event is
+ * ever dropped by the library: when its queue is full, the events are left in
+ * the kernel's buffers until the application reads more.
+ *
+ * @param[in]  device   The device file (e.g. /dev/input/event0) or NULL. In
+ *                      the latter case, all the keyboards, mice and
+ *                      touchscreens found in /dev/input are opened.
+ *
+ * @param[in]  flags    Default value: 0. The only currently supported flag
+ *                      is #TFB_FL_INPUT_GRAB.
+ *
+ * @return              #TFB_SUCCESS in case of success or
+ *                      #TFB_ERR_OPEN_INPUT.
+ *
+ * \note Reading from /dev/input/event* usually requires root privileges or
+ *       to be member of the 'input' group.
+ */
+int tfb_open_input_device(const char *device, uint32_t flags);
+
+/**
+ * Set the calibration of the touchscreens
+ *
+ * By default, the range of the absolute axes reported by the devices is mapped
+ * to the whole screen. When the reported range is not accurate, the actual
+ * raw values at the edges of the screen can be set here. Inverted axes are
+ * supported by passing x_min > x_max (or y_min > y_max). Passing all zeros
+ * restores the default.
+ *
+ * @param[in]  x_min    Raw value of the X axis at the left edge
+ * @param[in]  x_max    Raw value of the X axis at the right edge
+ * @param[in]  y_min    Raw value of the Y axis at the top edge
+ * @param[in]  y_max    Raw value of the Y axis at the bottom edge
+ */
+void tfb_set_touch_calibration(int x_min, int x_max, int y_min, int y_max);
+
+/**
+ * Close all the evdev input devices opened with tfb_open_input_device()
+ */
+void tfb_close_input_devices(void);
+
+/**
+ * Read an event from the evdev input devices, without blocking
+ *
+ * @param[out] ev       Address of the event to fill
+ *
+ * @return              true if an event has been read, false otherwise.
+ */
+bool tfb_read_event(struct tfb_event *ev);
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * Event loop functions and definitions
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * Callback type for input events, see tfb_loop_set_event_cb()
+ */
+typedef void (*tfb_event_cb)(const struct tfb_event *ev, void *user_arg);
+
+/**
+ * Callback type for timers and frame ticks
+ */
+typedef void (*tfb_timer_cb)(void *user_arg);
+
+/**
+ * Set the callback called by tfb_loop_run() for each input event
+ *
+ * @param[in]  cb          The callback. NULL removes it.
+ * @param[in]  user_arg    An arbitrary pointer passed to the callback
+ */
+void tfb_loop_set_event_cb(tfb_event_cb cb, void *user_arg);
+
+/**
+ * Add a periodic timer to the event loop
+ *
+ * @param[in]  period_us   Period of the timer, in microseconds
+ * @param[in]  cb          The callback
+ * @param[in]  user_arg    An arbitrary pointer passed to the callback
+ * @param[out] timer_id    Address of an int variable set to the timer's id.
+ *                         Can be NULL.
+ *
+ * @return                 #TFB_SUCCESS in case of success or
+ *                         #TFB_ERR_LOOP_SETUP_FAILED.
+ *
+ * \note    When the loop is late, the missed expirations are coalesced: the
+ *          callback is called just once.
+ */
+int tfb_loop_add_timer(uint32_t period_us, tfb_timer_cb cb,
+                       void *user_arg, int *timer_id);
+
+/**
+ * Remove a timer added with tfb_loop_add_timer()
+ *
+ * @param[in]  timer_id    The id of the timer
+ */
+void tfb_loop_remove_timer(int timer_id);
+
+/**
+ * Set the frame tick callback of the event loop
+ *
+ * The frame callback is like a timer, but in each iteration of the loop it's
+ * called after all the input events and the timers have been handled, so
+ * that every frame reflects all the input received until then. While a frame
+ * callback is set, the pointer motion is held until the next frame and
+ * coalesced into a single event. The key, button and wheel events are still
+ * delivered as soon as they arrive, preceded by any motion before them, so
+ * that they're never delayed by a low frame rate or lost while the VT is not
+ * active (when the frame ticks stop).
+ *
+ * @param[in]  fps         Frames per second. 0 removes the frame callback.
+ * @param[in]  cb          The callback, typically drawing and flushing
+ * @param[in]  user_arg    An arbitrary pointer passed to the callback
+ *
+ * @return                 #TFB_SUCCESS in case of success or
+ *                         #TFB_ERR_LOOP_SETUP_FAILED.
+ */
+int tfb_loop_set_frame_cb(uint32_t fps, tfb_timer_cb cb, void *user_arg);
+
+/**
+ * Run the event loop until tfb_loop_quit() is called
+ *
+ * tfb_loop_run() waits on the evdev devices, the TTY, the timers and the
+ * frame ticks all at once with epoll, so that the application never needs to
+ * poll for input or to sleep.
+ *
+ * @return                 #TFB_SUCCESS in case of success or
+ *                         #TFB_ERR_LOOP_SETUP_FAILED.
+ *
+ * \note The keystrokes from the TTY are delivered as #TFB_EV_TTY_KEY events
+ *       only when the TTY is in raw mode with #TFB_FL_KB_NONBLOCK.
+ */
+int tfb_loop_run(void);
+
+/**
+ * Make tfb_loop_run() return, after the current iteration
+ *
+ * Meant to be called from one of the loop's callbacks.
+ */
+void tfb_loop_quit(void);
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * Input latency instrumentation
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/// Number of buckets in the latency histogram
+#define TFB_LAT_BUCKETS          128
+
+/// Width of each bucket of the latency histogram, in microseconds
+#define TFB_LAT_BUCKET_US        250
+
+/**
+ * Input latency statistics
+ *
+ * A sample is the time between a keystroke (or any other input event) and the
+ * end of the first flush after it has been read by the library. For evdev
+ * devices the time of the keystroke is the kernel's timestamp, while for the
+ * TTY it's the time of the read() call.
+ */
+struct tfb_latency_stats {
+
+   uint32_t count;            /**< Number of samples */
+   uint64_t min_ns;           /**< Min latency */
+   uint64_t max_ns;           /**< Max latency */
+   uint64_t mean_ns;          /**< Mean latency */
+   uint64_t p50_ns;           /**< Median, with the bucket's resolution */
+   uint64_t p90_ns;           /**< 90th percentile */
+   uint64_t p99_ns;           /**< 99th percentile */
+
+   /** Histogram: the last bucket includes all the larger samples as well */
+   uint32_t hist[TFB_LAT_BUCKETS];
+};
+
+/**
+ * Enable or disable the input latency instrumentation
+ *
+ * Enabling the instrumentation resets all the statistics. While disabled (the
+ * default), the cost on the input and flush paths is a single branch.
+ *
+ * @param[in]  enable   true to enable, false to disable
+ */
+void tfb_latency_enable(bool enable);
+
+/**
+ * Get the input latency statistics collected so far
+ *
+ * @param[out] stats    Address of the struct to fill
+ */
+void tfb_latency_get_stats(struct tfb_latency_stats *stats);
+
+/**
+ * Write the most recent latency samples to a CSV file
+ *
+ * The columns are: code (the evdev code or the TTY key), kernel_ns, read_ns,
+ * flush_ns and latency_us. All the times are in CLOCK_MONOTONIC, and
+ * kernel_ns is 0 for the TTY.
+ *
+ * @param[in]  path     The output file
+ *
+ * @return              #TFB_SUCCESS in case of success or
+ *                      #TFB_ERR_WRITE_FILE_FAILED.
+ */
+int tfb_latency_dump_csv(const char *path);
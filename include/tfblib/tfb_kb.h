@@ -72,14 +72,96 @@ int tfb_restore_kb_mode(void);
  */
 tfb_key_t tfb_read_keypress(void);
 
+/**
+ * Read all the available keystrokes at once
+ *
+ * Decodes all the keystrokes already read from the TTY (and the ones that
+ * can be read without blocking), up to max_keys. In blocking mode, it blocks
+ * only if there is no keystroke at all to return.
+ *
+ * @param[out] keys        An array of at least max_keys elements
+ * @param[in]  max_keys    The max number of keys to read
+ *
+ * @return                 The number of keystrokes stored in 'keys'
+ *
+ * \note Escape sequences longer than sizeof(tfb_key_t) bytes are consumed
+ *       entirely and returned with their final byte in the last byte of the
+ *       key value.
+ */
+int tfb_read_keypresses(tfb_key_t *keys, int max_keys);
+
 /**
  * Get the number of the F key corresponding to 'k'
  *
- * @return              A number in the range [1, 12] in case 'k' is equal to
- *                      one of the TFB_KEY_F* values. Otherwise, return 0.
+ * @return              A number in the range [1, 12] in case 'k' is one of the
+ *                      F keys (in any of the supported variants and with any
+ *                      modifier). Otherwise, return 0.
  */
 int tfb_get_fn_key_num(tfb_key_t k);
 
+/**
+ * Symbolic values for the special keys, see tfb_get_key_sym()
+ */
+enum tfb_key_sym {
+
+   TFB_SYM_NONE,        /**< Not a special key (e.g. a regular character) */
+
+   TFB_SYM_UP,
+   TFB_SYM_DOWN,
+   TFB_SYM_RIGHT,
+   TFB_SYM_LEFT,
+   TFB_SYM_HOME,
+   TFB_SYM_END,
+   TFB_SYM_INS,
+   TFB_SYM_DEL,
+   TFB_SYM_PAGE_UP,
+   TFB_SYM_PAGE_DOWN,
+   TFB_SYM_KP_CENTER,   /**< Key 5 of the keypad, with NumLock off */
+   TFB_SYM_BACK_TAB,    /**< Shift + Tab */
+
+   TFB_SYM_F1,          /**< F1 ... F12 are guaranteed to be consecutive */
+   TFB_SYM_F2,
+   TFB_SYM_F3,
+   TFB_SYM_F4,
+   TFB_SYM_F5,
+   TFB_SYM_F6,
+   TFB_SYM_F7,
+   TFB_SYM_F8,
+   TFB_SYM_F9,
+   TFB_SYM_F10,
+   TFB_SYM_F11,
+   TFB_SYM_F12,
+};
+
+/**
+ * \addtogroup KeyModifiers Key modifiers
+ * @{
+ */
+
+#define TFB_MOD_SHIFT   (1 << 0)   ///< Shift was held down
+#define TFB_MOD_ALT     (1 << 1)   ///< Alt was held down
+#define TFB_MOD_CTRL    (1 << 2)   ///< Ctrl was held down
+#define TFB_MOD_META    (1 << 3)   ///< Meta was held down
+
+/** @} */
+
+/**
+ * Decode a keystroke into a symbolic key and its modifiers
+ *
+ * Recognizes the CSI (ESC [) and SS3 (ESC O) sequences sent by the Linux
+ * console and by xterm-compatible terminals, including the xterm modifier
+ * parameter (e.g. ESC [1;5A for Ctrl + Up). The decoding is table-driven and
+ * takes constant time.
+ *
+ * @param[in]  k        A keystroke returned by tfb_read_keypress()
+ * @param[out] mods     Address of a variable set to the TFB_MOD_* bits of the
+ *                      key. Can be NULL.
+ *
+ * @return              One of the #tfb_key_sym values. #TFB_SYM_NONE when 'k'
+ *                      is not a special key.
+ */
+enum tfb_key_sym tfb_get_key_sym(tfb_key_t k, uint32_t *mods);
+
 
 #define TFB_KEY_ENTER   ((tfb_key_t)10)
 #define TFB_KEY_UP      (*(tfb_key_t*)("\e[A\0\0\0\0\0"))
@@ -90,6 +172,8 @@ int tfb_get_fn_key_num(tfb_key_t k);
 #define TFB_KEY_DEL     (*(tfb_key_t*)("\e[3~\0\0\0\0\0"))
 #define TFB_KEY_HOME    (*(tfb_key_t*)("\e[1~\0\0\0\0\0"))
 #define TFB_KEY_END     (*(tfb_key_t*)("\e[4~\0\0\0\0\0"))
+#define TFB_KEY_PGUP    (*(tfb_key_t*)("\e[5~\0\0\0\0\0"))
+#define TFB_KEY_PGDN    (*(tfb_key_t*)("\e[6~\0\0\0\0\0"))
 
 #define TFB_KEY_F1      (tfb_int_fn_key_sequences[0])
 #define TFB_KEY_F2      (tfb_int_fn_key_sequences[1])
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/**
+ * @file tfb_shared.h
+ * @brief Tfblib's shared back buffer, for viewers running in other processes
+ *
+ * With #TFB_FL_SHARED_BUFFER, the back buffer lives in a memfd: another
+ * process can map it (e.g. through /proc/PID/fd/N, or receiving the file
+ * descriptor over a UNIX socket) and read the pixels directly from there,
+ * with no copies made by the renderer.
+ *
+ * The file starts with a struct tfb_shared_header and the pixels follow at
+ * the offset 'header_size', as 'height' rows of 'pitch' bytes. Each flush
+ * publishes the flushed rect in the header, under a sequence counter which is
+ * odd while the header is being updated (a seqlock). A viewer reads the header
+ * this way:
+ *
+ *    do {
+ *       seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+ *       ... read rect_count and the rects ...
+ *       __atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *    } while ((seq & 1) || seq != __atomic_load_n(&h->seq, __ATOMIC_RELAXED));
+ *
+ * and then copies (or displays) the rects published since the last time it
+ * looked. If more than #TFB_SHARED_RECTS rects have been published in the
+ * meanwhile, the oldest ones are gone: just take the whole screen.
+ *
+ * \note The renderer never waits for the viewers and 'seq' changes only when
+ *       flushing: between two flushes, the renderer keeps drawing the next
+ *       frame directly in the shared pixels, without touching it. So a copy
+ *       of the pixels can always contain partly drawn content, even when
+ *       'seq' has not changed while making it. Checking 'seq' only tells
+ *       that no flush happened in the meanwhile, i.e. that the list of the
+ *       rects read before the copy is still the latest one.
+ */
+
+#pragma once
+#include <stdint.h>
+
+/// The value of tfb_shared_header's 'magic' field: "TFB1"
+#define TFB_SHARED_MAGIC         0x31424654
+
+/// The number of rects kept in tfb_shared_header
+#define TFB_SHARED_RECTS         64
+
+/**
+ * A flushed rect, in screen coordinates
+ */
+struct tfb_shared_rect {
+
+   uint32_t x;
+   uint32_t y;
+   uint32_t w;
+   uint32_t h;
+};
+
+/**
+ * The header at the beginning of the shared back buffer
+ */
+struct tfb_shared_header {
+
+   uint32_t magic;            /**< #TFB_SHARED_MAGIC */
+   uint32_t header_size;      /**< Offset of the pixels in the file */
+   uint32_t width;            /**< Screen width, in pixels */
+   uint32_t height;           /**< Screen height, in pixels */
+   uint32_t pitch;            /**< Bytes per row of pixels */
+   uint32_t bits_per_pixel;   /**< 16, 24 or 32 */
+
+   uint8_t red_pos;           /**< First bit of the red channel */
+   uint8_t red_len;           /**< Bits of the red channel */
+   uint8_t green_pos;         /**< First bit of the green channel */
+   uint8_t green_len;         /**< Bits of the green channel */
+   uint8_t blue_pos;          /**< First bit of the blue channel */
+   uint8_t blue_len;          /**< Bits of the blue channel */
+   uint8_t reserved[2];
+
+   uint32_t seq;              /**< Sequence counter, odd during updates */
+   uint32_t rect_count;       /**< Rects published so far (wraps around) */
+
+   /** Rect number N is in rects[N % #TFB_SHARED_RECTS] */
+   struct tfb_shared_rect rects[TFB_SHARED_RECTS];
+};
+
+/**
+ * Get the file descriptor of the shared back buffer
+ *
+ * @return     The memfd's file descriptor or -1 when tfb_acquire_fb() has not
+ *             been called with #TFB_FL_SHARED_BUFFER.
+ */
+int tfb_get_shared_fd(void);
@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/**
+ * @file tfb_video.h
+ * @brief Tfblib's video playback and recording functions and definitions
+ */
+
+#pragma once
+#include <stdint.h>
+
+/**
+ * \addtogroup VideoFormats Video formats
+ * @{
+ */
+
+/// YUV4MPEG2 files with 4:2:0 chroma subsampling (e.g. ffmpeg -f yuv4mpegpipe)
+#define TFB_VIDEO_Y4M            1
+
+/// Headerless files of XRGB8888 frames, one after the other
+#define TFB_VIDEO_RAW_XRGB       2
+
+/** @} */
+
+/**
+ * \addtogroup VideoFlags Video playback flags
+ * @{
+ */
+
+/// Start again from the first frame after the last one, until stopped
+#define TFB_VIDEO_LOOP           (1 << 0)
+
+/** @} */
+
+/**
+ * Basic information about a video file
+ */
+struct tfb_video_info {
+
+   uint32_t width;         /**< Width of the frames, in pixels */
+   uint32_t height;        /**< Height of the frames, in pixels */
+   uint32_t format;        /**< One of the TFB_VIDEO_* values */
+   uint32_t frames;        /**< Number of complete frames in the file */
+   uint32_t fps_num;       /**< Frame rate numerator */
+   uint32_t fps_den;       /**< Frame rate denominator */
+};
+
+/**
+ * Opaque video file type
+ */
+typedef void *tfb_video_t;
+
+/**
+ * Open a Y4M video file
+ *
+ * The file is mapped in memory and its frames are indexed, but nothing is
+ * decoded. Only the 4:2:0 chroma formats are supported. The colors are
+ * converted as BT.601, in limited range unless the header has the
+ * XCOLORRANGE=FULL parameter.
+ *
+ * @param[in]  file     The Y4M file
+ * @param[out] video    Address of a tfb_video_t variable that will be set by
+ *                      the function in case of success.
+ *
+ * @return              #TFB_SUCCESS in case of success or one of the
+ *                      following errors:
+ *                          #TFB_ERR_READ_FILE_FAILED,
+ *                          #TFB_ERR_INVALID_IMAGE (invalid or unsupported),
+ *                          #TFB_ERR_OUT_OF_MEMORY.
+ */
+int tfb_open_video(const char *file, tfb_video_t *video);
+
+/**
+ * Open a file of raw XRGB8888 frames
+ *
+ * The file has no header: it's just a sequence of w * h pixels frames, as
+ * made by e.g. ffmpeg -f rawvideo -pix_fmt bgr0. A trailing incomplete frame
+ * is ignored.
+ *
+ * @param[in]  file     The file
+ * @param[in]  w        Width of the frames
+ * @param[in]  h        Height of the frames
+ * @param[in]  fps      Frames per second
+ * @param[out] video    Address of a tfb_video_t variable that will be set by
+ *                      the function in case of success.
+ *
+ * @return              Like tfb_open_video().
+ */
+int tfb_open_raw_video(const char *file, uint32_t w, uint32_t h,
+                       uint32_t fps, tfb_video_t *video);
+
+/**
+ * Close a video opened with tfb_open_video() or tfb_open_raw_video()
+ *
+ * @param[in]  video    The video to close. Can be NULL.
+ */
+void tfb_close_video(tfb_video_t video);
+
+/**
+ * Get the information about an open video
+ */
+void tfb_get_video_info(tfb_video_t video, struct tfb_video_info *info);
+
+/**
+ * Draw a single frame of a video at (x, y)
+ *
+ * The frame is converted row by row directly to the native pixel format, in
+ * the framebuffer (or in the back buffer, with #TFB_FL_USE_DOUBLE_BUFFER).
+ * Only the part inside the current window is converted. Useful for
+ * applications running their own loop: the flush is up to the caller.
+ *
+ * @param[in]  x        Window-relative X coordinate of the top-left corner
+ * @param[in]  y        Window-relative Y coordinate of the top-left corner
+ * @param[in]  video    An open video
+ * @param[in]  frame    Index of the frame, from 0
+ *
+ * @return              #TFB_SUCCESS in case of success or one of the
+ *                      following errors:
+ *                          #TFB_ERR_INVALID_IMAGE (no such frame),
+ *                          #TFB_ERR_OUT_OF_MEMORY.
+ */
+int tfb_draw_video_frame(int x, int y, tfb_video_t video, uint32_t frame);
+
+/**
+ * Play a video at (x, y), at its own frame rate
+ *
+ * A producer thread converts the next frame into one of two frame buffers,
+ * already in the native pixel format, while the calling thread waits for the
+ * frame's deadline, copies the current one to the screen and flushes it. That
+ * way, the decoding of a frame overlaps with the display of the previous one.
+ * When the conversion is slower than the frame rate, the producer skips to the
+ * frame due at the current time, so that the playback doesn't drift: it just
+ * shows fewer frames. Blocks until the end of the video or until
+ * tfb_stop_video() is called.
+ *
+ * @param[in]  x        Window-relative X coordinate of the top-left corner
+ * @param[in]  y        Window-relative Y coordinate of the top-left corner
+ * @param[in]  video    An open video
+ * @param[in]  flags    Zero or #TFB_VIDEO_LOOP
+ *
+ * @return              #TFB_SUCCESS in case of success or one of the
+ *                      following errors:
+ *                          #TFB_ERR_THREAD_CREATE_FAILED,
+ *                          #TFB_ERR_OUT_OF_MEMORY.
+ */
+int tfb_play_video(int x, int y, tfb_video_t video, uint32_t flags);
+
+/**
+ * Make tfb_play_video() return, after the current frame
+ *
+ * Can be called from another thread or from a signal handler.
+ */
+void tfb_stop_video(tfb_video_t video);
+
+/**
+ * Start recording all the flushed frames to a file
+ *
+ * From now on, each call to tfb_flush_rect() or tfb_flush_window() appends a
+ * record with the flushed rect to the file, compressed with QOI. Every
+ * 'keyframe_interval' records, the whole screen is recorded instead, so that
+ * a replay can start from there. The flushing thread just copies the rect's
+ * pixels into one of a few preallocated slots: the compression and the
+ * writing happen in a background thread. When all the slots are full (the
+ * background thread is late), the flush waits: no frame is ever dropped.
+ *
+ * The recordings can be replayed and compared pixel by pixel with the
+ * tfb_replay tool. Must be called after tfb_acquire_fb().
+ *
+ * @param[in]  file              The output file
+ * @param[in]  keyframe_interval Records between keyframes. With 0, only the
+ *                               first record is a keyframe.
+ *
+ * @return                 #TFB_SUCCESS in case of success or one of the
+ *                         following errors:
+ *                             #TFB_ERR_WRITE_FILE_FAILED,
+ *                             #TFB_ERR_THREAD_CREATE_FAILED,
+ *                             #TFB_ERR_OUT_OF_MEMORY.
+ *
+ * \note The memory used is about 5 times the size of the framebuffer.
+ */
+int tfb_start_recording(const char *file, uint32_t keyframe_interval);
+
+/**
+ * Stop recording, after writing all the pending records
+ *
+ * Called automatically by tfb_release_fb().
+ *
+ * @return                 #TFB_SUCCESS in case of success or
+ *                         #TFB_ERR_WRITE_FILE_FAILED if any record could not
+ *                         be written.
+ */
+int tfb_stop_recording(void);
@@ -51,9 +51,111 @@
  * tfb_flush_rect(). This flag is useful for applications needing to clean and
  * redraw the whole screen (or part of it) very often (e.g. games) in order to
  * avoid the annoying flicker effect.
+ *
+ * The back buffer is allocated with huge pages, when possible, and its rows
+ * start on a cache line: its pitch might be bigger than the framebuffer's.
  */
 #define TFB_FL_USE_DOUBLE_BUFFER    (1 << 1)
 
+/**
+ * Handle the VT switches.
+ *
+ * Passing this flag to tfb_acquire_fb() makes the library take control of the
+ * VT switches (VT_SETMODE with VT_PROCESS), using the signals SIGUSR1 (release)
+ * and SIGUSR2 (acquire). While the VT is not active, all the flushes are
+ * suspended and the frame callback of the event loop is not called. When the
+ * VT is active again, the redraw callback set with tfb_set_redraw_callback()
+ * is called or, if there is none, the whole back buffer is flushed.
+ *
+ * \note Meant to be used with #TFB_FL_USE_DOUBLE_BUFFER: without a back buffer
+ *       the drawing functions write directly to the framebuffer.
+ */
+#define TFB_FL_VT_PROCESS           (1 << 4)
+
+/**
+ * Draw in XRGB8888 and convert to the framebuffer's format on flush.
+ *
+ * Passing this flag to tfb_acquire_fb() makes it allocate a back buffer (as
+ * with #TFB_FL_USE_DOUBLE_BUFFER) which is always in the XRGB8888 format, no
+ * matter the actual video mode. All the drawing functions use the 32-bit
+ * paths and the pixels are converted to the framebuffer's format (e.g.
+ * RGB565, RGB555 or 24 bpp) by tfb_flush_rect(), using SIMD kernels where
+ * available. On 32 bpp video modes, it's the same as
+ * #TFB_FL_USE_DOUBLE_BUFFER.
+ */
+#define TFB_FL_CONVERT_ON_FLUSH     (1 << 5)
+
+/**
+ * Use ordered dithering when converting to a lower color depth.
+ *
+ * Meaningful only along with #TFB_FL_CONVERT_ON_FLUSH. The precision lost when
+ * converting to a 15 or 16-bit video mode is turned into a fine, regular
+ * pattern instead of visible bands in the gradients.
+ */
+#define TFB_FL_DITHER               (1 << 6)
+
+/**
+ * Put the back buffer in shared memory, for a viewer in another process.
+ *
+ * Implies #TFB_FL_USE_DOUBLE_BUFFER. The back buffer is allocated in a memfd
+ * (see tfb_get_shared_fd()) which starts with a header describing the pixel
+ * format and where each flush publishes the flushed rect, without locks. A
+ * local viewer or screenshot tool can map it and mirror the frames with no
+ * copies made by the renderer. See tfb_shared.h for the details.
+ */
+#define TFB_FL_SHARED_BUFFER        (1 << 7)
+
+/**
+ * Fault-in all the pages of the back buffer in tfb_acquire_fb().
+ *
+ * Meaningful only along with #TFB_FL_USE_DOUBLE_BUFFER (or any flag implying
+ * it). Otherwise, the pages are faulted-in the first time they are touched,
+ * typically while drawing and flushing the first frame, making it much slower
+ * than the following ones.
+ */
+#define TFB_FL_PREFAULT_BUFFER      (1 << 8)
+
+/**
+ * Don't copy to the framebuffer what has not changed since the last flush.
+ *
+ * Implies #TFB_FL_USE_DOUBLE_BUFFER. Each row of the screen is split in tiles
+ * of 64 pixels and a fast hash of each tile last copied to the framebuffer is
+ * kept: tfb_flush_rect() hashes the tiles of the rect and copies only the
+ * ones whose hash changed. Meant for applications redrawing everything on
+ * each frame, while only a small part of it actually changes. See
+ * tfb_get_flush_stats().
+ */
+#define TFB_FL_SKIP_UNCHANGED       (1 << 9)
+
+/**
+ * Copy to the framebuffer in a dedicated thread.
+ *
+ * Implies #TFB_FL_USE_DOUBLE_BUFFER. tfb_flush_rect() just snapshots the rect
+ * in one of two additional buffers and hands it over to a flush thread, which
+ * copies (or converts) it to the framebuffer while the application goes on
+ * with the next frame. At most two flushes can be queued: when both are, the
+ * next tfb_flush_rect() waits for the oldest one. See tfb_wait_flush().
+ *
+ * \note The memory used is 3 times the size of the back buffer.
+ */
+#define TFB_FL_ASYNC_FLUSH          (1 << 10)
+
+/**
+ * Use three back buffers, presenting always the newest complete frame.
+ *
+ * Implies #TFB_FL_USE_DOUBLE_BUFFER and disables #TFB_FL_SHARED_BUFFER and
+ * #TFB_FL_ASYNC_FLUSH. Each call to tfb_flush_rect() or tfb_flush_window()
+ * publishes the whole frame and switches the drawing to a free buffer,
+ * without ever waiting: a presenter thread waits for the vertical sync (when
+ * the driver supports FBIO_WAITFORVSYNC) and copies the newest published
+ * frame to the framebuffer. The frames published faster than they can be
+ * presented are dropped. See tfb_get_flush_stats().
+ *
+ * \note The new drawing buffer contains an older frame, not the one just
+ *       published: each frame must be drawn entirely.
+ */
+#define TFB_FL_TRIPLE_BUFFER        (1 << 11)
+
 /** @} */
 
 /**
@@ -63,7 +165,11 @@
  * functions, including the tfb_clear_* and tfb_flush_* functions.
  *
  * @param[in] flags        One or more among: #TFB_FL_NO_TTY_KD_GRAPHICS,
- *                         #TFB_FL_USE_DOUBLE_BUFFER.
+ *                         #TFB_FL_USE_DOUBLE_BUFFER, #TFB_FL_VT_PROCESS,
+ *                         #TFB_FL_CONVERT_ON_FLUSH, #TFB_FL_DITHER,
+ *                         #TFB_FL_SHARED_BUFFER, #TFB_FL_PREFAULT_BUFFER,
+ *                         #TFB_FL_SKIP_UNCHANGED, #TFB_FL_ASYNC_FLUSH,
+ *                         #TFB_FL_TRIPLE_BUFFER.
  *
  * @param[in] fb_device    The framebuffer device file. Can be NULL.
  *                         Defaults to /dev/fb0.
@@ -78,7 +184,8 @@
  *                             #TFB_ERR_UNSUPPORTED_VIDEO_MODE,
  *                             #TFB_ERR_TTY_GRAPHIC_MODE,
  *                             #TFB_ERR_MMAP_FB,
- *                             #TFB_ERR_OUT_OF_MEMORY.
+ *                             #TFB_ERR_OUT_OF_MEMORY,
+ *                             #TFB_ERR_VT_SETMODE_FAILED.
  *
  * \note This function does not affect the kb mode. tfb_set_kb_raw_mode() can
  *       be called before or after tfb_acquire_fb().
@@ -98,6 +205,31 @@ int tfb_acquire_fb(u32 flags, const char *fb_device, const char *tty_device);
  */
 void tfb_release_fb(void);
 
+/**
+ * Callback type for tfb_set_redraw_callback()
+ */
+typedef void (*tfb_redraw_cb)(void *user_arg);
+
+/**
+ * Set the callback used to redraw the whole screen after a VT switch
+ *
+ * Used only when tfb_acquire_fb() has been called with #TFB_FL_VT_PROCESS.
+ * The callback is never called from the signal handler: it's called by the
+ * next flush (before flushing) or by the event loop, as soon as possible.
+ *
+ * @param[in]  cb          The callback. NULL removes it.
+ * @param[in]  user_arg    An arbitrary pointer passed to the callback
+ */
+void tfb_set_redraw_callback(tfb_redraw_cb cb, void *user_arg);
+
+/**
+ * Check if our VT is the active one
+ *
+ * @return  false if the VT has been released because of a VT switch (see
+ *          #TFB_FL_VT_PROCESS), true otherwise.
+ */
+bool tfb_is_vt_active(void);
+
 /**
  * Limit the drawing to a window at (x, y) having size (w, h)
  *
@@ -129,6 +261,36 @@ int tfb_set_window(u32 x, u32 y, u32 w, u32 h);
   */
 int tfb_set_center_window_size(u32 w, u32 h);
 
+/**
+ * Limit the drawing to a rect, without changing the coordinate system
+ *
+ * Pushes a clip rect on a stack: from now on, all the drawing functions cut
+ * off everything outside of both the window and the rect. The rect is also
+ * intersected with the previous one on the stack (if any), so nested clips
+ * can only shrink. Useful e.g. to redraw a single widget, or part of it,
+ * without any overdraw outside of its bounds. Up to 32 rects can be pushed.
+ *
+ * @param[in] x      Window-relative X coordinate of the rect
+ * @param[in] y      Window-relative Y coordinate of the rect
+ * @param[in] w      Width of the rect, in pixels
+ * @param[in] h      Height of the rect, in pixels
+ *
+ * @return           #TFB_SUCCESS in case of success or
+ *                   #TFB_ERR_CLIP_STACK_FULL.
+ *
+ * \note The rects are stored in screen coordinates: calling tfb_set_window()
+ *       afterwards doesn't move them, it just clips them to the new window.
+ *       The flush functions always work on the whole window.
+ */
+int tfb_push_clip_rect(int x, int y, int w, int h);
+
+/**
+ * Restore the clip in effect before the last tfb_push_clip_rect()
+ *
+ * Does nothing when the stack is empty.
+ */
+void tfb_pop_clip_rect(void);
+
 
 
 /*
@@ -311,6 +473,92 @@ inline u32 tfb_make_color(u8 r, u8 g, u8 b);
 
 u32 tfb_make_color_hsv(u32 h, u8 s, u8 v);
 
+/**
+ * An RGB color, see tfb_make_colors()
+ */
+struct tfb_rgb {
+   u8 r;       /**< Red color component [0, 255] */
+   u8 g;       /**< Green color component [0, 255] */
+   u8 b;       /**< Blue color component [0, 255] */
+};
+
+/**
+ * An HSV color, see tfb_make_colors_hsv()
+ */
+struct tfb_hsv {
+   u32 h;      /**< Hue [0, 360 * #TFB_HUE_DEGREE] */
+   u8 s;       /**< Saturation [0, 255] */
+   u8 v;       /**< Value (Brightness) [0, 255] */
+};
+
+/**
+ * Convert an array of RGB colors to the representation of the current mode
+ *
+ * The same as calling tfb_make_color() for each element, but with kernels
+ * specialized for the current video mode. On x86, an SSE2 kernel converts 16
+ * colors at a time, about twice as fast as tfb_make_color() for XRGB8888.
+ *
+ * @param[out] dst      Array of 'n' elements, for the converted colors
+ * @param[in]  src      Array of 'n' RGB colors
+ * @param[in]  n        Number of colors
+ */
+void tfb_make_colors(u32 *dst, const struct tfb_rgb *src, u32 n);
+
+/**
+ * Convert an array of HSV colors to the representation of the current mode
+ *
+ * Gives exactly the same results as calling tfb_make_color_hsv() for each
+ * element, but several colors are converted at once with SIMD instructions,
+ * where available.
+ *
+ * @param[out] dst      Array of 'n' elements, for the converted colors
+ * @param[in]  src      Array of 'n' HSV colors
+ * @param[in]  n        Number of colors
+ */
+void tfb_make_colors_hsv(u32 *dst, const struct tfb_hsv *src, u32 n);
+
+/**
+ * An opaque identifier of an HSV palette, see tfb_make_hsv_palette()
+ */
+typedef void *tfb_hsv_palette_t;
+
+/**
+ * Precompute all the colors with a given saturation
+ *
+ * The palette is a lookup table with one entry per degree of hue and value
+ * (361 x 256 colors, about 360 KB). Converting a color with it costs just a
+ * load, at the price of rounding the hue down to a whole degree.
+ *
+ * @param[in]  s        Saturation of all the colors in the palette
+ * @param[out] palette  Address of a tfb_hsv_palette_t variable that will
+ *                      be set to the identifier of the new palette
+ *
+ * @return              #TFB_SUCCESS in case of success or
+ *                      #TFB_ERR_OUT_OF_MEMORY.
+ *
+ * \note The colors depend on the video mode: the palette must be created
+ *       after tfb_acquire_fb().
+ */
+int tfb_make_hsv_palette(u8 s, tfb_hsv_palette_t *palette);
+
+/**
+ * Free a palette created with tfb_make_hsv_palette()
+ *
+ * @param[in]  palette  The palette's identifier
+ */
+void tfb_free_hsv_palette(tfb_hsv_palette_t palette);
+
+/**
+ * Convert an array of HSV colors using a palette
+ *
+ * @param[out] dst      Array of 'n' elements, for the converted colors
+ * @param[in]  palette  A palette created with tfb_make_hsv_palette()
+ * @param[in]  src      Array of 'n' HSV colors. Their saturation is ignored.
+ * @param[in]  n        Number of colors
+ */
+void tfb_make_colors_hsv_palette(u32 *dst, tfb_hsv_palette_t palette,
+                                 const struct tfb_hsv *src, u32 n);
+
 /**
  * Set the color of the pixel at (x, y) to 'color'
  *
@@ -412,6 +660,134 @@ void tfb_draw_circle(int cx, int cy, int r, u32 color);
  */
 void tfb_fill_circle(int cx, int cy, int r, u32 color);
 
+/**
+ * \addtogroup flags Flags
+ * @{
+ */
+
+/**
+ * Fill rule for tfb_fill_polygon(): a pixel is inside the polygon when a ray
+ * starting from it crosses the polygon's edges an odd number of times.
+ */
+#define TFB_FILL_EVEN_ODD    0
+
+/**
+ * Fill rule for tfb_fill_polygon(): a pixel is inside the polygon when the
+ * winding number of the polygon's edges around it is not zero.
+ */
+#define TFB_FILL_NONZERO     1
+
+/** @} */
+
+/**
+ * A point with integer coordinates
+ */
+struct tfb_point {
+
+   int x;      /**< X coordinate, in pixels */
+   int y;      /**< Y coordinate, in pixels */
+};
+
+/**
+ * Draw a filled triangle on-screen
+ *
+ * @param[in]  x0       Window-relative X coordinate of the first vertex
+ * @param[in]  y0       Window-relative Y coordinate of the first vertex
+ * @param[in]  x1       Window-relative X coordinate of the second vertex
+ * @param[in]  y1       Window-relative Y coordinate of the second vertex
+ * @param[in]  x2       Window-relative X coordinate of the third vertex
+ * @param[in]  y2       Window-relative Y coordinate of the third vertex
+ * @param[in]  color    Triangle's color
+ *
+ * The triangle is rasterized one horizontal span per row, stepping its edges
+ * incrementally. Only the rows inside the current window are visited.
+ */
+void tfb_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
+                       u32 color);
+
+/**
+ * Draw a filled polygon on-screen
+ *
+ * @param[in]  points   Array of the polygon's vertices (window-relative).
+ *                      The polygon is implicitly closed.
+ * @param[in]  n        Number of vertices
+ * @param[in]  color    Polygon's color
+ * @param[in]  rule     Either #TFB_FILL_EVEN_ODD or #TFB_FILL_NONZERO.
+ *
+ * @return              #TFB_SUCCESS in case of success or
+ *                      #TFB_ERR_OUT_OF_MEMORY.
+ *
+ * The polygon can be concave and self-intersecting: 'rule' determines which
+ * regions are considered inside it.
+ */
+int tfb_fill_polygon(const struct tfb_point *points, int n,
+                     u32 color, int rule);
+
+/**
+ * Fill a rectangle with a linear gradient
+ *
+ * @param[in]  x        Window-relative X coordinate of rect's top-left corner
+ * @param[in]  y        Window-relative Y coordinate of rect's top-left corner
+ * @param[in]  w        Width of the rectangle
+ * @param[in]  h        Height of the rectangle
+ * @param[in]  x0       Window-relative X coordinate of gradient's start point
+ * @param[in]  y0       Window-relative Y coordinate of gradient's start point
+ * @param[in]  c0       Color at the start point
+ * @param[in]  x1       Window-relative X coordinate of gradient's end point
+ * @param[in]  y1       Window-relative Y coordinate of gradient's end point
+ * @param[in]  c1       Color at the end point
+ *
+ * The color changes along the direction from (x0, y0) to (x1, y1) and it's
+ * constant on the lines perpendicular to it. Beyond the two points, the
+ * colors c0 and c1 are extended. Horizontal (y0 == y1) and vertical
+ * (x0 == x1) gradients are the fastest: the former computes a single row and
+ * copies it, while the latter fills each row with a single color. The
+ * coordinates of the two points are clamped to [-131072, 131072].
+ */
+void tfb_fill_rect_linear_gradient(int x, int y, int w, int h,
+                                   int x0, int y0, u32 c0,
+                                   int x1, int y1, u32 c1);
+
+/**
+ * Fill a rectangle with a radial gradient
+ *
+ * @param[in]  x        Window-relative X coordinate of rect's top-left corner
+ * @param[in]  y        Window-relative Y coordinate of rect's top-left corner
+ * @param[in]  w        Width of the rectangle
+ * @param[in]  h        Height of the rectangle
+ * @param[in]  cx       Window-relative X coordinate of gradient's center
+ * @param[in]  cy       Window-relative Y coordinate of gradient's center
+ * @param[in]  r        Radius of the gradient
+ * @param[in]  c0       Color at the center
+ * @param[in]  c1       Color at distance 'r' from the center and beyond
+ *
+ * The coordinates of the center and the radius are clamped to
+ * [-131072, 131072].
+ */
+void tfb_fill_rect_radial_gradient(int x, int y, int w, int h,
+                                   int cx, int cy, int r, u32 c0, u32 c1);
+
+/**
+ * Fill a rectangle by repeating a pattern
+ *
+ * @param[in]  x        Window-relative X coordinate of rect's top-left corner
+ * @param[in]  y        Window-relative Y coordinate of rect's top-left corner
+ * @param[in]  w        Width of the rectangle
+ * @param[in]  h        Height of the rectangle
+ * @param[in]  pixels   Pointer to the top-left pixel of the pattern.
+ *                      Pixels are colors returned by tfb_make_color().
+ * @param[in]  pw       Width of the pattern, in pixels
+ * @param[in]  ph       Height of the pattern, in pixels
+ * @param[in]  pitch    Size in bytes of a row of the pattern
+ *
+ * The pattern is anchored at the origin of the current window, so adjacent
+ * rectangles filled with the same pattern tile seamlessly. Each row is filled
+ * with memcpy() of whole pattern rows. In deferred mode, the pattern is copied:
+ * its pixels can be changed or freed as soon as the function returns.
+ */
+void tfb_fill_rect_pattern(int x, int y, int w, int h,
+                           const u32 *pixels, u32 pw, u32 ph, u32 pitch);
+
 /**
  * Draw a single character on-screen at (x, y)
  *
@@ -548,6 +924,37 @@ void tfb_draw_string_scaled(int x, int y, u32 fg, u32 bg,
 void tfb_draw_xcenter_string_scaled(int cx, int y, u32 fg, u32 bg,
                                     int xscale, int yscale, const char *s);
 
+/**
+ * Copy a rectangular area of the current window to another position
+ *
+ * @param[in]  x        Window-relative X coordinate of source's top-left corner
+ * @param[in]  y        Window-relative Y coordinate of source's top-left corner
+ * @param[in]  w        Width of the area
+ * @param[in]  h        Height of the area
+ * @param[in]  dst_x    Window-relative X coordinate of the destination
+ * @param[in]  dst_y    Window-relative Y coordinate of the destination
+ *
+ * The source and the destination areas can overlap: the rows are copied in
+ * the right order depending on the direction of the move, each one with a
+ * single memmove(). Both areas are cut off against the current window.
+ *
+ * \note When double buffering is not used, this function has to read from
+ *       the video memory, which is usually quite slow.
+ */
+void tfb_copy_area(int x, int y, int w, int h, int dst_x, int dst_y);
+
+/**
+ * Scroll the content of the current window vertically
+ *
+ * @param[in]  dy          Number of pixels to scroll the content up by.
+ *                         Negative values scroll the content down.
+ * @param[in]  fill_color  Color used for the area uncovered by the scroll
+ *
+ * A convenience wrapper of tfb_copy_area() and tfb_fill_rect(), useful for
+ * console-like text panes and charts.
+ */
+void tfb_scroll_window(int dy, u32 fill_color);
+
 /**
  * Set all the pixels of the screen to the supplied color
  *
@@ -620,7 +1027,10 @@ inline u32 tfb_win_height(void);
  * In case tfb_acquire_fb() has been called with #TFB_FL_USE_DOUBLE_BUFFER,
  * this function copies the pixels in the specified region to actual
  * framebuffer. By default double buffering is not used and this function has no
- * effect.
+ * effect. With #TFB_FL_CONVERT_ON_FLUSH, the pixels are converted to the
+ * framebuffer's format while copying them. With #TFB_FL_ASYNC_FLUSH, the copy
+ * happens later, in the flush thread. With #TFB_FL_TRIPLE_BUFFER, the whole
+ * frame is published instead, no matter the rect.
  */
 void tfb_flush_rect(int x, int y, int w, int h);
 
@@ -646,6 +1056,156 @@ void tfb_flush_window(void);
  */
 int tfb_flush_fb(void);
 
+/**
+ * Wait until all the queued flushes have reached the framebuffer
+ *
+ * Meaningful only with #TFB_FL_ASYNC_FLUSH or #TFB_FL_TRIPLE_BUFFER (where it
+ * waits for the last published frame to be presented): otherwise,
+ * tfb_flush_rect() has already copied everything when it returns and this
+ * function does nothing.
+ * Useful e.g. before taking a screenshot of the framebuffer or before
+ * measuring the time of a frame.
+ */
+void tfb_wait_flush(void);
+
+/**
+ * Flush statistics, in bytes of the back buffer
+ */
+struct tfb_flush_stats {
+
+   uint64_t flushes;          /**< Calls to tfb_flush_rect() that copied */
+   uint64_t written_bytes;    /**< Bytes copied to the framebuffer */
+   uint64_t skipped_bytes;    /**< Bytes skipped, see #TFB_FL_SKIP_UNCHANGED */
+   uint64_t frames_presented; /**< See #TFB_FL_TRIPLE_BUFFER */
+   uint64_t frames_dropped;   /**< See #TFB_FL_TRIPLE_BUFFER */
+};
+
+/**
+ * Get the flush statistics collected since tfb_acquire_fb() or the last call
+ * to tfb_reset_flush_stats()
+ *
+ * Only the flushes actually copying from a back buffer are counted.
+ *
+ * @param[out] stats    Address of the struct to fill
+ */
+void tfb_get_flush_stats(struct tfb_flush_stats *stats);
+
+/**
+ * Reset the flush statistics
+ */
+void tfb_reset_flush_stats(void);
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * Deferred drawing
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * Enter the deferred drawing mode
+ *
+ * In deferred mode, the drawing functions do not touch the pixels: they just
+ * append a command to a list. When the list is flushed, the screen is split
+ * into 64x64 tiles, each command is binned into the tiles it overlaps and the
+ * tiles are rasterized in parallel by a pool of worker threads. Every tile is
+ * owned by a single worker and its commands are executed in their original
+ * order, so the result is the same as in immediate mode.
+ *
+ * The commands are flushed by tfb_flush_deferred(), tfb_end_deferred() and,
+ * implicitly, by tfb_flush_rect(), tfb_flush_window() and by the functions
+ * which cannot be deferred, like tfb_copy_area().
+ *
+ * @param[in]  threads  Number of threads to rasterize with, including the
+ *                      calling one. 0 means the number of online CPUs.
+ *
+ * @return              #TFB_SUCCESS in case of success or one of the
+ *                      following errors:
+ *                          #TFB_ERR_OUT_OF_MEMORY,
+ *                          #TFB_ERR_THREAD_CREATE_FAILED.
+ *
+ * \note tfb_draw_pixel() is never deferred: it's meant to be as fast as
+ *       possible and it always writes the pixel immediately. Avoid mixing it
+ *       with deferred drawing without calling tfb_flush_deferred() first.
+ *
+ * \note Glyphs are recorded by reference: fonts used in deferred mode must
+ *       not be unloaded before the commands have been flushed.
+ */
+int tfb_begin_deferred(u32 threads);
+
+/**
+ * Rasterize all the pending commands of the deferred mode
+ *
+ * Does nothing when not in deferred mode or when no commands are pending.
+ */
+void tfb_flush_deferred(void);
+
+/**
+ * Rasterize all the pending commands and leave the deferred mode
+ *
+ * Stops the worker threads started by tfb_begin_deferred().
+ */
+void tfb_end_deferred(void);
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * Sprite functions
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * Opaque run-length encoded sprite type
+ */
+typedef void *tfb_rle_sprite_t;
+
+/**
+ * Make a run-length encoded sprite out of a color-keyed pixel buffer
+ *
+ * The pixels equal to 'color_key' are considered transparent. Each row of
+ * the buffer is converted into a sequence of (skip, copy) runs, so that
+ * tfb_draw_rle_sprite() never has to test the single pixels and just copies
+ * the opaque runs with memcpy(). Sprites with large transparent areas also
+ * require much less memory than the original buffer.
+ *
+ * @param[in]  pixels      Pointer to the top-left pixel of the source buffer.
+ *                         Pixels are colors returned by tfb_make_color().
+ * @param[in]  w           Width of the source buffer, in pixels
+ * @param[in]  h           Height of the source buffer, in pixels
+ * @param[in]  pitch       Size in bytes of a row in the source buffer
+ * @param[in]  color_key   The color to treat as transparent
+ * @param[out] sprite      Address of a tfb_rle_sprite_t variable that will
+ *                         be set by the function in case of success.
+ *
+ * @return                 #TFB_SUCCESS in case of success or
+ *                         #TFB_ERR_OUT_OF_MEMORY.
+ */
+int tfb_make_rle_sprite(const u32 *pixels, u32 w, u32 h, u32 pitch,
+                        u32 color_key, tfb_rle_sprite_t *sprite);
+
+/**
+ * Free a sprite created with tfb_make_rle_sprite()
+ *
+ * @param[in]  sprite      The sprite to free. Can be NULL.
+ */
+void tfb_free_rle_sprite(tfb_rle_sprite_t sprite);
+
+/**
+ * Draw a run-length encoded sprite on-screen at (x, y)
+ *
+ * @param[in]  x           Window-relative X coordinate of sprite's top-left
+ *                         corner
+ * @param[in]  y           Window-relative Y coordinate of sprite's top-left
+ *                         corner
+ * @param[in]  sprite      A sprite made by tfb_make_rle_sprite()
+ *
+ * \note Rows outside of the current window are skipped entirely, while the
+ *       opaque runs are cut once against the window's horizontal bounds.
+ */
+void tfb_draw_rle_sprite(int x, int y, tfb_rle_sprite_t sprite);
+
 #include "tfb_inline_funcs.h" // internal header
 
 /* undef the the convenience types defined above */
@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <tfblib/tfblib.h>
+#include "utils.h"
+#include "raster.h"
+#include "input.h"
+
+/*
+ * Asynchronous flushes (TFB_FL_ASYNC_FLUSH).
+ *
+ * tfb_flush_rect() just snapshots the rect's rows into one of ASYNC_SLOTS
+ * buffers having the same layout as the back buffer and queues it: a flush
+ * thread does the actual copy (or conversion) to the framebuffer, which is
+ * typically way slower than a copy between two regular memory buffers. The
+ * application keeps on drawing in the back buffer, which is never touched by
+ * the flush thread, so nothing changes about what's drawn where. When all the
+ * slots are queued, tfb_flush_rect() waits for the oldest one to be flushed:
+ * that's what bounds the latency.
+ */
+
+#define ASYNC_SLOTS           2
+
+struct async_slot {
+   u8 *buf;
+   int x, y, w, h;
+   u64 frame;                    /* latency frame id */
+};
+
+static struct {
+
+   bool active;
+
+   struct async_slot slots[ASYNC_SLOTS];
+   u32 head;                     /* next slot to fill */
+   u32 tail;                     /* next slot to flush */
+   u32 used;                     /* queued slots, including the one in use */
+
+   pthread_t thread;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   bool quit;
+
+} af = {
+   .lock = PTHREAD_MUTEX_INITIALIZER,
+   .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void *flush_thread(void *arg)
+{
+   while (true) {
+
+      struct async_slot *s;
+
+      pthread_mutex_lock(&af.lock);
+      {
+         while (!af.used && !af.quit)
+            pthread_cond_wait(&af.cond, &af.lock);
+
+         s = af.used ? &af.slots[af.tail % ASYNC_SLOTS] : NULL;
+      }
+      pthread_mutex_unlock(&af.lock);
+
+      if (!s)
+         break; /* quit, with nothing left to flush */
+
+      if (tfb_int_flush_abs(s->buf, s->x, s->y, s->w, s->h))
+         tfb_int_latency_present(s->frame);
+
+      pthread_mutex_lock(&af.lock);
+      {
+         af.tail++;
+         af.used--;
+         pthread_cond_broadcast(&af.cond);
+      }
+      pthread_mutex_unlock(&af.lock);
+   }
+
+   return NULL;
+}
+
+/* Called by tfb_flush_rect() with the clipped rect, in absolute coordinates */
+void tfb_int_async_flush(int x, int y, int w, int h)
+{
+   struct async_slot *s;
+   size_t row_size;
+
+   if (w <= 0 || h <= 0) {
+      /* Nothing to copy, but the flush still ends a frame */
+      tfb_int_latency_flush();
+      return;
+   }
+
+   pthread_mutex_lock(&af.lock);
+   {
+      while (af.used == ASYNC_SLOTS)
+         pthread_cond_wait(&af.cond, &af.lock);
+
+      s = &af.slots[af.head % ASYNC_SLOTS];
+   }
+   pthread_mutex_unlock(&af.lock);
+
+   row_size = (size_t)w * __fb_bytespp;
+
+   for (int r = y; r < y + h; r++) {
+      const size_t off = (size_t)r * __fb_pitch + (size_t)x * __fb_bytespp;
+      memcpy(s->buf + off, __fb_buffer + off, row_size);
+   }
+
+   s->x = x;
+   s->y = y;
+   s->w = w;
+   s->h = h;
+   s->frame = tfb_int_latency_frame();
+
+   pthread_mutex_lock(&af.lock);
+   {
+      af.head++;
+      af.used++;
+      pthread_cond_broadcast(&af.cond);
+   }
+   pthread_mutex_unlock(&af.lock);
+}
+
+void tfb_int_async_wait(void)
+{
+   if (!af.active)
+      return;
+
+   pthread_mutex_lock(&af.lock);
+   {
+      while (af.used)
+         pthread_cond_wait(&af.cond, &af.lock);
+   }
+   pthread_mutex_unlock(&af.lock);
+}
+
+static void free_slots(void)
+{
+   for (int i = 0; i < ASYNC_SLOTS; i++) {
+      free(af.slots[i].buf);
+      af.slots[i].buf = NULL;
+   }
+}
+
+int tfb_int_async_start(void)
+{
+   for (int i = 0; i < ASYNC_SLOTS; i++) {
+
+      if (!(af.slots[i].buf = malloc(__fb_size))) {
+         free_slots();
+         return TFB_ERR_OUT_OF_MEMORY;
+      }
+
+      /* Fault-in the pages now, not while flushing */
+      memset(af.slots[i].buf, 0, __fb_size);
+   }
+
+   af.head = af.tail = af.used = 0;
+   af.quit = false;
+
+   if (pthread_create(&af.thread, NULL, flush_thread, NULL) != 0) {
+      free_slots();
+      return TFB_ERR_THREAD_CREATE_FAILED;
+   }
+
+   af.active = true;
+   return TFB_SUCCESS;
+}
+
+void tfb_int_async_stop(void)
+{
+   if (!af.active)
+      return;
+
+   pthread_mutex_lock(&af.lock);
+   {
+      af.quit = true;
+      pthread_cond_broadcast(&af.cond);
+   }
+   pthread_mutex_unlock(&af.lock);
+   pthread_join(af.thread, NULL);
+
+   af.active = false;
+   free_slots();
+}
@@ -0,0 +1,304 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <stdlib.h>
+
+#ifdef __SSE2__
+   #include <emmintrin.h>
+#endif
+
+#include <tfblib/tfblib.h>
+#include "utils.h"
+#include "raster.h"
+
+/*
+ * Batch color conversion functions.
+ */
+
+#define DEG_60          (60 * TFB_HUE_DEGREE)
+#define PALETTE_HUES    361            /* [0, 360] degrees, both included */
+
+#ifdef __SSE2__
+
+/*
+ * Move the four 3-byte colors in the low 12 bytes of 'v' to 32-bit lanes.
+ * The 16-bit word shuffles put each color in its lane, but in the odd lanes
+ * it starts from the byte 1: those get shifted down by a byte.
+ */
+static inline __m128i spread_rgb(__m128i v)
+{
+   const __m128i odd = _mm_set_epi32(-1, 0, -1, 0);
+   const __m128i lo = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 1, 1, 0));
+   const __m128i hi = _mm_shufflelo_epi16(_mm_srli_si128(v, 6),
+                                          _MM_SHUFFLE(2, 1, 1, 0));
+   const __m128i x = _mm_unpacklo_epi64(lo, hi);
+
+   return _mm_or_si128(_mm_andnot_si128(odd, x),
+                       _mm_and_si128(odd, _mm_srli_epi32(x, 8)));
+}
+
+/*
+ * The channel in the byte 'k' of each lane, reduced to 'len' bits at 'pos',
+ * like in tfb_make_color(): mask its top bits, move them down to bit 0, then
+ * up to 'pos'. Both the shifts are by a variable count, so that a single
+ * kernel works for any layout.
+ */
+struct rgb_channel {
+   __m128i mask;
+   __m128i down;
+   __m128i up;
+};
+
+static inline struct rgb_channel rgb_channel(u32 k, u32 len, u32 pos)
+{
+   return (struct rgb_channel) {
+      _mm_set1_epi32((0xffu << (8 - len) & 0xff) << (8 * k)),
+      _mm_cvtsi32_si128(8 * k + 8 - len),
+      _mm_cvtsi32_si128(pos),
+   };
+}
+
+static inline __m128i
+rgb_convert(__m128i x, const struct rgb_channel *c /* [3] */)
+{
+   __m128i r = _mm_and_si128(x, c[0].mask);
+   __m128i g = _mm_and_si128(x, c[1].mask);
+   __m128i b = _mm_and_si128(x, c[2].mask);
+
+   r = _mm_sll_epi32(_mm_srl_epi32(r, c[0].down), c[0].up);
+   g = _mm_sll_epi32(_mm_srl_epi32(g, c[1].down), c[1].up);
+   b = _mm_sll_epi32(_mm_srl_epi32(b, c[2].down), c[2].up);
+   return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+/* XRGB8888, the most common layout: just swap the bytes 0 and 2 */
+static inline __m128i rgb_to_xrgb8888(__m128i x)
+{
+   const __m128i r = _mm_slli_epi32(x, 16);
+   const __m128i b = _mm_srli_epi32(x, 16);
+
+   return _mm_or_si128(_mm_and_si128(x, _mm_set1_epi32(0x00ff00)),
+                       _mm_or_si128(_mm_and_si128(r, _mm_set1_epi32(0xff0000)),
+                                    _mm_and_si128(b, _mm_set1_epi32(0xff))));
+}
+
+/*
+ * 16 colors at a time, with a 16-byte load every 4 colors (12 bytes). Each
+ * load reads 4 bytes more than those colors: the loop stops early enough
+ * not to read past the end of 'src'. Returns the number of colors converted.
+ */
+static inline __attribute__((always_inline)) u32
+make_colors_sse2_impl(u32 *dst, const struct tfb_rgb *src, u32 n, bool xrgb)
+{
+   const struct rgb_channel ch[3] = {
+      rgb_channel(0, __fb_r_mask_size, __fb_r_pos),
+      rgb_channel(1, __fb_g_mask_size, __fb_g_pos),
+      rgb_channel(2, __fb_b_mask_size, __fb_b_pos),
+   };
+
+   const u8 *p = (const u8 *)src;
+   u32 i;
+
+   for (i = 0; i + 18 <= n; i += 16, p += 48) {
+
+      for (int k = 0; k < 4; k++) {
+
+         const __m128i v = _mm_loadu_si128((const __m128i *)(p + 12 * k));
+         const __m128i x = spread_rgb(v);
+
+         _mm_storeu_si128((__m128i *)(dst + i + 4 * k),
+                          xrgb ? rgb_to_xrgb8888(x) : rgb_convert(x, ch));
+      }
+   }
+
+   return i;
+}
+
+static u32 make_colors_sse2(u32 *dst, const struct tfb_rgb *src, u32 n)
+{
+   if (__fb_is_xrgb8888)
+      return make_colors_sse2_impl(dst, src, n, true);
+
+   return make_colors_sse2_impl(dst, src, n, false);
+}
+
+#endif
+
+void tfb_make_colors(u32 *dst, const struct tfb_rgb *src, u32 n)
+{
+   u32 i = 0;
+
+#ifdef __SSE2__
+   if (sizeof(struct tfb_rgb) == 3)
+      i = make_colors_sse2(dst, src, n);
+#endif
+
+   __tfb_px.make_colors(dst + i, src + i, n - i);
+}
+
+#ifdef __SSE2__
+
+/* x / 15, for x < 2^16 in each 32-bit lane */
+static inline __m128i div15(__m128i x)
+{
+   return _mm_srli_epi32(_mm_mulhi_epu16(x, _mm_set1_epi32(0x8889)), 3);
+}
+
+static inline __m128i
+select3(__m128i m_v, __m128i v, __m128i m_x, __m128i x, __m128i m_p, __m128i p)
+{
+   return _mm_or_si128(_mm_or_si128(_mm_and_si128(m_v, v),
+                                    _mm_and_si128(m_x, x)),
+                       _mm_and_si128(m_p, p));
+}
+
+/*
+ * The same integer math as tfb_make_color_hsv(), 4 colors at a time. With
+ * f = h - region * DEG_60 and t = (odd region ? f : DEG_60 - f), it comes
+ * down to:
+ *
+ *    p = v * (256 - s) / 256
+ *    x = v - ceil(s * v * t / (256 * DEG_60))
+ *
+ * where all the products fit in 16 bits, except s * v * t, which is computed
+ * with a 16 x 16 -> 32 bit multiplication. The divisions by DEG_60 become a
+ * shift and a division by 15, done with a multiplication. Like in the scalar
+ * function, hues beyond 360 degrees give black.
+ *
+ * Returns the number of colors converted.
+ */
+static u32 make_colors_hsv_sse2(u32 *dst, const struct tfb_hsv *src, u32 n)
+{
+   const __m128i r_shift = _mm_cvtsi32_si128(8 - __fb_r_mask_size);
+   const __m128i g_shift = _mm_cvtsi32_si128(8 - __fb_g_mask_size);
+   const __m128i b_shift = _mm_cvtsi32_si128(8 - __fb_b_mask_size);
+   const __m128i r_pos = _mm_cvtsi32_si128(__fb_r_pos);
+   const __m128i g_pos = _mm_cvtsi32_si128(__fb_g_pos);
+   const __m128i b_pos = _mm_cvtsi32_si128(__fb_b_pos);
+
+   const __m128i byte_mask = _mm_set1_epi32(0xff);
+   const __m128i one = _mm_set1_epi32(1);
+   const __m128i deg60 = _mm_set1_epi32(DEG_60);
+   u32 i;
+
+   for (i = 0; i + 4 <= n; i += 4) {
+
+      /* 4 x { h, s | v << 8 | padding } -> h[4], sv[4] */
+      const __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+      const __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 2));
+      const __m128i t0 = _mm_unpacklo_epi32(a, b);
+      const __m128i t1 = _mm_unpackhi_epi32(a, b);
+      const __m128i h = _mm_unpacklo_epi32(t0, t1);
+      const __m128i sv = _mm_unpackhi_epi32(t0, t1);
+
+      const __m128i s = _mm_and_si128(sv, byte_mask);
+      const __m128i v = _mm_and_si128(_mm_srli_epi32(sv, 8), byte_mask);
+
+      /* h >= 360 degrees (as unsigned) */
+      const __m128i out = _mm_or_si128(
+         _mm_cmpgt_epi32(h, _mm_set1_epi32(6 * DEG_60 - 1)),
+         _mm_cmplt_epi32(h, _mm_setzero_si128())
+      );
+
+      /* DEG_60 = 15 << 10 = (1 << 14) - (1 << 10) */
+      const __m128i region = div15(_mm_srli_epi32(h, 10));
+      const __m128i r14 = _mm_slli_epi32(region, 14);
+      const __m128i r10 = _mm_slli_epi32(region, 10);
+      const __m128i f = _mm_add_epi32(_mm_sub_epi32(h, r14), r10);
+
+      const __m128i odd = _mm_cmpeq_epi32(_mm_and_si128(region, one), one);
+      const __m128i t = _mm_or_si128(
+         _mm_and_si128(odd, f), _mm_andnot_si128(odd, _mm_sub_epi32(deg60, f))
+      );
+
+      const __m128i s_v = _mm_mullo_epi16(s, v);
+      const __m128i p = _mm_srli_epi32(
+         _mm_mullo_epi16(v, _mm_sub_epi32(_mm_set1_epi32(256), s)), 8
+      );
+
+      const __m128i prod = _mm_or_si128(
+         _mm_mullo_epi16(s_v, t), _mm_slli_epi32(_mm_mulhi_epu16(s_v, t), 16)
+      );
+
+      const __m128i q = div15(_mm_srli_epi32(
+         _mm_add_epi32(prod, _mm_set1_epi32(256 * DEG_60 - 1)), 18
+      ));
+
+      const __m128i x = _mm_sub_epi32(v, q);
+
+      const __m128i e0 = _mm_cmpeq_epi32(region, _mm_set1_epi32(0));
+      const __m128i e1 = _mm_cmpeq_epi32(region, _mm_set1_epi32(1));
+      const __m128i e2 = _mm_cmpeq_epi32(region, _mm_set1_epi32(2));
+      const __m128i e3 = _mm_cmpeq_epi32(region, _mm_set1_epi32(3));
+      const __m128i e4 = _mm_cmpeq_epi32(region, _mm_set1_epi32(4));
+      const __m128i e5 = _mm_cmpeq_epi32(region, _mm_set1_epi32(5));
+
+      const __m128i r = select3(_mm_or_si128(e0, e5), v,
+                                _mm_or_si128(e1, e4), x,
+                                _mm_or_si128(e2, e3), p);
+
+      const __m128i g = select3(_mm_or_si128(e1, e2), v,
+                                _mm_or_si128(e0, e3), x,
+                                _mm_or_si128(e4, e5), p);
+
+      const __m128i bl = select3(_mm_or_si128(e3, e4), v,
+                                 _mm_or_si128(e2, e5), x,
+                                 _mm_or_si128(e0, e1), p);
+
+      /* See tfb_make_color() */
+      const __m128i c = _mm_or_si128(
+         _mm_or_si128(_mm_sll_epi32(_mm_srl_epi32(r, r_shift), r_pos),
+                      _mm_sll_epi32(_mm_srl_epi32(g, g_shift), g_pos)),
+         _mm_sll_epi32(_mm_srl_epi32(bl, b_shift), b_pos)
+      );
+
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_andnot_si128(out, c));
+   }
+
+   return i;
+}
+
+#endif
+
+void tfb_make_colors_hsv(u32 *dst, const struct tfb_hsv *src, u32 n)
+{
+   u32 i = 0;
+
+#ifdef __SSE2__
+   if (sizeof(struct tfb_hsv) == 8)
+      i = make_colors_hsv_sse2(dst, src, n);
+#endif
+
+   for (; i < n; i++)
+      dst[i] = tfb_make_color_hsv(src[i].h, src[i].s, src[i].v);
+}
+
+int tfb_make_hsv_palette(u8 s, tfb_hsv_palette_t *palette)
+{
+   u32 *colors = malloc(PALETTE_HUES * 256 * sizeof(u32));
+
+   if (!colors)
+      return TFB_ERR_OUT_OF_MEMORY;
+
+   for (u32 deg = 0; deg < PALETTE_HUES; deg++)
+      for (u32 v = 0; v < 256; v++)
+         colors[deg * 256 + v] = tfb_make_color_hsv(deg * TFB_HUE_DEGREE, s, v);
+
+   *palette = colors;
+   return TFB_SUCCESS;
+}
+
+void tfb_free_hsv_palette(tfb_hsv_palette_t palette)
+{
+   free(palette);
+}
+
+void tfb_make_colors_hsv_palette(u32 *dst, tfb_hsv_palette_t palette,
+                                 const struct tfb_hsv *src, u32 n)
+{
+   const u32 *colors = palette;
+
+   for (u32 i = 0; i < n; i++) {
+      const u32 deg = MIN(src[i].h / TFB_HUE_DEGREE, PALETTE_HUES - 1u);
+      dst[i] = colors[deg * 256 + src[i].v];
+   }
+}
@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <linux/fb.h>
+
+#ifdef __SSE2__
+   #include <emmintrin.h>
+#endif
+
+#include <tfblib/tfblib.h>
+#include "utils.h"
+#include "raster.h"
+
+/*
+ * Conversion of the XRGB8888 back buffer to the framebuffer's format, used
+ * with TFB_FL_CONVERT_ON_FLUSH. All the drawing happens in 32 bpp and the
+ * pixels are converted only once, row by row, when they're flushed.
+ *
+ * With TFB_FL_DITHER, an ordered (Bayer 4x4) dithering is applied: before the
+ * low bits of each channel are dropped, a threshold depending on the pixel's
+ * position is added to it. That turns the banding of smooth gradients into a
+ * fine, regular pattern. The threshold is a function of (x, y) only, so
+ * flushing the same region twice gives exactly the same pixels.
+ */
+
+static const u8 bayer4[4][4] = {
+   {  0,  8,  2, 10 },
+   { 12,  4, 14,  6 },
+   {  3, 11,  1,  9 },
+   { 15,  7, 13,  5 },
+};
+
+/* Layout of the framebuffer's pixels */
+static struct {
+   u32 r_pos, g_pos, b_pos;
+   u32 r_len, g_len, b_len;
+} dev;
+
+/* The threshold for a channel with 'len' bits: [0, 2^(8 - len)) */
+static inline u32 dither_bias(u32 t, u32 len)
+{
+   return (t << (8 - len)) >> 4;
+}
+
+static inline u32 conv_channel(u32 v, u32 t, u32 len, u32 pos)
+{
+   return (MIN(v + dither_bias(t, len), 255u) >> (8 - len)) << pos;
+}
+
+static inline void
+convert_generic(void *dst, const u32 *src, u32 n,
+                int x, int y, u32 bytespp, bool dither)
+{
+   const u8 *brow = bayer4[y & 3];
+   u8 *d = dst;
+
+   for (u32 i = 0; i < n; i++, d += bytespp) {
+
+      const u32 c = src[i];
+      const u32 t = dither ? brow[(x + i) & 3] : 0;
+
+      const u32 v = conv_channel((c >> 16) & 0xff, t, dev.r_len, dev.r_pos) |
+                    conv_channel((c >> 8) & 0xff, t, dev.g_len, dev.g_pos) |
+                    conv_channel(c & 0xff, t, dev.b_len, dev.b_pos);
+
+      if (bytespp == 2) {
+         *(u16 *)d = v;
+      } else {
+         d[0] = v;
+         d[1] = v >> 8;
+         d[2] = v >> 16;
+      }
+   }
+}
+
+static void conv16(void *dst, const u32 *src, u32 n, int x, int y)
+{
+   convert_generic(dst, src, n, x, y, 2, false);
+}
+
+static void conv16_dither(void *dst, const u32 *src, u32 n, int x, int y)
+{
+   convert_generic(dst, src, n, x, y, 2, true);
+}
+
+static void conv24(void *dst, const u32 *src, u32 n, int x, int y)
+{
+   /* No dithering: 24 bpp modes have 8-bit channels */
+   convert_generic(dst, src, n, x, y, 3, false);
+}
+
+#ifdef __SSE2__
+
+/*
+ * SSE2 kernels for RGB565 and RGB555, 8 pixels per iteration. The dithering
+ * threshold of 4 consecutive pixels is added to all the channels at once
+ * with a saturating byte add. The 16-bit results are sign-extended before
+ * _mm_packs_epi32(), so that the signed saturation never kicks in.
+ */
+
+static inline __m128i
+pack16(__m128i p, int r_shift, u32 r_mask, int g_shift, u32 g_mask)
+{
+   const __m128i r = _mm_and_si128(_mm_srli_epi32(p, r_shift),
+                                   _mm_set1_epi32(r_mask));
+   const __m128i g = _mm_and_si128(_mm_srli_epi32(p, g_shift),
+                                   _mm_set1_epi32(g_mask));
+   const __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3),
+                                   _mm_set1_epi32(0x1f));
+
+   const __m128i v = _mm_or_si128(_mm_or_si128(r, g), b);
+   return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+static inline void
+convert_sse2(void *dst, const u32 *src, u32 n,
+             int x, int y, bool rgb565, bool dither)
+{
+   __m128i bias = _mm_setzero_si128();
+   u16 *d = dst;
+   u32 i;
+
+   if (dither) {
+
+      const u8 *brow = bayer4[y & 3];
+      u32 b[4];
+
+      for (int k = 0; k < 4; k++) {
+         const u32 t = brow[(x + k) & 3];
+         const u32 rb = dither_bias(t, 5);
+         const u32 g = dither_bias(t, rgb565 ? 6 : 5);
+         b[k] = (rb << 16) | (g << 8) | rb;
+      }
+
+      bias = _mm_loadu_si128((const __m128i *)b);
+   }
+
+   for (i = 0; i + 8 <= n; i += 8) {
+
+      __m128i p0 = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i p1 = _mm_loadu_si128((const __m128i *)(src + i + 4));
+
+      p0 = _mm_adds_epu8(p0, bias);
+      p1 = _mm_adds_epu8(p1, bias);
+
+      if (rgb565) {
+         p0 = pack16(p0, 8, 0xf800, 5, 0x07e0);
+         p1 = pack16(p1, 8, 0xf800, 5, 0x07e0);
+      } else {
+         p0 = pack16(p0, 9, 0x7c00, 6, 0x03e0);
+         p1 = pack16(p1, 9, 0x7c00, 6, 0x03e0);
+      }
+
+      _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(p0, p1));
+   }
+
+   convert_generic(d + i, src + i, n - i, x + i, y, 2, dither);
+}
+
+static void conv565_sse2(void *dst, const u32 *src, u32 n, int x, int y)
+{
+   convert_sse2(dst, src, n, x, y, true, false);
+}
+
+static void conv565_sse2_dither(void *dst, const u32 *src, u32 n, int x, int y)
+{
+   convert_sse2(dst, src, n, x, y, true, true);
+}
+
+static void conv555_sse2(void *dst, const u32 *src, u32 n, int x, int y)
+{
+   convert_sse2(dst, src, n, x, y, false, false);
+}
+
+static void conv555_sse2_dither(void *dst, const u32 *src, u32 n, int x, int y)
+{
+   convert_sse2(dst, src, n, x, y, false, true);
+}
+
+/* RGB565 (g_len = 6) or RGB555 (g_len = 5) */
+static bool is_layout(const struct fb_var_screeninfo *fbi, u32 g_len)
+{
+   return fbi->red.offset == 5 + g_len && fbi->red.length == 5 &&
+          fbi->green.offset == 5 && fbi->green.length == g_len &&
+          fbi->blue.offset == 0 && fbi->blue.length == 5;
+}
+
+#endif
+
+convert_func
+tfb_int_get_converter(const struct fb_var_screeninfo *fbi, bool dither)
+{
+   dev.r_pos = fbi->red.offset;
+   dev.g_pos = fbi->green.offset;
+   dev.b_pos = fbi->blue.offset;
+   dev.r_len = fbi->red.length;
+   dev.g_len = fbi->green.length;
+   dev.b_len = fbi->blue.length;
+
+   switch (fbi->bits_per_pixel) {
+
+      case 16:
+
+#ifdef __SSE2__
+         if (is_layout(fbi, 6))
+            return dither ? conv565_sse2_dither : conv565_sse2;
+
+         if (is_layout(fbi, 5))
+            return dither ? conv555_sse2_dither : conv555_sse2;
+#endif
+
+         return dither ? conv16_dither : conv16;
+
+      case 24:
+         return conv24;
+
+      default:
+         return NULL;
+   }
+}
@@ -0,0 +1,491 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <tfblib/tfblib.h>
+#include "utils.h"
+#include "raster.h"
+
+/*
+ * Deferred drawing mode.
+ *
+ * While in deferred mode, the drawing functions just append commands to a
+ * list. When the list is flushed, each command is binned into the screen
+ * tiles its bounding box overlaps and then the tiles are rasterized in
+ * parallel by a pool of workers. Each tile is rasterized by exactly one
+ * worker, which runs the tile's commands in their original order using the
+ * tile as clip rectangle: therefore, no locking is needed on pixel writes and
+ * the final result is the same as in immediate mode.
+ */
+
+#define TILE_SHIFT            6
+#define TILE_SIZE             (1 << TILE_SHIFT)
+
+bool __tfb_deferred;
+
+static struct cmd *cmds;
+static size_t cmds_count;
+static size_t cmds_cap;
+
+/* The polygons' edge tables, built once when recording the commands */
+static struct edge *edges;
+static size_t edges_count;
+static size_t edges_cap;
+
+/* Copies of the patterns' pixels, as compact rows */
+static u32 *patterns;
+static size_t patterns_count;
+static size_t patterns_cap;
+
+/*
+ * Per-worker scratch buffers for scanning the polygons, 'scan_cap' elems per
+ * worker: no allocations are needed while rasterizing the tiles.
+ */
+static struct edge *scan_work;
+static struct edge **scan_active;
+static size_t scan_cap;
+
+/* Per-tile lists of command indexes, stored contiguously one after another */
+static int tiles_x;
+static int tiles_y;
+static u32 *tile_start;          /* ntiles + 1 elems */
+static u32 *tile_pos;            /* ntiles elems, used while binning */
+static u32 *tile_cmds;
+static size_t tile_cmds_cap;
+
+static struct {
+
+   pthread_t *threads;
+   int count;
+
+   pthread_mutex_t lock;
+   pthread_cond_t work_cond;
+   pthread_cond_t done_cond;
+   u32 generation;
+   int busy;
+   bool quit;
+
+   int next_tile;
+
+} pool = {
+   .lock = PTHREAD_MUTEX_INITIALIZER,
+   .work_cond = PTHREAD_COND_INITIALIZER,
+   .done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static bool grow(void **buf, size_t *cap, size_t needed, size_t elem_size)
+{
+   size_t new_cap = MAX(*cap, (size_t)64);
+   void *new_buf;
+
+   if (needed <= *cap)
+      return true;
+
+   while (new_cap < needed)
+      new_cap *= 2;
+
+   new_buf = realloc(*buf, new_cap * elem_size);
+
+   if (!new_buf)
+      return false;
+
+   *buf = new_buf;
+   *cap = new_cap;
+   return true;
+}
+
+bool tfb_int_defer(struct cmd *cmd)
+{
+   cmd->bbox = clip_intersect(&cmd->bbox, &cmd->clip);
+
+   if (clip_is_empty(&cmd->bbox))
+      return true; /* nothing to draw */
+
+   if (!grow((void **)&cmds, &cmds_cap, cmds_count + 1, sizeof(*cmds))) {
+      tfb_flush_deferred();
+      return false;
+   }
+
+   cmds[cmds_count++] = *cmd;
+   return true;
+}
+
+/* Make room for scanning polygons of n edges, in all the workers */
+static bool grow_scan_buffers(size_t n)
+{
+   const size_t workers = pool.count + 1;
+   void *p;
+
+   if (n <= scan_cap)
+      return true;
+
+   if (!(p = realloc(scan_work, n * workers * sizeof(*scan_work))))
+      return false;
+
+   scan_work = p;
+
+   if (!(p = realloc(scan_active, n * workers * sizeof(*scan_active))))
+      return false;
+
+   scan_active = p;
+   scan_cap = n;
+   return true;
+}
+
+bool tfb_int_defer_polygon(struct cmd *cmd,
+                           const struct tfb_point *p, int n)
+{
+   if (!grow((void **)&edges, &edges_cap, edges_count + n, sizeof(*edges)) ||
+       !grow_scan_buffers(n))
+   {
+      tfb_flush_deferred();
+      return false;
+   }
+
+   cmd->u.edges_off = edges_count;
+   cmd->a[2] = tfb_int_polygon_edges(edges + edges_count, p, n,
+                                     cmd->a[0], cmd->a[1]);
+
+   if (!tfb_int_defer(cmd))
+      return false;
+
+   edges_count += cmd->a[2];
+   return true;
+}
+
+bool tfb_int_defer_pattern(struct cmd *cmd, const struct pattern *p)
+{
+   const size_t n = (size_t)p->w * p->h;
+   u32 *dst;
+
+   if (!grow((void **)&patterns, &patterns_cap,
+             patterns_count + n, sizeof(*patterns)))
+   {
+      tfb_flush_deferred();
+      return false;
+   }
+
+   cmd->u.pixels_off = patterns_count;
+   cmd->a[6] = p->w;
+   cmd->a[7] = p->h;
+
+   if (!tfb_int_defer(cmd))
+      return false;
+
+   dst = patterns + patterns_count;
+
+   for (u32 y = 0; y < p->h; y++, dst += p->w)
+      memcpy(dst, (const u8 *)p->pixels + y * p->pitch, p->w * sizeof(u32));
+
+   patterns_count += n;
+   return true;
+}
+
+static void run_cmd(const struct clip_rect *c, const struct cmd *cmd,
+                    int worker)
+{
+   const int *a = cmd->a;
+   struct pattern p;
+
+   switch (cmd->type) {
+
+      case CMD_FILL_RECT:
+         tfb_int_fill_rect(c, a[0], a[1], a[2], a[3], cmd->color);
+         break;
+
+      case CMD_LINE:
+         tfb_int_draw_line(c, a[0], a[1], a[2], a[3], cmd->color);
+         break;
+
+      case CMD_CIRCLE:
+         tfb_int_draw_circle(c, a[0], a[1], a[2], cmd->color);
+         break;
+
+      case CMD_FILL_CIRCLE:
+         tfb_int_fill_circle(c, a[0], a[1], a[2], cmd->color);
+         break;
+
+      case CMD_TRIANGLE:
+         tfb_int_fill_triangle(c, a[0], a[1], a[2], a[3], a[4], a[5],
+                               cmd->color);
+         break;
+
+      case CMD_POLYGON:
+         tfb_int_scan_polygon(c, edges + cmd->u.edges_off, a[2],
+                              scan_work + worker * scan_cap,
+                              scan_active + worker * scan_cap,
+                              cmd->color, cmd->rule);
+         break;
+
+      case CMD_GLYPH:
+         tfb_int_draw_glyph(c, a[0], a[1], cmd->color, cmd->color2,
+                            &cmd->u.glyph);
+         break;
+
+      case CMD_LINEAR_GRADIENT:
+         tfb_int_fill_linear_gradient(c, a[0], a[1], a[2], a[3],
+                                      a[4], a[5], a[6], a[7],
+                                      cmd->color, cmd->color2);
+         break;
+
+      case CMD_RADIAL_GRADIENT:
+         tfb_int_fill_radial_gradient(c, a[0], a[1], a[2], a[3],
+                                      a[4], a[5], a[6],
+                                      cmd->color, cmd->color2);
+         break;
+
+      case CMD_PATTERN:
+         p = (struct pattern) {
+            patterns + cmd->u.pixels_off, a[6], a[7], a[6] * sizeof(u32)
+         };
+
+         tfb_int_fill_pattern(c, a[0], a[1], a[2], a[3], a[4], a[5], &p);
+         break;
+   }
+}
+
+static inline void
+cmd_tile_range(const struct cmd *cmd, int *tx0, int *ty0, int *tx1, int *ty1)
+{
+   *tx0 = cmd->bbox.x0 >> TILE_SHIFT;
+   *ty0 = cmd->bbox.y0 >> TILE_SHIFT;
+   *tx1 = (cmd->bbox.x1 - 1) >> TILE_SHIFT;
+   *ty1 = (cmd->bbox.y1 - 1) >> TILE_SHIFT;
+}
+
+static bool bin_commands(void)
+{
+   const int ntiles = tiles_x * tiles_y;
+   int tx0, ty0, tx1, ty1;
+
+   memset(tile_start, 0, (ntiles + 1) * sizeof(u32));
+
+   /* First pass: count the commands in each tile */
+   for (size_t i = 0; i < cmds_count; i++) {
+
+      cmd_tile_range(&cmds[i], &tx0, &ty0, &tx1, &ty1);
+
+      for (int ty = ty0; ty <= ty1; ty++)
+         for (int tx = tx0; tx <= tx1; tx++)
+            tile_start[ty * tiles_x + tx + 1]++;
+   }
+
+   for (int t = 0; t < ntiles; t++) {
+      tile_start[t + 1] += tile_start[t];
+      tile_pos[t] = tile_start[t];
+   }
+
+   if (!grow((void **)&tile_cmds, &tile_cmds_cap,
+             tile_start[ntiles], sizeof(*tile_cmds)))
+   {
+      return false;
+   }
+
+   /* Second pass: fill the lists, preserving the order of the commands */
+   for (size_t i = 0; i < cmds_count; i++) {
+
+      cmd_tile_range(&cmds[i], &tx0, &ty0, &tx1, &ty1);
+
+      for (int ty = ty0; ty <= ty1; ty++)
+         for (int tx = tx0; tx <= tx1; tx++)
+            tile_cmds[tile_pos[ty * tiles_x + tx]++] = i;
+   }
+
+   return true;
+}
+
+static void raster_tile(int t, int worker)
+{
+   const int x = (t % tiles_x) << TILE_SHIFT;
+   const int y = (t / tiles_x) << TILE_SHIFT;
+   const struct clip_rect tile = {
+      x, y, MIN(x + TILE_SIZE, __fb_screen_w), MIN(y + TILE_SIZE, __fb_screen_h)
+   };
+
+   for (u32 i = tile_start[t]; i < tile_start[t + 1]; i++) {
+
+      const struct cmd *cmd = &cmds[tile_cmds[i]];
+      const struct clip_rect c = clip_intersect(&cmd->clip, &tile);
+
+      run_cmd(&c, cmd, worker);
+   }
+}
+
+static void raster_tiles(int worker)
+{
+   const int ntiles = tiles_x * tiles_y;
+   int t;
+
+   while ((t = __atomic_fetch_add(&pool.next_tile, 1,
+                                  __ATOMIC_RELAXED)) < ntiles)
+   {
+      raster_tile(t, worker);
+   }
+}
+
+static void *worker_thread(void *arg)
+{
+   const int worker = (int)(uintptr_t)arg;
+   u32 gen = 0;
+
+   pthread_mutex_lock(&pool.lock);
+
+   while (true) {
+
+      while (pool.generation == gen && !pool.quit)
+         pthread_cond_wait(&pool.work_cond, &pool.lock);
+
+      if (pool.quit)
+         break;
+
+      gen = pool.generation;
+      pthread_mutex_unlock(&pool.lock);
+
+      raster_tiles(worker);
+
+      pthread_mutex_lock(&pool.lock);
+
+      if (--pool.busy == 0)
+         pthread_cond_signal(&pool.done_cond);
+   }
+
+   pthread_mutex_unlock(&pool.lock);
+   return NULL;
+}
+
+void tfb_flush_deferred(void)
+{
+   if (!cmds_count)
+      return;
+
+   if (bin_commands()) {
+
+      pool.next_tile = 0;
+
+      pthread_mutex_lock(&pool.lock);
+      pool.generation++;
+      pool.busy = pool.count;
+      pthread_cond_broadcast(&pool.work_cond);
+      pthread_mutex_unlock(&pool.lock);
+
+      /* The calling thread is the worker 0 */
+      raster_tiles(0);
+
+      pthread_mutex_lock(&pool.lock);
+
+      while (pool.busy > 0)
+         pthread_cond_wait(&pool.done_cond, &pool.lock);
+
+      pthread_mutex_unlock(&pool.lock);
+
+   } else {
+
+      /* Out of memory while binning: just rasterize everything serially */
+      for (size_t i = 0; i < cmds_count; i++)
+         run_cmd(&cmds[i].clip, &cmds[i], 0);
+   }
+
+   cmds_count = 0;
+   edges_count = 0;
+   patterns_count = 0;
+}
+
+static void stop_workers(void)
+{
+   pthread_mutex_lock(&pool.lock);
+   pool.quit = true;
+   pthread_cond_broadcast(&pool.work_cond);
+   pthread_mutex_unlock(&pool.lock);
+
+   for (int i = 0; i < pool.count; i++)
+      pthread_join(pool.threads[i], NULL);
+
+   free(pool.threads);
+   pool.threads = NULL;
+   pool.count = 0;
+   pool.generation = 0;
+   pool.quit = false;
+}
+
+static void free_buffers(void)
+{
+   free(cmds);
+   free(edges);
+   free(patterns);
+   free(scan_work);
+   free(scan_active);
+   free(tile_start);
+   free(tile_pos);
+   free(tile_cmds);
+
+   cmds = NULL;
+   edges = NULL;
+   patterns = NULL;
+   scan_work = NULL;
+   scan_active = NULL;
+   tile_start = NULL;
+   tile_pos = NULL;
+   tile_cmds = NULL;
+   cmds_cap = edges_cap = patterns_cap = scan_cap = tile_cmds_cap = 0;
+   cmds_count = edges_count = patterns_count = 0;
+}
+
+int tfb_begin_deferred(u32 threads)
+{
+   int ntiles;
+
+   if (__tfb_deferred)
+      tfb_end_deferred();
+
+   if (!threads) {
+      long n = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = n > 0 ? n : 1;
+   }
+
+   tiles_x = (__fb_screen_w + TILE_SIZE - 1) >> TILE_SHIFT;
+   tiles_y = (__fb_screen_h + TILE_SIZE - 1) >> TILE_SHIFT;
+   ntiles = tiles_x * tiles_y;
+
+   tile_start = malloc((ntiles + 1) * sizeof(u32));
+   tile_pos = malloc(ntiles * sizeof(u32));
+   pool.threads = malloc((threads - 1) * sizeof(pthread_t));
+
+   if (!tile_start || !tile_pos || (threads > 1 && !pool.threads)) {
+      free(pool.threads);
+      pool.threads = NULL;
+      free_buffers();
+      return TFB_ERR_OUT_OF_MEMORY;
+   }
+
+   /* The calling thread is a worker as well */
+   for (u32 i = 0; i < threads - 1; i++) {
+
+      if (pthread_create(&pool.threads[i], NULL, worker_thread,
+                         (void *)(uintptr_t)(i + 1)) != 0)
+      {
+         stop_workers();
+         free_buffers();
+         return TFB_ERR_THREAD_CREATE_FAILED;
+      }
+
+      pool.count++;
+   }
+
+   __tfb_deferred = true;
+   return TFB_SUCCESS;
+}
+
+void tfb_end_deferred(void)
+{
+   if (!__tfb_deferred)
+      return;
+
+   tfb_flush_deferred();
+   __tfb_deferred = false;
+
+   stop_workers();
+   free_buffers();
+}
@@ -6,9 +6,11 @@
 #include <stdint.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <limits.h>
 
 #include <tfblib/tfblib.h>
 #include "utils.h"
+#include "raster.h"
 
 extern inline u32 tfb_make_color(u8 red, u8 green, u8 blue);
 extern inline void tfb_draw_pixel(int x, int y, u32 color);
@@ -29,6 +31,7 @@ size_t __fb_pitch_div4; /*
                          * that we can skip by using __fb_pitch_div4 + an early
                          * cast to u32.
                          */
+u32 __fb_bytespp = 4;
 
 int __fb_screen_w;
 int __fb_screen_h;
@@ -39,15 +42,22 @@ int __fb_off_y;
 int __fb_win_end_x;
 int __fb_win_end_y;
 
-u32 __fb_r_mask;
-u32 __fb_g_mask;
-u32 __fb_b_mask;
-u8 __fb_r_mask_size;
-u8 __fb_g_mask_size;
-u8 __fb_b_mask_size;
-u8 __fb_r_pos;
-u8 __fb_g_pos;
-u8 __fb_b_pos;
+/* The current clip rect, see tfb_push_clip_rect() */
+int __fb_clip_x0;
+int __fb_clip_y0;
+int __fb_clip_x1;
+int __fb_clip_y1;
+
+/* XRGB8888 until tfb_acquire_fb(), like the default pixel kernels */
+u32 __fb_r_mask = 0xff0000;
+u32 __fb_g_mask = 0x00ff00;
+u32 __fb_b_mask = 0x0000ff;
+u8 __fb_r_mask_size = 8;
+u8 __fb_g_mask_size = 8;
+u8 __fb_b_mask_size = 8;
+u8 __fb_r_pos = 16;
+u8 __fb_g_pos = 8;
+u8 __fb_b_pos = 0;
 
 int tfb_set_center_window_size(u32 w, u32 h)
 {
@@ -58,13 +68,27 @@ int tfb_set_center_window_size(u32 w, u32 h)
 
 void tfb_clear_screen(u32 color)
 {
-   if (__fb_pitch == (u32) 4 * __fb_screen_w) {
-      memset32(__fb_buffer, color, __fb_size >> 2);
+   if (__tfb_deferred) {
+
+      struct cmd cmd = {
+         .type = CMD_FILL_RECT,
+         .color = color,
+         .a = { 0, 0, __fb_screen_w, __fb_screen_h },
+         .clip = { 0, 0, __fb_screen_w, __fb_screen_h },
+         .bbox = { 0, 0, __fb_screen_w, __fb_screen_h },
+      };
+
+      if (tfb_int_defer(&cmd))
+         return;
+   }
+
+   if (__fb_pitch == __fb_bytespp * __fb_screen_w) {
+      __tfb_px.fill(__fb_buffer, color, __fb_size / __fb_bytespp);
       return;
    }
 
    for (int y = 0; y < __fb_screen_h; y++)
-      tfb_draw_hline(0, y, __fb_screen_w, color);
+      __tfb_px.fill(fb_ptr(0, y), color, __fb_screen_w);
 }
 
 void tfb_clear_win(u32 color)
@@ -72,39 +96,85 @@ void tfb_clear_win(u32 color)
    tfb_fill_rect(0, 0, __fb_win_w, __fb_win_h, color);
 }
 
+void tfb_int_fill_rect(const struct clip_rect *c,
+                       int x, int y, int w, int h, u32 color)
+{
+   const int xs = MAX(x, c->x0);
+   const int xe = MIN(x + w, c->x1);
+   const int yend = MIN(y + h, c->y1);
+   void *dest;
+
+   if (xs >= xe)
+      return;
+
+   y = MAX(y, c->y0);
+   dest = fb_ptr(xs, y);
+
+   for (; y < yend; y++, dest += __fb_pitch)
+      __tfb_px.fill(dest, color, xe - xs);
+}
+
+/*
+ * Record a filled rectangle in absolute coordinates, in deferred mode.
+ * Returns false if the rect has to be drawn immediately.
+ */
+static bool defer_rect(int x, int y, int w, int h, u32 color)
+{
+   struct cmd cmd = {
+      .type = CMD_FILL_RECT,
+      .color = color,
+      .a = { x, y, w, h },
+      .clip = win_clip(),
+      .bbox = { x, y, x + w, y + h },
+   };
+
+   return tfb_int_defer(&cmd);
+}
+
 void tfb_draw_hline(int x, int y, int len, u32 color)
 {
-   if (x < 0) {
-      len += x;
-      x = 0;
-   }
+   const struct clip_rect c = win_clip();
+
+   if (len < 0)
+      return;
 
    x += __fb_off_x;
    y += __fb_off_y;
 
-   if (len < 0 || y < __fb_off_y || y >= __fb_win_end_y)
+   if (__tfb_deferred && defer_rect(x, y, len, 1, color))
       return;
 
-   len = MIN(len, MAX(0, (int)__fb_win_end_x - x));
-   memset32(__fb_buffer + y * __fb_pitch + (x << 2), color, len);
+   if (y >= c.y0 && y < c.y1)
+      clip_span(&c, y, x, x + len, color);
 }
 
 void tfb_draw_vline(int x, int y, int len, u32 color)
 {
+   const struct clip_rect c = win_clip();
    int yend;
 
-   if (y < 0) {
-      len += y;
-      y = 0;
-   }
+   if (len < 0)
+      return;
 
    x += __fb_off_x;
    y += __fb_off_y;
 
-   if (len < 0 || x < __fb_off_x || x >= __fb_win_end_x)
+   if (__tfb_deferred && defer_rect(x, y, 1, len, color))
+      return;
+
+   if (x < c.x0 || x >= c.x1)
       return;
 
-   yend = MIN(y + len, __fb_win_end_y);
+   yend = MIN(y + len, c.y1);
+   y = MAX(y, c.y0);
+
+   if (__fb_bytespp != 4) {
+
+      for (void *p = fb_ptr(x, y); y < yend; y++, p += __fb_pitch)
+         __tfb_px.put(p, color);
+
+      return;
+   }
 
    volatile u32 *buf =
       ((volatile u32 *) __fb_buffer) + y * __fb_pitch_div4 + x;
@@ -115,8 +185,7 @@ void tfb_draw_vline(int x, int y, int len, u32 color)
 
 void tfb_fill_rect(int x, int y, int w, int h, u32 color)
 {
-   u32 yend;
-   void *dest;
+   const struct clip_rect c = win_clip();
 
    if (w < 0) {
       x += w;
@@ -131,26 +200,10 @@ void tfb_fill_rect(int x, int y, int w, int h, u32 color)
    x += __fb_off_x;
    y += __fb_off_y;
 
-   if (x < 0) {
-      w += x;
-      x = 0;
-   }
-
-   if (y < 0) {
-      h += y;
-      y = 0;
-   }
-
-   if (w < 0 || h < 0)
+   if (__tfb_deferred && defer_rect(x, y, w, h, color))
       return;
 
-   w = MIN(w, MAX(0, (int)__fb_win_end_x - x));
-   yend = MIN(y + h, __fb_win_end_y);
-
-   dest = __fb_buffer + y * __fb_pitch + (x << 2);
-
-   for (u32 cy = y; cy < yend; cy++, dest += __fb_pitch)
-      memset32(dest, color, w);
+   tfb_int_fill_rect(&c, x, y, w, h, color);
 }
 
 void tfb_draw_rect(int x, int y, int w, int h, u32 color)
@@ -162,7 +215,8 @@ void tfb_draw_rect(int x, int y, int w, int h, u32 color)
 }
 
 static void
-midpoint_line(int x, int y, int x1, int y1, u32 color, bool swap_xy)
+midpoint_line(const struct clip_rect *c,
+              int x, int y, int x1, int y1, u32 color, bool swap_xy)
 {
    const int dx = INT_ABS(x1 - x);
    const int dy = INT_ABS(y1 - y);
@@ -177,34 +231,78 @@ midpoint_line(int x, int y, int x1, int y1, u32 color, bool swap_xy)
 
    if (swap_xy) {
 
-      tfb_draw_pixel(y, x, color);
+      clip_pixel(c, y, x, color);
 
       while (x != x1) {
          x += sx;
          y += inc_y[d <= 0];
          d += inc_d[d <= 0];
-         tfb_draw_pixel(y, x, color);
+         clip_pixel(c, y, x, color);
       }
 
    } else {
 
-      tfb_draw_pixel(x, y, color);
+      clip_pixel(c, x, y, color);
 
       while (x != x1) {
          x += sx;
          y += inc_y[d <= 0];
          d += inc_d[d <= 0];
-         tfb_draw_pixel(x, y, color);
+         clip_pixel(c, x, y, color);
       }
    }
 }
 
-void tfb_draw_line(int x0, int y0, int x1, int y1, u32 color)
+void tfb_int_draw_line(const struct clip_rect *c,
+                       int x0, int y0, int x1, int y1, u32 color)
 {
    if (INT_ABS(y1 - y0) <= INT_ABS(x1 - x0))
-      midpoint_line(x0, y0, x1, y1, color, false);
+      midpoint_line(c, x0, y0, x1, y1, color, false);
    else
-      midpoint_line(y0, x0, y1, x1, color, true);
+      midpoint_line(c, y0, x0, y1, x1, color, true);
+}
+
+void tfb_draw_line(int x0, int y0, int x1, int y1, u32 color)
+{
+   const struct clip_rect c = win_clip();
+
+   x0 += __fb_off_x;
+   y0 += __fb_off_y;
+   x1 += __fb_off_x;
+   y1 += __fb_off_y;
+
+   if (__tfb_deferred) {
+
+      struct cmd cmd = {
+         .type = CMD_LINE,
+         .color = color,
+         .a = { x0, y0, x1, y1 },
+         .clip = c,
+         .bbox = { MIN(x0, x1), MIN(y0, y1), MAX(x0, x1) + 1, MAX(y0, y1) + 1 },
+      };
+
+      if (tfb_int_defer(&cmd))
+         return;
+   }
+
+   tfb_int_draw_line(&c, x0, y0, x1, y1, color);
+}
+
+/*
+ * Record a circle in absolute coordinates, in deferred mode.
+ * Returns false if the circle has to be drawn immediately.
+ */
+static bool defer_circle(enum cmd_type type, int cx, int cy, int r, u32 color)
+{
+   struct cmd cmd = {
+      .type = type,
+      .color = color,
+      .a = { cx, cy, r },
+      .clip = win_clip(),
+      .bbox = { cx - r, cy - r, cx + r + 1, cy + r + 1 },
+   };
+
+   return tfb_int_defer(&cmd);
 }
 
 /*
@@ -213,7 +311,8 @@ void tfb_draw_line(int x0, int y0, int x1, int y1, u32 color)
  *
  * Written by John Kennedy, Mathematics Department, Santa Monica College.
  */
-void tfb_draw_circle(int cx, int cy, int r, u32 color)
+void tfb_int_draw_circle(const struct clip_rect *c,
+                         int cx, int cy, int r, u32 color)
 {
    int x = r;
    int y = 0;
@@ -223,14 +322,14 @@ void tfb_draw_circle(int cx, int cy, int r, u32 color)
 
    while (x >= y) {
 
-      tfb_draw_pixel(cx + x, cy + y, color);
-      tfb_draw_pixel(cx - x, cy + y, color);
-      tfb_draw_pixel(cx - x, cy - y, color);
-      tfb_draw_pixel(cx + x, cy - y, color);
-      tfb_draw_pixel(cx + y, cy + x, color);
-      tfb_draw_pixel(cx - y, cy + x, color);
-      tfb_draw_pixel(cx - y, cy - x, color);
-      tfb_draw_pixel(cx + y, cy - x, color);
+      clip_pixel(c, cx + x, cy + y, color);
+      clip_pixel(c, cx - x, cy + y, color);
+      clip_pixel(c, cx - x, cy - y, color);
+      clip_pixel(c, cx + x, cy - y, color);
+      clip_pixel(c, cx + y, cy + x, color);
+      clip_pixel(c, cx - y, cy + x, color);
+      clip_pixel(c, cx - y, cy - x, color);
+      clip_pixel(c, cx + y, cy - x, color);
 
       y++;
       rerr += ych;
@@ -244,16 +343,405 @@ void tfb_draw_circle(int cx, int cy, int r, u32 color)
    }
 }
 
+void tfb_draw_circle(int cx, int cy, int r, u32 color)
+{
+   const struct clip_rect c = win_clip();
+
+   cx += __fb_off_x;
+   cy += __fb_off_y;
+
+   if (__tfb_deferred && defer_circle(CMD_CIRCLE, cx, cy, r, color))
+      return;
+
+   tfb_int_draw_circle(&c, cx, cy, r, color);
+}
+
 /*
- * Simple algorithm for drawing a filled circle which just scans the whole
- * 2R x 2R square containing the circle.
+ * Fill the circle one span per row. A pixel (x, y), relative to the center,
+ * belongs to the circle when x*x + y*y <= r*r + r. Going from the top row
+ * towards the center, the half-width of the span can only grow, so it's
+ * enough to step it incrementally and to mirror each span on the bottom half.
  */
-void tfb_fill_circle(int cx, int cy, int r, u32 color)
+void tfb_int_fill_circle(const struct clip_rect *c,
+                         int cx, int cy, int r, u32 color)
 {
    const int r2 = r * r + r;
+   int x = 0;
+
+   for (int y = -r; y <= 0; y++) {
+
+      while ((x + 1) * (x + 1) + y * y <= r2)
+         x++;
+
+      if (cy + y >= c->y0 && cy + y < c->y1)
+         clip_span(c, cy + y, cx - x, cx + x + 1, color);
+
+      if (y && cy - y >= c->y0 && cy - y < c->y1)
+         clip_span(c, cy - y, cx - x, cx + x + 1, color);
+   }
+}
+
+void tfb_fill_circle(int cx, int cy, int r, u32 color)
+{
+   const struct clip_rect c = win_clip();
+
+   cx += __fb_off_x;
+   cy += __fb_off_y;
+
+   if (__tfb_deferred && defer_circle(CMD_FILL_CIRCLE, cx, cy, r, color))
+      return;
+
+   tfb_int_fill_circle(&c, cx, cy, r, color);
+}
+
+#define FP_SHIFT          16
+#define FP_ONE            ((int64_t)1 << FP_SHIFT)
+#define FP_TO_PIXEL(v)    ((int)(((v) + (1 << (FP_SHIFT - 1)) - 1) >> FP_SHIFT))
+
+static void edge_init(struct edge *e, int xa, int ya, int xb, int yb)
+{
+   e->dir = 1;
+
+   if (ya > yb) {
+      int t;
+      t = xa; xa = xb; xb = t;
+      t = ya; ya = yb; yb = t;
+      e->dir = -1;
+   }
+
+   e->ymin = ya;
+   e->ymax = yb;
+   e->xt = xa;
+   e->ddx = xb - xa;
+   e->den = yb > ya ? 2 * (yb - ya) : 1;
+   floor_divmod(2 * e->ddx * FP_ONE, e->den, &e->dx, &e->dr);
+}
+
+/* Calculate the X of the edge at the center of the row 'y' */
+static inline void edge_start(struct edge *e, int y)
+{
+   const int64_t n =
+      ((int64_t)e->xt * e->den + (int64_t)e->ddx * (2 * (y - e->ymin) + 1));
+
+   floor_divmod(n * FP_ONE, e->den, &e->x, &e->r);
+}
+
+static inline void edge_step(struct edge *e)
+{
+   e->x += e->dx;
+   e->r += e->dr;
+
+   if (e->r >= e->den) {
+      e->x++;
+      e->r -= e->den;
+   }
+}
+
+void tfb_int_fill_triangle(const struct clip_rect *c,
+                           int x0, int y0, int x1, int y1, int x2, int y2,
+                           u32 color)
+{
+   struct edge e02, e01, e12, *left, *right, *sh;
+   int t, y, ymid, yend;
+
+   /* Sort the vertices by Y */
+   if (y0 > y1) { t = x0; x0 = x1; x1 = t; t = y0; y0 = y1; y1 = t; }
+   if (y1 > y2) { t = x1; x1 = x2; x2 = t; t = y1; y1 = y2; y2 = t; }
+   if (y0 > y1) { t = x0; x0 = x1; x1 = t; t = y0; y0 = y1; y1 = t; }
+
+   y = MAX(y0, c->y0);
+   yend = MIN(y2, c->y1);
+
+   if (y >= yend)
+      return;
 
-   for (int y = -r; y <= r; y++)
-      for (int x = -r; x <= r; x++)
-         if (x*x + y*y <= r2)
-            tfb_draw_pixel(cx + x, cy + y, color);
+   edge_init(&e02, x0, y0, x2, y2);
+   edge_init(&e01, x0, y0, x1, y1);
+   edge_init(&e12, x1, y1, x2, y2);
+
+   /*
+    * The long edge (v0, v2) is on the same side for the whole triangle:
+    * check once which one, using the sign of the cross product.
+    */
+   const bool long_on_left =
+      (int64_t)(x1 - x0) * (y2 - y0) - (int64_t)(x2 - x0) * (y1 - y0) > 0;
+
+   edge_start(&e02, y);
+
+   for (int pass = 0; pass < 2; pass++) {
+
+      if (pass == 0) {
+         sh = &e01;
+         ymid = MIN(y1, yend);
+      } else {
+         sh = &e12;
+         ymid = yend;
+      }
+
+      if (y >= ymid)
+         continue;
+
+      edge_start(sh, y);
+      left = long_on_left ? &e02 : sh;
+      right = long_on_left ? sh : &e02;
+
+      for (; y < ymid; y++) {
+         clip_span(c, y, FP_TO_PIXEL(left->x), FP_TO_PIXEL(right->x), color);
+         edge_step(left);
+         edge_step(right);
+      }
+   }
+}
+
+void tfb_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
+                       u32 color)
+{
+   const struct clip_rect c = win_clip();
+
+   x0 += __fb_off_x; y0 += __fb_off_y;
+   x1 += __fb_off_x; y1 += __fb_off_y;
+   x2 += __fb_off_x; y2 += __fb_off_y;
+
+   if (__tfb_deferred) {
+
+      struct cmd cmd = {
+         .type = CMD_TRIANGLE,
+         .color = color,
+         .a = { x0, y0, x1, y1, x2, y2 },
+         .clip = c,
+         .bbox = {
+            MIN(x0, MIN(x1, x2)), MIN(y0, MIN(y1, y2)),
+            MAX(x0, MAX(x1, x2)) + 1, MAX(y0, MAX(y1, y2)) + 1
+         },
+      };
+
+      if (tfb_int_defer(&cmd))
+         return;
+   }
+
+   tfb_int_fill_triangle(&c, x0, y0, x1, y1, x2, y2, color);
+}
+
+static int edge_cmp_ymin(const void *a, const void *b)
+{
+   return ((const struct edge *)a)->ymin - ((const struct edge *)b)->ymin;
+}
+
+int tfb_int_polygon_edges(struct edge *edges,
+                          const struct tfb_point *points, int n,
+                          int off_x, int off_y)
+{
+   int ne = 0;
+
+   /* Skip the horizontal edges */
+   for (int i = 0; i < n; i++) {
+
+      const struct tfb_point *a = &points[i];
+      const struct tfb_point *b = &points[(i + 1) % n];
+
+      if (a->y != b->y)
+         edge_init(&edges[ne++], a->x + off_x, a->y + off_y,
+                                 b->x + off_x, b->y + off_y);
+   }
+
+   qsort(edges, ne, sizeof(struct edge), edge_cmp_ymin);
+   return ne;
+}
+
+void tfb_int_scan_polygon(const struct clip_rect *c,
+                          const struct edge *edges, int ne,
+                          struct edge *work, struct edge **active,
+                          u32 color, int rule)
+{
+   int na = 0, nw = 0, next = 0;
+   struct edge *e;
+   int y, yend;
+
+   y = ne > 0 ? MAX(edges[0].ymin, c->y0) : c->y0;
+   yend = c->y0;
+
+   for (int i = 0; i < ne; i++)
+      yend = MAX(yend, edges[i].ymax);
+
+   yend = MIN(yend, c->y1);
+
+   for (; y < yend && (next < ne || na > 0); y++) {
+
+      int j = 0;
+
+      /* Drop the edges ending before this row */
+      for (int i = 0; i < na; i++)
+         if (active[i]->ymax > y)
+            active[j++] = active[i];
+
+      na = j;
+
+      /* Add the edges starting at (or, because of clipping, above) this row */
+      for (; next < ne && edges[next].ymin <= y; next++) {
+
+         if (edges[next].ymax <= y)
+            continue;
+
+         e = &work[nw++];
+         *e = edges[next];
+         edge_start(e, y);
+         active[na++] = e;
+      }
+
+      /* Keep the active list sorted by X: it's almost always sorted already */
+      for (int i = 1; i < na; i++) {
+
+         e = active[i];
+
+         for (j = i; j > 0 && active[j - 1]->x > e->x; j--)
+            active[j] = active[j - 1];
+
+         active[j] = e;
+      }
+
+      if (rule == TFB_FILL_NONZERO) {
+
+         for (int i = 0, wind = 0; i < na; i++) {
+
+            if (wind != 0)
+               clip_span(c, y, FP_TO_PIXEL(active[i - 1]->x),
+                               FP_TO_PIXEL(active[i]->x), color);
+
+            wind += active[i]->dir;
+         }
+
+      } else {
+
+         for (int i = 0; i + 1 < na; i += 2)
+            clip_span(c, y, FP_TO_PIXEL(active[i]->x),
+                            FP_TO_PIXEL(active[i + 1]->x), color);
+      }
+
+      for (int i = 0; i < na; i++)
+         edge_step(active[i]);
+   }
+}
+
+int tfb_int_fill_polygon(const struct clip_rect *c,
+                         const struct tfb_point *points, int n,
+                         int off_x, int off_y, u32 color, int rule)
+{
+   struct edge *edges, *work, **active;
+   int ne;
+
+   if (n < 3)
+      return TFB_SUCCESS;
+
+   edges = malloc(n * (2 * sizeof(struct edge) + sizeof(struct edge *)));
+
+   if (!edges)
+      return TFB_ERR_OUT_OF_MEMORY;
+
+   work = edges + n;
+   active = (struct edge **)(work + n);
+
+   ne = tfb_int_polygon_edges(edges, points, n, off_x, off_y);
+   tfb_int_scan_polygon(c, edges, ne, work, active, color, rule);
+
+   free(edges);
+   return TFB_SUCCESS;
+}
+
+int tfb_fill_polygon(const struct tfb_point *points, int n,
+                     u32 color, int rule)
+{
+   const struct clip_rect c = win_clip();
+
+   if (n < 3)
+      return TFB_SUCCESS;
+
+   if (__tfb_deferred) {
+
+      struct cmd cmd = {
+         .type = CMD_POLYGON,
+         .rule = rule,
+         .color = color,
+         .a = { __fb_off_x, __fb_off_y },
+         .clip = c,
+         .bbox = { INT_MAX, INT_MAX, INT_MIN, INT_MIN },
+      };
+
+      for (int i = 0; i < n; i++) {
+         cmd.bbox.x0 = MIN(cmd.bbox.x0, points[i].x + __fb_off_x);
+         cmd.bbox.y0 = MIN(cmd.bbox.y0, points[i].y + __fb_off_y);
+         cmd.bbox.x1 = MAX(cmd.bbox.x1, points[i].x + __fb_off_x + 1);
+         cmd.bbox.y1 = MAX(cmd.bbox.y1, points[i].y + __fb_off_y + 1);
+      }
+
+      if (tfb_int_defer_polygon(&cmd, points, n))
+         return TFB_SUCCESS;
+   }
+
+   return tfb_int_fill_polygon(&c, points, n, __fb_off_x, __fb_off_y,
+                               color, rule);
+}
+
+void tfb_copy_area(int x, int y, int w, int h, int dst_x, int dst_y)
+{
+   const struct clip_rect win = win_rect();
+   const struct clip_rect c = win_clip();
+   int d, step;
+   void *src, *dest;
+
+   tfb_int_deferred_sync();
+
+   x += __fb_off_x;
+   y += __fb_off_y;
+   dst_x += __fb_off_x;
+   dst_y += __fb_off_y;
+
+   /* Cut the source against the window and the destination against the clip */
+   if ((d = MAX(win.x0 - x, c.x0 - dst_x)) > 0) {
+      x += d;
+      dst_x += d;
+      w -= d;
+   }
+
+   if ((d = MAX(win.y0 - y, c.y0 - dst_y)) > 0) {
+      y += d;
+      dst_y += d;
+      h -= d;
+   }
+
+   w = MIN(w, MIN(win.x1 - x, c.x1 - dst_x));
+   h = MIN(h, MIN(win.y1 - y, c.y1 - dst_y));
+
+   if (w <= 0 || h <= 0)
+      return;
+
+   src = fb_ptr(x, y);
+   dest = fb_ptr(dst_x, dst_y);
+   step = __fb_pitch;
+
+   if (dst_y > y) {
+
+      /* Moving down: copy the rows bottom-up to not overwrite the source */
+      src += (h - 1) * __fb_pitch;
+      dest += (h - 1) * __fb_pitch;
+      step = -step;
+   }
+
+   for (int i = 0; i < h; i++, src += step, dest += step)
+      memmove(dest, src, w * __fb_bytespp);
+}
+
+void tfb_scroll_window(int dy, u32 fill_color)
+{
+   if (INT_ABS(dy) >= __fb_win_h) {
+      tfb_clear_win(fill_color);
+      return;
+   }
+
+   if (dy > 0) {
+      tfb_copy_area(0, dy, __fb_win_w, __fb_win_h - dy, 0, 0);
+      tfb_fill_rect(0, __fb_win_h - dy, __fb_win_w, dy, fill_color);
+   } else if (dy < 0) {
+      tfb_copy_area(0, 0, __fb_win_w, __fb_win_h + dy, 0, -dy);
+      tfb_fill_rect(0, 0, __fb_win_w, -dy, fill_color);
+   }
 }
@@ -22,6 +22,14 @@ static const char *error_msgs[] =
    /* 14 */    "Unable to set a keyboard input paramater with ioctl()",
    /* 15 */    "Unable to find a font matching the criteria",
    /* 16 */    "Unable to flush the framebuffer with ioctl()",
+   /* 17 */    "Unable to create a thread",
+   /* 18 */    "Unable to open a suitable input device",
+   /* 19 */    "Unable to set up the event loop",
+   /* 20 */    "Unable to open/write the output file",
+   /* 21 */    "Unable to set the VT mode with ioctl()",
+   /* 22 */    "Unable to open/read the input file",
+   /* 23 */    "Invalid or unsupported image/video file",
+   /* 24 */    "Too many nested clip rects",
 };
 
 const char *tfb_strerror(int error_code)
@@ -14,20 +14,85 @@
 #include <unistd.h>
 #include <termios.h>
 #include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #include <tfblib/tfblib.h>
+#include <tfblib/tfb_video.h>
 #include "utils.h"
 #include "font.h"
+#include "raster.h"
+#include "input.h"
+#include "vt.h"
 
 #define DEFAULT_FB_DEVICE "/dev/fb0"
 #define DEFAULT_TTY_DEVICE "/dev/tty"
 
+#define CACHE_LINE_SIZE    64
+#define PAGE_SIZE          4096
+#define HUGE_PAGE_SIZE     (2u << 20)
+
 struct fb_var_screeninfo __fbi;
 int __tfb_ttyfd = -1;
 
 static int fbfd = -1;
 
+/* The actual framebuffer's pitch and size, see TFB_FL_CONVERT_ON_FLUSH */
+static size_t real_pitch;
+static size_t real_size;
+static u32 real_bytespp;
+static convert_func convert;
+
+/* The back buffer is in a memfd, see TFB_FL_SHARED_BUFFER */
+static bool shared_buffer;
+
+/* The size of the back buffer's mapping (see alloc_back_buffer()) */
+static size_t back_size;
+
+/* See TFB_FL_SKIP_UNCHANGED, TFB_FL_ASYNC_FLUSH and TFB_FL_TRIPLE_BUFFER */
+static bool skip_unchanged;
+static bool async_flush;
+static bool triple_buffer;
+
+/*
+ * Updated by the flush thread and by the presenter thread as well, while the
+ * application might be reading it: always accessed with atomics.
+ */
+static struct tfb_flush_stats flush_stats;
+
+static inline void stat_add(uint64_t *stat, u64 n)
+{
+   __atomic_fetch_add(stat, n, __ATOMIC_RELAXED);
+}
+
 static void tfb_init_colors(void);
+static int tb_start(bool prefault);
+static void tb_stop(void);
+static void tb_publish(void);
+static void tb_wait_idle(void);
+
+static const struct fb_bitfield xrgb_red = { 16, 8, 0 };
+static const struct fb_bitfield xrgb_green = { 8, 8, 0 };
+static const struct fb_bitfield xrgb_blue = { 0, 8, 0 };
+
+#define CLIP_STACK_SIZE    32
+
+/* The pushed clip rects, in absolute coordinates, each one within the last */
+static struct clip_rect clip_stack[CLIP_STACK_SIZE];
+static int clip_depth;
+
+static void update_clip(void)
+{
+   struct clip_rect c = win_rect();
+
+   if (clip_depth)
+      c = clip_intersect(&c, &clip_stack[clip_depth - 1]);
+
+   __fb_clip_x0 = c.x0;
+   __fb_clip_y0 = c.y0;
+   __fb_clip_x1 = c.x1;
+   __fb_clip_y1 = c.y1;
+}
 
 int tfb_set_window(u32 x, u32 y, u32 w, u32 h)
 {
@@ -44,15 +109,119 @@ int tfb_set_window(u32 x, u32 y, u32 w, u32 h)
    __fb_win_end_x = __fb_off_x + __fb_win_w;
    __fb_win_end_y = __fb_off_y + __fb_win_h;
 
+   update_clip();
+   return TFB_SUCCESS;
+}
+
+int tfb_push_clip_rect(int x, int y, int w, int h)
+{
+   struct clip_rect r = {
+      x + __fb_off_x, y + __fb_off_y,
+      x + __fb_off_x + w, y + __fb_off_y + h
+   };
+
+   if (clip_depth == CLIP_STACK_SIZE)
+      return TFB_ERR_CLIP_STACK_FULL;
+
+   if (clip_depth)
+      r = clip_intersect(&r, &clip_stack[clip_depth - 1]);
+
+   clip_stack[clip_depth++] = r;
+   update_clip();
    return TFB_SUCCESS;
 }
 
+void tfb_pop_clip_rect(void)
+{
+   if (clip_depth) {
+      clip_depth--;
+      update_clip();
+   }
+}
+
+/*
+ * The pitch of the back buffer: every row starts on a cache line and, when
+ * the rows would be a multiple of the page size apart, a cache line of
+ * padding is added. Otherwise, all the pixels of a column would compete for
+ * the same few cache sets (and alias in the store buffer), making every
+ * vertical walk (vlines, circles, copy_area) much slower.
+ */
+static size_t back_buffer_pitch(u32 width, u32 bytespp)
+{
+   size_t pitch = ALIGN_UP((size_t)width * bytespp, CACHE_LINE_SIZE);
+
+   if (pitch % PAGE_SIZE == 0)
+      pitch += CACHE_LINE_SIZE;
+
+   return pitch;
+}
+
+/*
+ * Allocate the back buffer with mmap() instead of malloc(), in order to get
+ * huge pages: explicit ones (MAP_HUGETLB) when the system has some reserved,
+ * transparent ones (MADV_HUGEPAGE) otherwise. In the latter case, the mapping
+ * is aligned to the huge page size, or the kernel couldn't use them. With
+ * 'prefault', all the pages are faulted-in now, instead of during the first
+ * frame.
+ */
+static void *alloc_back_buffer(size_t size, bool prefault)
+{
+   const int prot = PROT_READ | PROT_WRITE;
+   const int fl = MAP_PRIVATE | MAP_ANONYMOUS;
+   const size_t len = ALIGN_UP(size, HUGE_PAGE_SIZE);
+   u8 *p, *aligned;
+
+#ifdef MAP_HUGETLB
+
+   p = mmap(NULL, len, prot, fl | MAP_HUGETLB | (prefault ? MAP_POPULATE : 0),
+            -1, 0);
+
+   if (p != MAP_FAILED) {
+      back_size = len;
+      return p;
+   }
+
+#endif
+
+   p = mmap(NULL, len + HUGE_PAGE_SIZE, prot, fl, -1, 0);
+
+   if (p == MAP_FAILED)
+      return NULL;
+
+   aligned = (u8 *)ALIGN_UP((uintptr_t)p, HUGE_PAGE_SIZE);
+
+   if (aligned > p)
+      munmap(p, aligned - p);
+
+   if (p + HUGE_PAGE_SIZE > aligned)
+      munmap(aligned + len, p + HUGE_PAGE_SIZE - aligned);
+
+   back_size = len;
+
+#ifdef MADV_HUGEPAGE
+   madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+
+   /*
+    * Not MAP_POPULATE: the pages would be faulted-in before madvise(), as
+    * regular pages. Touching them afterwards gets the huge ones.
+    */
+   if (prefault) {
+      for (size_t off = 0; off < len; off += PAGE_SIZE)
+         ((volatile u8 *)aligned)[off] = 0;
+   }
+
+   return aligned;
+}
+
 int tfb_acquire_fb(u32 flags, const char *fb_device, const char *tty_device)
 {
    static struct fb_fix_screeninfo fb_fixinfo;
 
    int ret = TFB_SUCCESS;
 
+   tfb_reset_flush_stats();
+
    if (!fb_device)
       fb_device = DEFAULT_FB_DEVICE;
 
@@ -76,20 +245,57 @@ int tfb_acquire_fb(u32 flags, const char *fb_device, const char *tty_device)
       goto out;
    }
 
-   __fb_pitch = fb_fixinfo.line_length;
-   __fb_size = __fb_pitch * __fbi.yres;
-   __fb_pitch_div4 = __fb_pitch >> 2;
+   real_pitch = fb_fixinfo.line_length;
+   real_size = real_pitch * __fbi.yres;
+   real_bytespp = __fbi.bits_per_pixel / 8;
+   convert = NULL;
 
-   if (__fbi.bits_per_pixel != 32) {
-      ret = TFB_ERR_UNSUPPORTED_VIDEO_MODE;
+   __fb_pitch = real_pitch;
+   __fb_size = real_size;
+
+   ret = tfb_int_set_pixel_format(__fbi.bits_per_pixel,
+                                  &__fbi.red, &__fbi.green, &__fbi.blue);
+
+   if (ret != TFB_SUCCESS)
       goto out;
+
+   /* The presenter thread owns the buffers: no sharing, no flush thread */
+   if (flags & TFB_FL_TRIPLE_BUFFER)
+      flags &= ~(TFB_FL_SHARED_BUFFER | TFB_FL_ASYNC_FLUSH);
+
+   if (flags & (TFB_FL_SHARED_BUFFER |
+                TFB_FL_SKIP_UNCHANGED |
+                TFB_FL_ASYNC_FLUSH |
+                TFB_FL_TRIPLE_BUFFER))
+   {
+      flags |= TFB_FL_USE_DOUBLE_BUFFER;
    }
 
-   if (__fbi.red.msb_right || __fbi.green.msb_right || __fbi.blue.msb_right) {
-      ret = TFB_ERR_UNSUPPORTED_VIDEO_MODE;
-      goto out;
+   if (flags & TFB_FL_CONVERT_ON_FLUSH) {
+
+      flags |= TFB_FL_USE_DOUBLE_BUFFER;
+
+      if (__fbi.bits_per_pixel != 32) {
+
+         convert = tfb_int_get_converter(&__fbi, flags & TFB_FL_DITHER);
+
+         if (!convert) {
+            ret = TFB_ERR_UNSUPPORTED_VIDEO_MODE;
+            goto out;
+         }
+
+         /* The back buffer is XRGB8888 */
+         tfb_int_set_pixel_format(32, &xrgb_red, &xrgb_green, &xrgb_blue);
+      }
    }
 
+   if (flags & TFB_FL_USE_DOUBLE_BUFFER) {
+      __fb_pitch = back_buffer_pitch(__fbi.xres, __fb_bytespp);
+      __fb_size = __fb_pitch * __fbi.yres;
+   }
+
+   __fb_pitch_div4 = __fb_pitch >> 2;
+
    __tfb_ttyfd = open(tty_device, O_RDWR);
 
    if (__tfb_ttyfd < 0) {
@@ -105,7 +311,12 @@ int tfb_acquire_fb(u32 flags, const char *fb_device, const char *tty_device)
       }
    }
 
-   __fb_real_buffer = mmap(NULL, __fb_size,
+   if (flags & TFB_FL_VT_PROCESS) {
+      if ((ret = tfb_int_vt_setup()) != TFB_SUCCESS)
+         goto out;
+   }
+
+   __fb_real_buffer = mmap(NULL, real_size,
                            PROT_READ | PROT_WRITE,
                            MAP_SHARED, fbfd, 0);
 
@@ -114,9 +325,24 @@ int tfb_acquire_fb(u32 flags, const char *fb_device, const char *tty_device)
       goto out;
    }
 
-   if (flags & TFB_FL_USE_DOUBLE_BUFFER) {
+   __fb_screen_w = __fbi.xres;
+   __fb_screen_h = __fbi.yres;
+
+   if (flags & TFB_FL_SHARED_BUFFER) {
 
-      __fb_buffer = malloc(__fb_size);
+      __fb_buffer = tfb_int_shared_alloc(__fb_size,
+                                         flags & TFB_FL_PREFAULT_BUFFER);
+      shared_buffer = true;
+
+      if (!__fb_buffer) {
+         ret = TFB_ERR_OUT_OF_MEMORY;
+         goto out;
+      }
+
+   } else if (flags & TFB_FL_USE_DOUBLE_BUFFER) {
+
+      __fb_buffer = alloc_back_buffer(__fb_size,
+                                      flags & TFB_FL_PREFAULT_BUFFER);
 
       if (!__fb_buffer) {
          ret = TFB_ERR_OUT_OF_MEMORY;
@@ -128,20 +354,31 @@ int tfb_acquire_fb(u32 flags, const char *fb_device, const char *tty_device)
       __fb_buffer = __fb_real_buffer;
    }
 
-   __fb_screen_w = __fbi.xres;
-   __fb_screen_h = __fbi.yres;
+   if (flags & TFB_FL_SKIP_UNCHANGED) {
 
-   __fb_r_pos = __fbi.red.offset;
-   __fb_r_mask_size = __fbi.red.length;
-   __fb_r_mask = ((1 << __fb_r_mask_size) - 1) << __fb_r_pos;
+      skip_unchanged = true;
 
-   __fb_g_pos = __fbi.green.offset;
-   __fb_g_mask_size = __fbi.green.length;
-   __fb_g_mask = ((1 << __fb_g_mask_size) - 1) << __fb_g_pos;
+      if (!tfb_int_tilehash_alloc()) {
+         ret = TFB_ERR_OUT_OF_MEMORY;
+         goto out;
+      }
+   }
 
-   __fb_b_pos = __fbi.blue.offset;
-   __fb_b_mask_size = __fbi.blue.length;
-   __fb_b_mask = ((1 << __fb_b_mask_size) - 1) << __fb_b_pos;
+   if (flags & TFB_FL_ASYNC_FLUSH) {
+
+      if ((ret = tfb_int_async_start()) != TFB_SUCCESS)
+         goto out;
+
+      async_flush = true;
+   }
+
+   if (flags & TFB_FL_TRIPLE_BUFFER) {
+
+      if ((ret = tb_start(flags & TFB_FL_PREFAULT_BUFFER)) != TFB_SUCCESS)
+         goto out;
+
+      triple_buffer = true;
+   }
 
    tfb_set_window(0, 0, __fb_screen_w, __fb_screen_h);
    tfb_init_colors();
@@ -159,13 +396,31 @@ out:
 
 void tfb_release_fb(void)
 {
+   tfb_end_deferred();
+   tfb_stop_recording();
+   clip_depth = 0;
+   tfb_int_async_stop();
+   tb_stop();
+
    if (__fb_real_buffer)
-      munmap(__fb_real_buffer, __fb_size);
+      munmap(__fb_real_buffer, real_size);
+
+   if (shared_buffer)
+      tfb_int_shared_free();
+   else if (back_size)
+      munmap(__fb_buffer, back_size);
 
-   if (__fb_buffer != __fb_real_buffer)
-      free(__fb_buffer);
+   if (skip_unchanged)
+      tfb_int_tilehash_free();
+
+   shared_buffer = false;
+   skip_unchanged = false;
+   async_flush = false;
+   triple_buffer = false;
+   back_size = 0;
 
    if (__tfb_ttyfd != -1) {
+      tfb_int_vt_restore();
       ioctl(__tfb_ttyfd, KDSETMODE, KD_TEXT);
       close(__tfb_ttyfd);
    }
@@ -178,8 +433,19 @@ void tfb_flush_rect(int x, int y, int w, int h)
 {
    int yend;
 
-   if (__fb_buffer == __fb_real_buffer)
+   tfb_int_deferred_sync();
+   tfb_int_vt_process_pending();
+   tfb_int_record_flush(x, y, w, h);
+
+   if (triple_buffer) {
+      tb_publish();
+      return;
+   }
+
+   if (__fb_buffer == __fb_real_buffer) {
+      tfb_int_latency_flush();
       return;
+   }
 
    x += __fb_off_x;
    y += __fb_off_y;
@@ -194,19 +460,95 @@ void tfb_flush_rect(int x, int y, int w, int h)
       y = 0;
    }
 
-   if (w < 0 || h < 0)
+   if (w < 0 || h < 0) {
+      /* Nothing to copy, but the flush still ends a frame */
+      tfb_int_latency_flush();
       return;
+   }
 
    w = MIN(w, MAX(0, __fb_win_end_x - x));
    yend = MIN(y + h, __fb_win_end_y);
 
-   size_t offset = y * __fb_pitch + (x << 2);
-   void *dest = __fb_real_buffer + offset;
-   void *src = __fb_buffer + offset;
-   u32 rect_pitch = w << 2;
+   if (shared_buffer && w > 0 && yend > y)
+      tfb_int_shared_publish(x, y, w, yend - y);
+
+   if (async_flush) {
+      tfb_int_async_flush(x, y, w, yend - y);
+      return;
+   }
+
+   if (tfb_int_flush_abs(__fb_buffer, x, y, w, yend - y))
+      tfb_int_latency_flush();
+}
+
+bool tfb_int_flush_abs(const void *buf, int x, int y, int w, int h)
+{
+   if (!tfb_int_flush_begin())
+      return false;
+
+   if (w > 0 && h > 0) {
+
+      const u64 size = (u64)w * h * __fb_bytespp;
+      u64 copied = size;
+
+      if (skip_unchanged)
+         copied = tfb_int_copy_changed(buf, x, y, w, h);
+      else
+         tfb_int_copy_rect(buf, x, y, w, h);
 
-   for (int cy = y; cy < yend; cy++, src += __fb_pitch, dest += __fb_pitch)
-      memcpy(dest, src, rect_pitch);
+      stat_add(&flush_stats.written_bytes, copied);
+      stat_add(&flush_stats.skipped_bytes, size - copied);
+   }
+
+   stat_add(&flush_stats.flushes, 1);
+   tfb_int_flush_end();
+   return true;
+}
+
+void tfb_wait_flush(void)
+{
+   tfb_int_async_wait();
+   tb_wait_idle();
+}
+
+#define STAT_LOAD(f)       __atomic_load_n(&flush_stats.f, __ATOMIC_RELAXED)
+#define STAT_RESET(f)      __atomic_store_n(&flush_stats.f, 0, __ATOMIC_RELAXED)
+
+void tfb_get_flush_stats(struct tfb_flush_stats *stats)
+{
+   *stats = (struct tfb_flush_stats) {
+      .flushes = STAT_LOAD(flushes),
+      .written_bytes = STAT_LOAD(written_bytes),
+      .skipped_bytes = STAT_LOAD(skipped_bytes),
+      .frames_presented = STAT_LOAD(frames_presented),
+      .frames_dropped = STAT_LOAD(frames_dropped),
+   };
+}
+
+void tfb_reset_flush_stats(void)
+{
+   STAT_RESET(flushes);
+   STAT_RESET(written_bytes);
+   STAT_RESET(skipped_bytes);
+   STAT_RESET(frames_presented);
+   STAT_RESET(frames_dropped);
+}
+
+void tfb_int_copy_rect(const void *buf, int x, int y, int w, int h)
+{
+   const void *src = buf + y * __fb_pitch + x * __fb_bytespp;
+   void *dest = __fb_real_buffer + y * real_pitch + x * real_bytespp;
+
+   if (convert) {
+
+      for (int cy = y; cy < y + h; cy++, src += __fb_pitch, dest += real_pitch)
+         convert(dest, src, w, x, cy);
+
+      return;
+   }
+
+   for (int cy = y; cy < y + h; cy++, src += __fb_pitch, dest += real_pitch)
+      memcpy(dest, src, w * __fb_bytespp);
 }
 
 void tfb_flush_window(void)
@@ -216,14 +558,217 @@ void tfb_flush_window(void)
 
 int tfb_flush_fb(void)
 {
+   tfb_int_vt_process_pending();
+   tfb_wait_flush();
+
+   if (!tfb_int_flush_begin())
+      return TFB_SUCCESS;
+
    __fbi.activate |= FB_ACTIVATE_NOW | FB_ACTIVATE_FORCE;
    if(ioctl(fbfd, FBIOPUT_VSCREENINFO, &__fbi) < 0) {
+      tfb_int_flush_end();
       return TFB_ERR_FB_FLUSH_IOCTL_FAILED;
    }
 
+   tfb_int_flush_end();
+   tfb_int_latency_flush();
+   return TFB_SUCCESS;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * Triple buffering
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Three back buffers: the application draws in one of them (__fb_buffer),
+ * the presenter thread copies another one to the framebuffer and the third
+ * one is in the 'ready' slot. Publishing a frame atomically exchanges the
+ * application's buffer with the one in the slot, marking it as fresh: if the
+ * buffer got back was still fresh, that frame has never been presented and
+ * it's dropped. The presenter does the same exchange, taking only fresh
+ * frames. Therefore, the application never waits for the presenter and the
+ * presenter always takes the newest complete frame.
+ */
+
+#define TB_FRESH              (1 << 2)
+
+static struct {
+
+   void *bufs[3];
+   int render;                   /* owned by the application */
+   int present;                  /* owned by the presenter */
+   int ready;                    /* index | TB_FRESH, exchanged atomically */
+   u64 frame[3];                 /* latency frame id of each buffer */
+   bool vsync;
+
+   pthread_t thread;
+   sem_t wake;
+   pthread_mutex_t lock;
+   pthread_cond_t idle_cond;
+   bool busy;
+   bool quit;
+
+} tb = {
+   .lock = PTHREAD_MUTEX_INITIALIZER,
+   .idle_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void tb_present(void)
+{
+   u32 crtc = 0;
+
+   /* Stop trying when the driver does not support it */
+   if (tb.vsync && ioctl(fbfd, FBIO_WAITFORVSYNC, &crtc) != 0)
+      tb.vsync = false;
+
+   if (tfb_int_flush_abs(tb.bufs[tb.present],
+                         0, 0, __fb_screen_w, __fb_screen_h))
+   {
+      stat_add(&flush_stats.frames_presented, 1);
+      tfb_int_latency_present(tb.frame[tb.present]);
+   }
+}
+
+static void *presenter_thread(void *arg)
+{
+   while (true) {
+
+      int old;
+
+      if (sem_wait(&tb.wake) != 0)
+         continue; /* EINTR */
+
+      pthread_mutex_lock(&tb.lock);
+      {
+         if (tb.quit) {
+            pthread_mutex_unlock(&tb.lock);
+            break;
+         }
+
+         tb.busy = true;
+      }
+      pthread_mutex_unlock(&tb.lock);
+
+      old = __atomic_exchange_n(&tb.ready, tb.present, __ATOMIC_ACQ_REL);
+      tb.present = old & ~TB_FRESH;
+
+      if (old & TB_FRESH)
+         tb_present();
+
+      pthread_mutex_lock(&tb.lock);
+      {
+         tb.busy = false;
+         pthread_cond_broadcast(&tb.idle_cond);
+      }
+      pthread_mutex_unlock(&tb.lock);
+   }
+
+   return NULL;
+}
+
+static void tb_publish(void)
+{
+   int old;
+
+   /*
+    * The pending latency samples go with the frame. If it gets dropped, they
+    * are closed by the next frame presented, which includes their effects.
+    */
+   tb.frame[tb.render] = tfb_int_latency_frame();
+   old = __atomic_exchange_n(&tb.ready, tb.render | TB_FRESH, __ATOMIC_ACQ_REL);
+
+   if (old & TB_FRESH)
+      stat_add(&flush_stats.frames_dropped, 1);
+
+   tb.render = old & ~TB_FRESH;
+   __fb_buffer = tb.bufs[tb.render];
+   sem_post(&tb.wake);
+}
+
+const void *tfb_int_screen_buffer(void)
+{
+   /* Once idle, the presenter's buffer holds the last frame published */
+   return triple_buffer ? tb.bufs[tb.present] : __fb_buffer;
+}
+
+/* Wait until the last published frame has been presented */
+static void tb_wait_idle(void)
+{
+   if (!triple_buffer)
+      return;
+
+   pthread_mutex_lock(&tb.lock);
+   {
+      while (tb.busy || (__atomic_load_n(&tb.ready, __ATOMIC_ACQUIRE) &
+                         TB_FRESH))
+      {
+         pthread_cond_wait(&tb.idle_cond, &tb.lock);
+      }
+   }
+   pthread_mutex_unlock(&tb.lock);
+}
+
+/* The buffer in __fb_buffer is left to tfb_release_fb() */
+static void tb_free_buffers(void)
+{
+   for (int i = 0; i < 3; i++) {
+
+      if (tb.bufs[i] && tb.bufs[i] != __fb_buffer)
+         munmap(tb.bufs[i], back_size);
+
+      tb.bufs[i] = NULL;
+   }
+}
+
+static int tb_start(bool prefault)
+{
+   tb.bufs[0] = __fb_buffer;
+   tb.bufs[1] = alloc_back_buffer(__fb_size, prefault);
+   tb.bufs[2] = alloc_back_buffer(__fb_size, prefault);
+
+   if (!tb.bufs[1] || !tb.bufs[2]) {
+      tb_free_buffers();
+      return TFB_ERR_OUT_OF_MEMORY;
+   }
+
+   tb.render = 0;
+   tb.present = 1;
+   tb.ready = 2;
+   memset(tb.frame, 0, sizeof(tb.frame));
+   tb.vsync = true;
+   tb.busy = tb.quit = false;
+   sem_init(&tb.wake, 0, 0);
+
+   if (pthread_create(&tb.thread, NULL, presenter_thread, NULL) != 0) {
+      sem_destroy(&tb.wake);
+      tb_free_buffers();
+      return TFB_ERR_THREAD_CREATE_FAILED;
+   }
+
    return TFB_SUCCESS;
 }
 
+static void tb_stop(void)
+{
+   if (!triple_buffer)
+      return;
+
+   pthread_mutex_lock(&tb.lock);
+   {
+      tb.quit = true;
+   }
+   pthread_mutex_unlock(&tb.lock);
+
+   sem_post(&tb.wake);
+   pthread_join(tb.thread, NULL);
+   sem_destroy(&tb.wake);
+   tb_free_buffers();
+}
+
 u32 tfb_screen_width_mm(void) { return __fbi.width; }
 u32 tfb_screen_height_mm(void) { return __fbi.height; }
 
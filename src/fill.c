@@ -0,0 +1,341 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <tfblib/tfblib.h>
+#include "utils.h"
+#include "raster.h"
+
+/*
+ * Gradient fills work on a ramp of RAMP_SIZE precomputed colors between the
+ * two end colors. Each pixel just needs the index in the ramp, which is
+ * stepped incrementally in 16.16 fixed point along the rows.
+ */
+#define RAMP_SIZE       256
+#define RAMP_MAX        (RAMP_SIZE - 1)
+#define RAMP_FP_MAX     ((int64_t)RAMP_MAX << 16)
+
+/*
+ * Limit for the gradients' window-relative coordinates and radius. With any
+ * screen smaller than 65536 pixels, |px - x0| < 2^17.6 and |dx| <= 2^18, so
+ * the fixed point setup of the linear gradients stays below 2^61, and the
+ * squared distances of the radial gradients below 2^37.
+ */
+#define GRADIENT_COORD_MAX    (1 << 17)
+
+#define STEP_EXACT(v, v_r, step, step_r, den)                               \
+   do {                                                                     \
+      v += step;                                                            \
+      v_r += step_r;                                                        \
+      if (v_r >= den) {                                                     \
+         v++;                                                               \
+         v_r -= den;                                                        \
+      }                                                                     \
+   } while (0)
+
+static inline int ramp_index(int64_t v)
+{
+   return v <= 0 ? 0 : (v >= RAMP_FP_MAX ? RAMP_MAX : (int)(v >> 16));
+}
+
+/*
+ * Rows are computed as u32 colors. In 32 bpp modes, they're written directly
+ * to the framebuffer, otherwise into 'span' and then stored with the pixel
+ * kernel of the current format.
+ */
+static inline u32 *row_dest(int x, int y, u32 *span)
+{
+   return __fb_bytespp == 4 ? fb_ptr(x, y) : span;
+}
+
+static inline void row_done(int x, int y, u32 *dest, u32 *span, int n)
+{
+   if (dest == span)
+      __tfb_px.copy(fb_ptr(x, y), span, n);
+}
+
+void tfb_int_fill_linear_gradient(const struct clip_rect *c,
+                                  int x, int y, int w, int h,
+                                  int x0, int y0, int x1, int y1,
+                                  u32 c0, u32 c1)
+{
+   const struct clip_rect rect = { x, y, x + w, y + h };
+   const struct clip_rect r = clip_intersect(&rect, c);
+   const int64_t dx = (int64_t)x1 - x0;
+   const int64_t dy = (int64_t)y1 - y0;
+   const int64_t len2 = dx * dx + dy * dy;
+   const int span_w = MAX(r.x1 - r.x0, 1);
+   u32 ramp[RAMP_SIZE];
+   u32 span[span_w];
+
+   if (clip_is_empty(&r))
+      return;
+
+   if (!len2) {
+      tfb_int_fill_rect(c, x, y, w, h, c1);
+      return;
+   }
+
+   __tfb_px.ramp(ramp, RAMP_SIZE, c0, c1);
+
+   /*
+    * The position along the gradient of the pixel (px, py), scaled to the
+    * ramp and in 16.16 fixed point, is:
+    *
+    *    v = ((px - x0) * dx + (py - y0) * dy) * (RAMP_MAX << 16) / len2
+    *
+    * which grows by a constant step for each pixel along a row. The division
+    * is stepped exactly, as a quotient plus a remainder, so that the value at
+    * a given pixel does not depend on where the span begins (e.g. because of
+    * clipping).
+    */
+   int64_t step, step_r, v, v_r;
+   floor_divmod(dx * RAMP_FP_MAX, len2, &step, &step_r);
+
+   if (dy == 0) {
+
+      /* Horizontal gradient: all the rows are the same */
+      floor_divmod(((int64_t)r.x0 - x0) * dx * RAMP_FP_MAX, len2, &v, &v_r);
+
+      for (int i = 0; i < span_w; i++) {
+         span[i] = ramp[ramp_index(v)];
+         STEP_EXACT(v, v_r, step, step_r, len2);
+      }
+
+      for (int cy = r.y0; cy < r.y1; cy++)
+         __tfb_px.copy(fb_ptr(r.x0, cy), span, span_w);
+
+      return;
+   }
+
+   for (int cy = r.y0; cy < r.y1; cy++) {
+
+      const int64_t px0 = (int64_t)r.x0 - x0;
+      const int64_t py0 = (int64_t)cy - y0;
+      u32 *dest;
+
+      floor_divmod((px0 * dx + py0 * dy) * RAMP_FP_MAX, len2, &v, &v_r);
+
+      if (dx == 0) {
+         /* Vertical gradient: each row has a single color */
+         __tfb_px.fill(fb_ptr(r.x0, cy), ramp[ramp_index(v)], span_w);
+         continue;
+      }
+
+      dest = row_dest(r.x0, cy, span);
+
+      for (int i = 0; i < span_w; i++) {
+         dest[i] = ramp[ramp_index(v)];
+         STEP_EXACT(v, v_r, step, step_r, len2);
+      }
+
+      row_done(r.x0, cy, dest, span, span_w);
+   }
+}
+
+void tfb_int_fill_radial_gradient(const struct clip_rect *c,
+                                  int x, int y, int w, int h,
+                                  int cx, int cy, int radius, u32 c0, u32 c1)
+{
+   const struct clip_rect rect = { x, y, x + w, y + h };
+   const struct clip_rect r = clip_intersect(&rect, c);
+   const int64_t r2 = (int64_t)radius * radius;
+   int64_t thr[RAMP_SIZE];
+   u32 ramp[RAMP_SIZE];
+   u32 span[MAX(r.x1 - r.x0, 1)];
+   int idx = 0;
+
+   if (clip_is_empty(&r))
+      return;
+
+   if (radius <= 0) {
+      tfb_int_fill_rect(c, x, y, w, h, c1);
+      return;
+   }
+
+   __tfb_px.ramp(ramp, RAMP_SIZE, c0, c1);
+
+   /*
+    * The ramp index of a pixel at distance 'd' from the center is
+    * d * RAMP_MAX / radius. Instead of calculating square roots, precompute
+    * the minimum squared distance for each index: along a row, the squared
+    * distance changes incrementally and so does the index, which just has to
+    * be moved up or down until it matches the current threshold.
+    */
+   for (int i = 0; i < RAMP_SIZE; i++)
+      thr[i] = ((int64_t)i * i * r2 + RAMP_MAX * RAMP_MAX - 1) /
+               (RAMP_MAX * RAMP_MAX);
+
+   for (int py = r.y0; py < r.y1; py++) {
+
+      const int64_t ddy = (int64_t)py - cy;
+      int64_t ddx = (int64_t)r.x0 - cx;
+      int64_t d2 = ddx * ddx + ddy * ddy;
+      u32 *const row = row_dest(r.x0, py, span);
+      u32 *dest = row;
+
+      for (int px = r.x0; px < r.x1; px++) {
+
+         while (idx < RAMP_MAX && d2 >= thr[idx + 1])
+            idx++;
+
+         while (idx > 0 && d2 < thr[idx])
+            idx--;
+
+         *dest++ = ramp[idx];
+
+         /* (ddx + 1)^2 = ddx^2 + 2 * ddx + 1 */
+         d2 += 2 * ddx + 1;
+         ddx++;
+      }
+
+      row_done(r.x0, py, row, span, r.x1 - r.x0);
+   }
+}
+
+static inline int mod_pos(int v, int m)
+{
+   v %= m;
+   return v < 0 ? v + m : v;
+}
+
+void tfb_int_fill_pattern(const struct clip_rect *c,
+                          int x, int y, int w, int h, int ax, int ay,
+                          const struct pattern *p)
+{
+   const struct clip_rect rect = { x, y, x + w, y + h };
+   const struct clip_rect r = clip_intersect(&rect, c);
+   const int sx0 = mod_pos(r.x0 - ax, p->w);
+   int sy = mod_pos(r.y0 - ay, p->h);
+
+   if (clip_is_empty(&r))
+      return;
+
+   for (int cy = r.y0; cy < r.y1; cy++) {
+
+      const u32 *src = (const u32 *)((const u8 *)p->pixels + sy * p->pitch);
+      void *dest = fb_ptr(r.x0, cy);
+      int sx = sx0;
+
+      /* Copy the pattern's row in whole chunks, wrapping around */
+      for (int rem = r.x1 - r.x0; rem > 0; ) {
+
+         const int n = MIN(rem, (int)p->w - sx);
+
+         __tfb_px.copy(dest, src + sx, n);
+         dest += n * __fb_bytespp;
+         rem -= n;
+         sx = 0;
+      }
+
+      if (++sy == (int)p->h)
+         sy = 0;
+   }
+}
+
+static inline int gradient_coord(int v)
+{
+   return MAX(-GRADIENT_COORD_MAX, MIN(v, GRADIENT_COORD_MAX));
+}
+
+static inline void normalize_rect(int *x, int *y, int *w, int *h)
+{
+   if (*w < 0) {
+      *x += *w;
+      *w = -*w;
+   }
+
+   if (*h < 0) {
+      *y += *h;
+      *h = -*h;
+   }
+
+   *x += __fb_off_x;
+   *y += __fb_off_y;
+}
+
+void tfb_fill_rect_linear_gradient(int x, int y, int w, int h,
+                                   int x0, int y0, u32 c0,
+                                   int x1, int y1, u32 c1)
+{
+   const struct clip_rect c = win_clip();
+
+   normalize_rect(&x, &y, &w, &h);
+   x0 = gradient_coord(x0) + __fb_off_x;
+   y0 = gradient_coord(y0) + __fb_off_y;
+   x1 = gradient_coord(x1) + __fb_off_x;
+   y1 = gradient_coord(y1) + __fb_off_y;
+
+   if (__tfb_deferred) {
+
+      struct cmd cmd = {
+         .type = CMD_LINEAR_GRADIENT,
+         .color = c0,
+         .color2 = c1,
+         .a = { x, y, w, h, x0, y0, x1, y1 },
+         .clip = c,
+         .bbox = { x, y, x + w, y + h },
+      };
+
+      if (tfb_int_defer(&cmd))
+         return;
+   }
+
+   tfb_int_fill_linear_gradient(&c, x, y, w, h, x0, y0, x1, y1, c0, c1);
+}
+
+void tfb_fill_rect_radial_gradient(int x, int y, int w, int h,
+                                   int cx, int cy, int r, u32 c0, u32 c1)
+{
+   const struct clip_rect c = win_clip();
+
+   normalize_rect(&x, &y, &w, &h);
+   cx = gradient_coord(cx) + __fb_off_x;
+   cy = gradient_coord(cy) + __fb_off_y;
+   r = gradient_coord(r);
+
+   if (__tfb_deferred) {
+
+      struct cmd cmd = {
+         .type = CMD_RADIAL_GRADIENT,
+         .color = c0,
+         .color2 = c1,
+         .a = { x, y, w, h, cx, cy, r },
+         .clip = c,
+         .bbox = { x, y, x + w, y + h },
+      };
+
+      if (tfb_int_defer(&cmd))
+         return;
+   }
+
+   tfb_int_fill_radial_gradient(&c, x, y, w, h, cx, cy, r, c0, c1);
+}
+
+void tfb_fill_rect_pattern(int x, int y, int w, int h,
+                           const u32 *pixels, u32 pw, u32 ph, u32 pitch)
+{
+   const struct clip_rect c = win_clip();
+   const struct pattern p = { pixels, pw, ph, pitch };
+
+   if (!pw || !ph)
+      return;
+
+   normalize_rect(&x, &y, &w, &h);
+
+   if (__tfb_deferred) {
+
+      struct cmd cmd = {
+         .type = CMD_PATTERN,
+         .a = { x, y, w, h, __fb_off_x, __fb_off_y },
+         .clip = c,
+         .bbox = { x, y, x + w, y + h },
+      };
+
+      if (tfb_int_defer_pattern(&cmd, &p))
+         return;
+   }
+
+   tfb_int_fill_pattern(&c, x, y, w, h, __fb_off_x, __fb_off_y, &p);
+}
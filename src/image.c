@@ -0,0 +1,732 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <tfblib/tfblib.h>
+#include <tfblib/tfb_image.h>
+#include "utils.h"
+#include "raster.h"
+#include "qoi.h"
+
+/*
+ * Streaming image decoders.
+ *
+ * The file is read sequentially through a fixed-size buffer and decoded one
+ * row at a time into a row of XRGB8888 pixels. Each row is then converted to
+ * the native format (see pixel_ops.from_xrgb) and written directly to the
+ * framebuffer. The memory used does not depend on the height of the image:
+ * just the read buffer and a few rows.
+ */
+
+#define READ_BUF_SIZE         (64 * 1024)
+#define MAX_IMAGE_SIDE        (1 << 16)
+
+#define BMP_FILE_HDR_SIZE     14
+#define BMP_MAX_INFO_SIZE     124      /* BITMAPV5HEADER */
+#define BMP_BI_RGB            0
+#define BMP_BI_BITFIELDS      3
+
+struct reader {
+   int fd;
+   u32 pos;
+   u32 len;
+   u8 buf[READ_BUF_SIZE];
+};
+
+struct image {
+
+   struct tfb_image_info info;
+
+   /* Netpbm */
+   u32 channels;              /* 1: gray, 2: gray + alpha, 3: RGB, 4: RGBA */
+   u32 maxval;
+
+   /* BMP */
+   u32 bpp;
+   bool bottom_up;
+   u32 shifts[3];             /* for BI_BITFIELDS: R, G, B */
+   u32 palette[256];
+
+   /* QOI */
+   struct qoi_rgba px;
+   struct qoi_rgba index[64];
+   u32 run;
+};
+
+/* Where the rows go: the image's position and the clip rect, absolute */
+struct sink {
+   int x;
+   int y;
+   struct clip_rect clip;
+   u32 *native;               /* conversion buffer, when not in 32 bpp */
+};
+
+/*
+ * ----------------------------------------------------------------------------
+ * Buffered reader
+ * ----------------------------------------------------------------------------
+ */
+
+static bool rd_fill(struct reader *r)
+{
+   ssize_t rc;
+
+   do {
+      rc = read(r->fd, r->buf, sizeof(r->buf));
+   } while (rc < 0 && errno == EINTR);
+
+   r->pos = 0;
+   r->len = rc > 0 ? rc : 0;
+   return r->len > 0;
+}
+
+static inline int rd_byte(struct reader *r)
+{
+   if (UNLIKELY(r->pos == r->len) && !rd_fill(r))
+      return -1;
+
+   return r->buf[r->pos++];
+}
+
+/* Read 'n' bytes into 'dest' or just skip them, if 'dest' is NULL */
+static bool rd_bytes(struct reader *r, void *dest, size_t n)
+{
+   u8 *d = dest;
+
+   while (n > 0) {
+
+      u32 chunk;
+
+      if (r->pos == r->len && !rd_fill(r))
+         return false;
+
+      chunk = MIN(n, (size_t)(r->len - r->pos));
+
+      if (d) {
+         memcpy(d, r->buf + r->pos, chunk);
+         d += chunk;
+      }
+
+      r->pos += chunk;
+      n -= chunk;
+   }
+
+   return true;
+}
+
+static inline u32 get_le16(const u8 *p)
+{
+   return p[0] | (p[1] << 8);
+}
+
+static inline u32 get_le32(const u8 *p)
+{
+   return get_le16(p) | (get_le16(p + 2) << 16);
+}
+
+static inline u32 get_be32(const u8 *p)
+{
+   return ((u32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static bool is_valid_size(u32 w, u32 h)
+{
+   return w > 0 && h > 0 && w <= MAX_IMAGE_SIDE && h <= MAX_IMAGE_SIDE;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Netpbm: P5, P6 and P7
+ * ----------------------------------------------------------------------------
+ */
+
+/* Read a whitespace-separated token, skipping the comments */
+static bool pnm_token(struct reader *r, char *tok, u32 size)
+{
+   u32 len = 0;
+   int c;
+
+   do {
+
+      c = rd_byte(r);
+
+      if (c == '#')
+         while (c >= 0 && c != '\n')
+            c = rd_byte(r);
+
+   } while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+
+   /* The single whitespace after the token is consumed as well */
+   for (; c > ' '; c = rd_byte(r)) {
+
+      if (len == size - 1)
+         return false;
+
+      tok[len++] = c;
+   }
+
+   tok[len] = 0;
+   return len > 0;
+}
+
+static bool pnm_number(struct reader *r, u32 *val)
+{
+   char tok[16];
+   char *end;
+   unsigned long v;
+
+   if (!pnm_token(r, tok, sizeof(tok)))
+      return false;
+
+   v = strtoul(tok, &end, 10);
+
+   if (*end || v > MAX_IMAGE_SIDE)
+      return false;
+
+   *val = v;
+   return true;
+}
+
+static int pnm_header(struct reader *r, struct image *img, char type)
+{
+   char tok[16];
+
+   img->info.format = TFB_IMG_PNM;
+   img->info.width = img->info.height = 0;
+
+   if (type != '7') {
+
+      img->channels = type == '5' ? 1 : 3;
+
+      if (!pnm_number(r, &img->info.width) ||
+          !pnm_number(r, &img->info.height) ||
+          !pnm_number(r, &img->maxval))
+      {
+         return TFB_ERR_INVALID_IMAGE;
+      }
+
+   } else {
+
+      img->channels = img->maxval = 0;
+
+      for (;;) {
+
+         u32 *field = NULL;
+
+         if (!pnm_token(r, tok, sizeof(tok)))
+            return TFB_ERR_INVALID_IMAGE;
+
+         if (!strcmp(tok, "ENDHDR"))
+            break;
+
+         if (!strcmp(tok, "WIDTH"))
+            field = &img->info.width;
+         else if (!strcmp(tok, "HEIGHT"))
+            field = &img->info.height;
+         else if (!strcmp(tok, "DEPTH"))
+            field = &img->channels;
+         else if (!strcmp(tok, "MAXVAL"))
+            field = &img->maxval;
+
+         /* TUPLTYPE is implied by DEPTH */
+         if (field ? !pnm_number(r, field) : !pnm_token(r, tok, sizeof(tok)))
+            return TFB_ERR_INVALID_IMAGE;
+      }
+   }
+
+   if (!is_valid_size(img->info.width, img->info.height))
+      return TFB_ERR_INVALID_IMAGE;
+
+   if (img->channels < 1 || img->channels > 4)
+      return TFB_ERR_INVALID_IMAGE;
+
+   if (img->maxval < 1 || img->maxval > 65535)
+      return TFB_ERR_INVALID_IMAGE;
+
+   return TFB_SUCCESS;
+}
+
+static inline u32 pnm_sample(const struct image *img, const u8 *p)
+{
+   const u32 v = img->maxval > 255 ? (u32)((p[0] << 8) | p[1]) : p[0];
+
+   if (img->maxval == 255)
+      return v;
+
+   return MIN((v * 255 + img->maxval / 2) / img->maxval, 255u);
+}
+
+static u32 pnm_row_size(const struct image *img)
+{
+   return img->info.width * img->channels * (img->maxval > 255 ? 2 : 1);
+}
+
+static void pnm_row(const struct image *img, const u8 *raw, u32 *row)
+{
+   const u32 w = img->info.width;
+   const u32 bps = img->maxval > 255 ? 2 : 1;
+   const u32 step = img->channels * bps;
+
+   if (img->channels == 3 && img->maxval == 255) {
+
+      for (u32 i = 0; i < w; i++, raw += 3)
+         row[i] = (raw[0] << 16) | (raw[1] << 8) | raw[2];
+
+      return;
+   }
+
+   for (u32 i = 0; i < w; i++, raw += step) {
+
+      if (img->channels >= 3) {
+
+         row[i] = (pnm_sample(img, raw) << 16) |
+                  (pnm_sample(img, raw + bps) << 8) |
+                  pnm_sample(img, raw + 2 * bps);
+
+      } else {
+
+         row[i] = pnm_sample(img, raw) * 0x010101;
+      }
+   }
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * BMP
+ * ----------------------------------------------------------------------------
+ */
+
+/* Only 8-bit channels are supported, at any position */
+static bool bmp_mask_shift(u32 mask, u32 *shift)
+{
+   if (!mask)
+      return false;
+
+   *shift = __builtin_ctz(mask);
+   return (mask >> *shift) == 0xff;
+}
+
+static int bmp_header(struct reader *r, struct image *img)
+{
+   u8 fh[BMP_FILE_HDR_SIZE - 2];
+   u8 ih[BMP_MAX_INFO_SIZE];
+   u32 offset, ih_size, compression, consumed;
+   u32 masks[3] = { 0xff0000, 0x00ff00, 0x0000ff };
+   int32_t w, h;
+
+   img->info.format = TFB_IMG_BMP;
+
+   if (!rd_bytes(r, fh, sizeof(fh)) || !rd_bytes(r, ih, 4))
+      return TFB_ERR_INVALID_IMAGE;
+
+   offset = get_le32(fh + 8);
+   ih_size = get_le32(ih);
+
+   /* BITMAPINFOHEADER (40) or any of the later versions (52+) */
+   if ((ih_size != 40 && ih_size < 52) || ih_size > BMP_MAX_INFO_SIZE)
+      return TFB_ERR_INVALID_IMAGE;
+
+   if (!rd_bytes(r, ih + 4, ih_size - 4))
+      return TFB_ERR_INVALID_IMAGE;
+
+   consumed = BMP_FILE_HDR_SIZE + ih_size;
+   w = (int32_t)get_le32(ih + 4);
+   h = (int32_t)get_le32(ih + 8);
+   img->bpp = get_le16(ih + 14);
+   compression = get_le32(ih + 16);
+
+   if (w <= 0 || h == 0 || h == INT32_MIN)
+      return TFB_ERR_INVALID_IMAGE;
+
+   img->bottom_up = h > 0;
+   img->info.width = w;
+   img->info.height = h > 0 ? h : -h;
+
+   if (!is_valid_size(img->info.width, img->info.height))
+      return TFB_ERR_INVALID_IMAGE;
+
+   if (compression == BMP_BI_BITFIELDS && img->bpp == 32) {
+
+      if (ih_size == 40) {
+
+         /* The masks follow the header */
+         if (!rd_bytes(r, ih + 40, 12))
+            return TFB_ERR_INVALID_IMAGE;
+
+         consumed += 12;
+      }
+
+      for (int i = 0; i < 3; i++)
+         masks[i] = get_le32(ih + 40 + 4 * i);
+
+   } else if (compression != BMP_BI_RGB) {
+
+      return TFB_ERR_INVALID_IMAGE;
+   }
+
+   for (int i = 0; i < 3; i++)
+      if (!bmp_mask_shift(masks[i], &img->shifts[i]))
+         return TFB_ERR_INVALID_IMAGE;
+
+   if (img->bpp == 8) {
+
+      u32 colors = get_le32(ih + 32);
+      u8 entry[4];
+
+      if (!colors)
+         colors = 256;
+
+      if (colors > 256)
+         return TFB_ERR_INVALID_IMAGE;
+
+      memset(img->palette, 0, sizeof(img->palette));
+
+      for (u32 i = 0; i < colors; i++) {
+
+         if (!rd_bytes(r, entry, 4))
+            return TFB_ERR_INVALID_IMAGE;
+
+         img->palette[i] = (entry[2] << 16) | (entry[1] << 8) | entry[0];
+      }
+
+      consumed += colors * 4;
+
+   } else if (img->bpp != 24 && img->bpp != 32) {
+
+      return TFB_ERR_INVALID_IMAGE;
+   }
+
+   /* Go to the pixel data */
+   if (offset < consumed || !rd_bytes(r, NULL, offset - consumed))
+      return TFB_ERR_INVALID_IMAGE;
+
+   return TFB_SUCCESS;
+}
+
+static u32 bmp_row_size(const struct image *img)
+{
+   return (img->info.width * (img->bpp / 8) + 3) & ~3u;
+}
+
+static void bmp_row(const struct image *img, const u8 *raw, u32 *row)
+{
+   const u32 w = img->info.width;
+
+   switch (img->bpp) {
+
+      case 8:
+         for (u32 i = 0; i < w; i++)
+            row[i] = img->palette[raw[i]];
+         break;
+
+      case 24:
+         for (u32 i = 0; i < w; i++, raw += 3)
+            row[i] = (raw[2] << 16) | (raw[1] << 8) | raw[0];
+         break;
+
+      case 32:
+         for (u32 i = 0; i < w; i++, raw += 4) {
+            const u32 px = get_le32(raw);
+            row[i] = (((px >> img->shifts[0]) & 0xff) << 16) |
+                     (((px >> img->shifts[1]) & 0xff) << 8) |
+                     ((px >> img->shifts[2]) & 0xff);
+         }
+         break;
+   }
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * QOI
+ * ----------------------------------------------------------------------------
+ */
+
+static int qoi_header(struct reader *r, struct image *img)
+{
+   u8 h[QOI_HEADER_SIZE - 2];
+
+   img->info.format = TFB_IMG_QOI;
+
+   if (!rd_bytes(r, h, sizeof(h)) || memcmp(h, QOI_MAGIC + 2, 2))
+      return TFB_ERR_INVALID_IMAGE;
+
+   img->info.width = get_be32(h + 2);
+   img->info.height = get_be32(h + 6);
+
+   if (!is_valid_size(img->info.width, img->info.height))
+      return TFB_ERR_INVALID_IMAGE;
+
+   if (h[10] != 3 && h[10] != 4)
+      return TFB_ERR_INVALID_IMAGE;
+
+   img->px = (struct qoi_rgba) { 0, 0, 0, 255 };
+   img->run = 0;
+   memset(img->index, 0, sizeof(img->index));
+   return TFB_SUCCESS;
+}
+
+static bool qoi_row(struct reader *r, struct image *img, u32 *row)
+{
+   struct qoi_rgba px = img->px;
+   int b1, b2;
+
+   for (u32 i = 0; i < img->info.width; i++) {
+
+      if (img->run) {
+         img->run--;
+         row[i] = qoi_rgba_to_xrgb(px);
+         continue;
+      }
+
+      if ((b1 = rd_byte(r)) < 0)
+         return false;
+
+      if (b1 == QOI_OP_RGB) {
+
+         if (!rd_bytes(r, &px, 3))
+            return false;
+
+      } else if (b1 == QOI_OP_RGBA) {
+
+         if (!rd_bytes(r, &px, 4))
+            return false;
+
+      } else {
+
+         switch (b1 & QOI_MASK_2) {
+
+            case QOI_OP_INDEX:
+               px = img->index[b1];
+               break;
+
+            case QOI_OP_DIFF:
+               px.r += ((b1 >> 4) & 3) - 2;
+               px.g += ((b1 >> 2) & 3) - 2;
+               px.b += (b1 & 3) - 2;
+               break;
+
+            case QOI_OP_LUMA:
+
+               if ((b2 = rd_byte(r)) < 0)
+                  return false;
+
+               px.r += (b1 & 0x3f) - 32 - 8 + ((b2 >> 4) & 0x0f);
+               px.g += (b1 & 0x3f) - 32;
+               px.b += (b1 & 0x3f) - 32 - 8 + (b2 & 0x0f);
+               break;
+
+            case QOI_OP_RUN:
+               img->run = b1 & 0x3f;
+               break;
+         }
+      }
+
+      img->index[qoi_hash(px)] = px;
+      row[i] = qoi_rgba_to_xrgb(px);
+   }
+
+   img->px = px;
+   return true;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Common code
+ * ----------------------------------------------------------------------------
+ */
+
+static int read_header(struct reader *r, struct image *img)
+{
+   u8 magic[2];
+
+   if (!rd_bytes(r, magic, 2))
+      return TFB_ERR_INVALID_IMAGE;
+
+   if (magic[0] == 'P' && magic[1] >= '5' && magic[1] <= '7')
+      return pnm_header(r, img, magic[1]);
+
+   if (magic[0] == 'B' && magic[1] == 'M')
+      return bmp_header(r, img);
+
+   if (!memcmp(magic, QOI_MAGIC, 2))
+      return qoi_header(r, img);
+
+   return TFB_ERR_INVALID_IMAGE;
+}
+
+static void sink_row(const struct sink *s, const u32 *row, u32 w, u32 n)
+{
+   const int y = s->y + n;
+   const int x0 = MAX(s->x, s->clip.x0);
+   const int x1 = MIN(s->x + (int)w, s->clip.x1);
+
+   if (y < s->clip.y0 || y >= s->clip.y1 || x0 >= x1)
+      return;
+
+   row += x0 - s->x;
+
+   if (__fb_bytespp == 4) {
+      __tfb_px.from_xrgb(fb_ptr(x0, y), row, x1 - x0);
+      return;
+   }
+
+   __tfb_px.from_xrgb(s->native, row, x1 - x0);
+   __tfb_px.copy(fb_ptr(x0, y), s->native, x1 - x0);
+}
+
+static int decode(struct reader *r, struct image *img, struct sink *s)
+{
+   const u32 w = img->info.width;
+   const u32 h = img->info.height;
+   u32 raw_size = 0;
+   u32 *row = NULL;
+   u8 *raw = NULL;
+   int rc = TFB_SUCCESS;
+
+   if (img->info.format == TFB_IMG_PNM)
+      raw_size = pnm_row_size(img);
+   else if (img->info.format == TFB_IMG_BMP)
+      raw_size = bmp_row_size(img);
+
+   row = malloc(w * sizeof(u32));
+   raw = raw_size ? malloc(raw_size) : NULL;
+   s->native = __fb_bytespp != 4 ? malloc(w * sizeof(u32)) : NULL;
+
+   if (!row || (raw_size && !raw) || (__fb_bytespp != 4 && !s->native)) {
+      rc = TFB_ERR_OUT_OF_MEMORY;
+      goto out;
+   }
+
+   for (u32 i = 0; i < h; i++) {
+
+      u32 n = i;
+
+      switch (img->info.format) {
+
+         case TFB_IMG_PNM:
+
+            if (!rd_bytes(r, raw, raw_size))
+               rc = TFB_ERR_INVALID_IMAGE;
+            else
+               pnm_row(img, raw, row);
+
+            break;
+
+         case TFB_IMG_BMP:
+
+            if (!rd_bytes(r, raw, raw_size))
+               rc = TFB_ERR_INVALID_IMAGE;
+            else
+               bmp_row(img, raw, row);
+
+            if (img->bottom_up)
+               n = h - 1 - i;
+
+            break;
+
+         case TFB_IMG_QOI:
+
+            if (!qoi_row(r, img, row))
+               rc = TFB_ERR_INVALID_IMAGE;
+
+            break;
+      }
+
+      if (rc != TFB_SUCCESS)
+         break;
+
+      sink_row(s, row, w, n);
+   }
+
+out:
+   free(s->native);
+   free(raw);
+   free(row);
+   return rc;
+}
+
+static struct reader *new_reader(int fd)
+{
+   struct reader *r = malloc(sizeof(struct reader));
+
+   if (r)
+      *r = (struct reader) { .fd = fd };
+
+   return r;
+}
+
+int tfb_get_image_info(const char *file, struct tfb_image_info *info)
+{
+   struct reader *r;
+   struct image *img;
+   int fd, rc;
+
+   if ((fd = open(file, O_RDONLY | O_CLOEXEC)) < 0)
+      return TFB_ERR_READ_FILE_FAILED;
+
+   r = new_reader(fd);
+   img = malloc(sizeof(struct image));
+
+   if (r && img) {
+
+      if ((rc = read_header(r, img)) == TFB_SUCCESS)
+         *info = img->info;
+
+   } else {
+
+      rc = TFB_ERR_OUT_OF_MEMORY;
+   }
+
+   free(img);
+   free(r);
+   close(fd);
+   return rc;
+}
+
+int tfb_draw_image_fd(int x, int y, int fd)
+{
+   struct sink s = {
+      .x = x + __fb_off_x,
+      .y = y + __fb_off_y,
+      .clip = win_clip(),
+   };
+
+   struct reader *r;
+   struct image *img;
+   int rc;
+
+   tfb_int_deferred_sync();
+
+   r = new_reader(fd);
+   img = malloc(sizeof(struct image));
+
+   if (r && img) {
+
+      if ((rc = read_header(r, img)) == TFB_SUCCESS)
+         rc = decode(r, img, &s);
+
+   } else {
+
+      rc = TFB_ERR_OUT_OF_MEMORY;
+   }
+
+   free(img);
+   free(r);
+   return rc;
+}
+
+int tfb_draw_image(int x, int y, const char *file)
+{
+   int fd, rc;
+
+   if ((fd = open(file, O_RDONLY | O_CLOEXEC)) < 0)
+      return TFB_ERR_READ_FILE_FAILED;
+
+   rc = tfb_draw_image_fd(x, y, fd);
+   close(fd);
+   return rc;
+}
@@ -0,0 +1,484 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tfblib/tfblib.h>
+#include <tfblib/tfb_input.h>
+#include "utils.h"
+#include "input.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#define MAX_INPUT_DEVS        16
+#define EVQ_SIZE              256      /* must be a power of 2 */
+#define EV_READ_BATCH         64
+#define MAX_DEV_BUTTONS       4        /* button changes buffered per report */
+#define EV_READ_CARRY         (MAX_DEV_BUTTONS + 2)
+
+#define BITS_PER_LONG         (8 * sizeof(long))
+#define NLONGS(n)             (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+struct input_dev {
+   bool mono_clock;        /* timestamps in CLOCK_MONOTONIC */
+   bool has_abs;
+   struct input_absinfo abs_x;
+   struct input_absinfo abs_y;
+
+   /* State accumulated until the next SYN_REPORT */
+   int raw_x;
+   int raw_y;
+   int rel_dx;
+   int rel_dy;
+   int wheel;
+   bool abs_moved;
+
+   /* Button events are emitted after the motion, at the new position */
+   u16 btn_codes[MAX_DEV_BUTTONS];
+   u8 btn_values[MAX_DEV_BUTTONS];
+   int btn_count;
+};
+
+/* The slots of the removed devices have fd = -1, until reused */
+static int input_fds[MAX_INPUT_DEVS];
+static struct input_dev input_devs[MAX_INPUT_DEVS];
+static int input_fds_count;
+
+/* The pointer position, shared by all the devices */
+static int ptr_x;
+static int ptr_y;
+
+static struct {
+   bool enabled;
+   int x_min, x_max, y_min, y_max;
+} calib;
+
+/*
+ * Queue of the events read from the devices and not returned yet. The readers
+ * stop reading when there's no room for a whole batch (see tfb_int_evq_room()),
+ * leaving the rest in the kernel's buffers: so, the queue should never be
+ * full. If it ever is, the oldest event is dropped.
+ */
+static struct tfb_event evq[EVQ_SIZE];
+static u32 evq_head;
+static u32 evq_tail;
+
+void tfb_int_evq_push(const struct tfb_event *ev)
+{
+   if (evq_tail - evq_head == EVQ_SIZE)
+      evq_head++;
+
+   evq[evq_tail++ & (EVQ_SIZE - 1)] = *ev;
+}
+
+u32 tfb_int_evq_room(void)
+{
+   return EVQ_SIZE - (evq_tail - evq_head);
+}
+
+bool tfb_int_evq_motion_only(void)
+{
+   for (u32 i = evq_head; i != evq_tail; i++)
+      if (evq[i & (EVQ_SIZE - 1)].type != TFB_EV_POINTER_MOTION)
+         return false;
+
+   return true;
+}
+
+/*
+ * Push a motion event, merging it with the last queued event if that's a
+ * motion event as well.
+ */
+static void evq_push_motion(const struct tfb_event *ev)
+{
+   struct tfb_event *last = &evq[(evq_tail - 1) & (EVQ_SIZE - 1)];
+
+   if (evq_tail != evq_head && last->type == TFB_EV_POINTER_MOTION) {
+      last->x = ev->x;
+      last->y = ev->y;
+      last->dx += ev->dx;
+      last->dy += ev->dy;
+      last->time_ns = ev->time_ns;
+      return;
+   }
+
+   tfb_int_evq_push(ev);
+}
+
+bool tfb_int_evq_pop(struct tfb_event *ev)
+{
+   if (evq_head == evq_tail)
+      return false;
+
+   *ev = evq[evq_head++ & (EVQ_SIZE - 1)];
+   return true;
+}
+
+static inline bool test_bit(const unsigned long *bits, u32 n)
+{
+   return (bits[n / BITS_PER_LONG] >> (n % BITS_PER_LONG)) & 1;
+}
+
+enum dev_kind {
+   DEV_OTHER,
+   DEV_KEYBOARD,
+   DEV_MOUSE,
+   DEV_TOUCH,
+};
+
+static enum dev_kind get_dev_kind(int fd)
+{
+   unsigned long ev_bits[NLONGS(EV_CNT)] = {0};
+   unsigned long key_bits[NLONGS(KEY_CNT)] = {0};
+   unsigned long rel_bits[NLONGS(REL_CNT)] = {0};
+   unsigned long abs_bits[NLONGS(ABS_CNT)] = {0};
+
+   if (ioctl(fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits) < 0)
+      return DEV_OTHER;
+
+   if (test_bit(ev_bits, EV_KEY))
+      ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits);
+
+   if (test_bit(ev_bits, EV_REL))
+      ioctl(fd, EVIOCGBIT(EV_REL, sizeof(rel_bits)), rel_bits);
+
+   if (test_bit(ev_bits, EV_ABS))
+      ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits);
+
+   if (test_bit(abs_bits, ABS_X) && test_bit(abs_bits, ABS_Y) &&
+       (test_bit(key_bits, BTN_TOUCH) || test_bit(key_bits, BTN_LEFT)))
+   {
+      return DEV_TOUCH;
+   }
+
+   if (test_bit(rel_bits, REL_X) && test_bit(rel_bits, REL_Y))
+      return DEV_MOUSE;
+
+   /* Power buttons etc. have EV_KEY too: look for some actual keys */
+   if (test_bit(key_bits, KEY_A) && test_bit(key_bits, KEY_Z) &&
+       test_bit(key_bits, KEY_ENTER) && test_bit(key_bits, KEY_SPACE))
+   {
+      return DEV_KEYBOARD;
+   }
+
+   return DEV_OTHER;
+}
+
+static int add_device(const char *path, u32 flags, bool known_kinds_only)
+{
+   struct input_dev *dev;
+   int fd, slot, clk = CLOCK_MONOTONIC;
+   enum dev_kind kind;
+
+   for (slot = 0; slot < input_fds_count; slot++)
+      if (input_fds[slot] < 0)
+         break;
+
+   if (slot == MAX_INPUT_DEVS)
+      return TFB_ERR_OPEN_INPUT;
+
+   fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+   if (fd < 0)
+      return TFB_ERR_OPEN_INPUT;
+
+   kind = get_dev_kind(fd);
+
+   if (known_kinds_only && kind == DEV_OTHER) {
+      close(fd);
+      return TFB_ERR_OPEN_INPUT;
+   }
+
+   if (flags & TFB_FL_INPUT_GRAB) {
+      if (ioctl(fd, EVIOCGRAB, 1) < 0) {
+         close(fd);
+         return TFB_ERR_OPEN_INPUT;
+      }
+   }
+
+   /*
+    * Make the kernel timestamp the events with the same clock used by the
+    * event loop's timers. Old kernels don't support it: in that case the
+    * events will have CLOCK_REALTIME timestamps, which are useless for the
+    * latency stats.
+    */
+   dev = &input_devs[slot];
+   *dev = (struct input_dev) { .mono_clock = !ioctl(fd, EVIOCSCLOCKID, &clk) };
+
+   if (kind == DEV_TOUCH) {
+      dev->has_abs = !ioctl(fd, EVIOCGABS(ABS_X), &dev->abs_x) &&
+                     !ioctl(fd, EVIOCGABS(ABS_Y), &dev->abs_y);
+      dev->raw_x = dev->abs_x.value;
+      dev->raw_y = dev->abs_y.value;
+   }
+
+   input_fds[slot] = fd;
+   input_fds_count = MAX(input_fds_count, slot + 1);
+   return TFB_SUCCESS;
+}
+
+int tfb_open_input_device(const char *device, u32 flags)
+{
+   struct dirent *de;
+   char path[280];
+   DIR *d;
+
+   if (device)
+      return add_device(device, flags, false);
+
+   if (!(d = opendir("/dev/input")))
+      return TFB_ERR_OPEN_INPUT;
+
+   while ((de = readdir(d))) {
+
+      if (strncmp(de->d_name, "event", 5))
+         continue;
+
+      snprintf(path, sizeof(path), "/dev/input/%s", de->d_name);
+      add_device(path, flags, true);
+   }
+
+   closedir(d);
+   return input_fds_count > 0 ? TFB_SUCCESS : TFB_ERR_OPEN_INPUT;
+}
+
+void tfb_close_input_devices(void)
+{
+   for (int i = 0; i < input_fds_count; i++)
+      if (input_fds[i] >= 0)
+         close(input_fds[i]);
+
+   input_fds_count = 0;
+   evq_head = evq_tail = 0;
+}
+
+int tfb_int_input_fds(const int **fds)
+{
+   *fds = input_fds;
+   return input_fds_count;
+}
+
+void tfb_int_input_remove(int dev)
+{
+   if (input_fds[dev] < 0)
+      return;
+
+   close(input_fds[dev]);
+   input_fds[dev] = -1;
+}
+
+void tfb_set_touch_calibration(int x_min, int x_max, int y_min, int y_max)
+{
+   calib.enabled = x_min != x_max && y_min != y_max;
+   calib.x_min = x_min;
+   calib.x_max = x_max;
+   calib.y_min = y_min;
+   calib.y_max = y_max;
+}
+
+/* Map a raw absolute value in [min, max] to [0, size - 1] */
+static inline int abs_to_screen(int v, int min, int max, u32 size)
+{
+   const int64_t r = (int64_t)(v - min) * ((int)size - 1) / (max - min);
+   return MAX(0, MIN((int)r, (int)size - 1));
+}
+
+static void clamp_pointer(void)
+{
+   ptr_x = MAX(0, MIN(ptr_x, (int)__fb_screen_w - 1));
+   ptr_y = MAX(0, MIN(ptr_y, (int)__fb_screen_h - 1));
+}
+
+/* Push the button changes buffered until the end of the report */
+static void flush_buttons(struct input_dev *dev, u64 time_ns)
+{
+   struct tfb_event ev = { .time_ns = time_ns, .x = ptr_x, .y = ptr_y };
+
+   for (int i = 0; i < dev->btn_count; i++) {
+
+      ev.type = dev->btn_values[i] ? TFB_EV_BUTTON_PRESS
+                                   : TFB_EV_BUTTON_RELEASE;
+      ev.code = dev->btn_codes[i];
+      tfb_int_evq_push(&ev);
+   }
+
+   dev->btn_count = 0;
+}
+
+static void handle_syn_report(struct input_dev *dev, u64 time_ns)
+{
+   struct tfb_event ev = { .time_ns = time_ns };
+   const int old_x = ptr_x;
+   const int old_y = ptr_y;
+
+   if (dev->abs_moved && dev->has_abs) {
+
+      if (calib.enabled) {
+         ptr_x = abs_to_screen(dev->raw_x, calib.x_min, calib.x_max,
+                               __fb_screen_w);
+         ptr_y = abs_to_screen(dev->raw_y, calib.y_min, calib.y_max,
+                               __fb_screen_h);
+      } else if (dev->abs_x.maximum > dev->abs_x.minimum &&
+                 dev->abs_y.maximum > dev->abs_y.minimum)
+      {
+         ptr_x = abs_to_screen(dev->raw_x, dev->abs_x.minimum,
+                               dev->abs_x.maximum, __fb_screen_w);
+         ptr_y = abs_to_screen(dev->raw_y, dev->abs_y.minimum,
+                               dev->abs_y.maximum, __fb_screen_h);
+      }
+   }
+
+   ptr_x += dev->rel_dx;
+   ptr_y += dev->rel_dy;
+   clamp_pointer();
+
+   if (ptr_x != old_x || ptr_y != old_y) {
+      ev.type = TFB_EV_POINTER_MOTION;
+      ev.x = ptr_x;
+      ev.y = ptr_y;
+      ev.dx = ptr_x - old_x;
+      ev.dy = ptr_y - old_y;
+      evq_push_motion(&ev);
+   }
+
+   flush_buttons(dev, time_ns);
+
+   ev.x = ptr_x;
+   ev.y = ptr_y;
+   ev.dx = ev.dy = 0;
+
+   if (dev->wheel) {
+      ev.type = TFB_EV_WHEEL;
+      ev.dy = dev->wheel;
+      tfb_int_evq_push(&ev);
+   }
+
+   dev->rel_dx = dev->rel_dy = dev->wheel = 0;
+   dev->abs_moved = false;
+}
+
+static void handle_key_event(struct input_dev *dev,
+                             const struct input_event *ie, u64 time_ns,
+                             u64 read_ns)
+{
+   static const u32 key_ev_types[] = {
+      TFB_EV_KEY_RELEASE, TFB_EV_KEY_PRESS, TFB_EV_KEY_REPEAT
+   };
+
+   struct tfb_event ev = {
+      .type = key_ev_types[ie->value],
+      .code = ie->code,
+      .time_ns = time_ns,
+      .x = ptr_x,
+      .y = ptr_y,
+   };
+
+   /* Presses and key repeats are the inputs worth measuring the latency of */
+   if (ie->value == 1 || (ie->value == 2 && ie->code < BTN_MISC))
+      tfb_int_latency_input(ie->code, dev->mono_clock ? time_ns : 0, read_ns);
+
+   if (BTN_MISC <= ie->code && ie->code < KEY_OK) {
+
+      /* Buttons don't repeat */
+      if (ie->value != 2) {
+
+         /* Too many changes in a single report: don't wait for its end */
+         if (dev->btn_count == ARRAY_SIZE(dev->btn_codes))
+            flush_buttons(dev, time_ns);
+
+         dev->btn_codes[dev->btn_count] = ie->code;
+         dev->btn_values[dev->btn_count] = ie->value;
+         dev->btn_count++;
+      }
+
+      return;
+   }
+
+   tfb_int_evq_push(&ev);
+}
+
+static void handle_input_event(struct input_dev *dev,
+                               const struct input_event *ie, u64 read_ns)
+{
+   const u64 time_ns = (u64)ie->input_event_sec * 1000000000ull +
+                       (u64)ie->input_event_usec * 1000ull;
+
+   switch (ie->type) {
+
+      case EV_KEY:
+         if ((u32)ie->value <= 2)
+            handle_key_event(dev, ie, time_ns, read_ns);
+         break;
+
+      case EV_REL:
+         if (ie->code == REL_X)
+            dev->rel_dx += ie->value;
+         else if (ie->code == REL_Y)
+            dev->rel_dy += ie->value;
+         else if (ie->code == REL_WHEEL)
+            dev->wheel += ie->value;
+         break;
+
+      case EV_ABS:
+         if (ie->code == ABS_X) {
+            dev->raw_x = ie->value;
+            dev->abs_moved = true;
+         } else if (ie->code == ABS_Y) {
+            dev->raw_y = ie->value;
+            dev->abs_moved = true;
+         }
+         break;
+
+      case EV_SYN:
+         if (ie->code == SYN_REPORT)
+            handle_syn_report(dev, time_ns);
+         break;
+   }
+}
+
+bool tfb_int_input_read(int dev)
+{
+   struct input_event buf[EV_READ_BATCH];
+   u64 read_ns = 0;
+   ssize_t rc;
+
+   /*
+    * Each input_event produces at most one tfb_event, except for the first
+    * SYN_REPORT, which also pushes what the previous batch left buffered: up
+    * to MAX_DEV_BUTTONS button changes, a wheel event and a pointer motion.
+    */
+   while (tfb_int_evq_room() >= EV_READ_BATCH + EV_READ_CARRY) {
+
+      rc = read(input_fds[dev], buf, sizeof(buf));
+
+      /* ENODEV: the device has been unplugged */
+      if (rc < 0 && errno != EAGAIN && errno != EINTR)
+         return false;
+
+      if (__tfb_latency_enabled)
+         read_ns = mono_time_ns();
+
+      for (ssize_t i = 0; i < rc / (ssize_t)sizeof(buf[0]); i++)
+         handle_input_event(&input_devs[dev], &buf[i], read_ns);
+
+      if (rc != sizeof(buf))
+         break;
+   }
+
+   return true;
+}
+
+bool tfb_read_event(struct tfb_event *ev)
+{
+   if (evq_head == evq_tail) {
+      for (int i = 0; i < input_fds_count; i++)
+         if (input_fds[i] >= 0 && !tfb_int_input_read(i))
+            tfb_int_input_remove(i);
+   }
+
+   return tfb_int_evq_pop(ev);
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include <time.h>
+
+#include <tfblib/tfblib.h>
+#include <tfblib/tfb_input.h>
+#include "utils.h"
+
+static inline u64 mono_time_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* The TTY fd when the event loop can wait on it, -1 otherwise (kb.c) */
+int tfb_int_kb_pollable_fd(void);
+
+/*
+ * Event queue and evdev devices (input.c)
+ */
+void tfb_int_evq_push(const struct tfb_event *ev);
+bool tfb_int_evq_pop(struct tfb_event *ev);
+
+/* Free slots in the queue: read more input only if there's room for it */
+u32 tfb_int_evq_room(void);
+
+/* True if the queue contains only pointer motion (or nothing) */
+bool tfb_int_evq_motion_only(void);
+
+/*
+ * Read all the available events from an evdev device into the queue. Returns
+ * false when the device is gone (e.g. unplugged) and must be removed.
+ */
+bool tfb_int_input_read(int dev);
+
+/* Get the fds of the evdev devices, -1 for the removed ones */
+int tfb_int_input_fds(const int **fds);
+
+/* Close a device and free its slot. The caller must remove it from epoll. */
+void tfb_int_input_remove(int dev);
+
+/*
+ * Input latency instrumentation (latency.c)
+ */
+extern bool __tfb_latency_enabled;
+
+void tfb_int_latency_record_input(u64 code, u64 kernel_ns, u64 read_ns);
+u64 tfb_int_latency_record_frame(void);
+void tfb_int_latency_record_present(u64 frame);
+
+/*
+ * Register an input for which a sample will be taken at the end of the next
+ * flush. 'kernel_ns' is 0 when the source has no CLOCK_MONOTONIC timestamp.
+ */
+static inline void tfb_int_latency_input(u64 code, u64 kernel_ns, u64 read_ns)
+{
+   if (__tfb_latency_enabled)
+      tfb_int_latency_record_input(code, kernel_ns, read_ns);
+}
+
+/*
+ * Called by the flush functions when a frame is complete but not on the
+ * device yet: the pending inputs are handed over to it. Returns the id of the
+ * frame, to pass to tfb_int_latency_present(), or 0 when disabled.
+ */
+static inline u64 tfb_int_latency_frame(void)
+{
+   return __tfb_latency_enabled ? tfb_int_latency_record_frame() : 0;
+}
+
+/* Called, in any thread, once the frame 'frame' is on the device */
+static inline void tfb_int_latency_present(u64 frame)
+{
+   if (frame)
+      tfb_int_latency_record_present(frame);
+}
+
+/* Called by the flush functions once the pixels are on the device */
+static inline void tfb_int_latency_flush(void)
+{
+   if (__tfb_latency_enabled)
+      tfb_int_latency_record_present(tfb_int_latency_record_frame());
+}
@@ -3,6 +3,7 @@
 #include <tfblib/tfblib.h>
 #include <tfblib/tfb_kb.h>
 #include "utils.h"            // internal header
+#include "input.h"
 
 #include <fcntl.h>
 #include <linux/kd.h>
@@ -98,159 +99,171 @@ int tfb_restore_kb_mode(void)
    return TFB_SUCCESS;
 }
 
+/*
+ * TTY input decoder.
+ *
+ * Bytes are read from the TTY in large chunks into 'kb.buf' and then consumed
+ * one by one by the escape sequence state machine, just moving 'kb.pos'. The
+ * buffer is refilled only once it has been fully consumed, so it never needs
+ * to wrap around nor to be compacted. The state machine keeps its state
+ * between calls, so sequences split across reads are handled as well.
+ */
+
+#define KB_BUF_SIZE     4096
+
 static struct {
 
    enum {
-      NB_INITIAL_STATE,
-      NB_AFTER_ESC_READ,
-      NB_AFTER_OPEN_BRACKET_READ
+      KB_INITIAL_STATE,
+      KB_AFTER_ESC_READ,
+      KB_AFTER_OPEN_BRACKET_READ,
+      KB_AFTER_SS3_READ
    } state;
 
-   int len;
-   int readbuf_len;
+   u32 seq_len;         /* total length of the sequence, even if > 8 */
 
    union {
       tfb_key_t key;
-      char buf[sizeof(tfb_key_t)];
+      char seq[sizeof(tfb_key_t)];
    };
 
-   char readbuf[sizeof(tfb_key_t)];
-
-} nb_ctx;
+   u32 pos;
+   u32 len;
+   u64 read_ns;         /* time of the last read(), for the latency stats */
+   char buf[KB_BUF_SIZE];
 
-static inline void nb_ctx_append(char c)
-{
-   nb_ctx.buf[nb_ctx.len++] = c;
-}
+} kb;
 
-static tfb_key_t nb_handle_initial_state(int rc, char c)
+static inline void kb_seq_append(char c)
 {
-   nb_ctx.len = 0;
-   nb_ctx.key = 0;
-
-   if (rc <= 0)
-      return 0;
-
-   if (c != '\033')
-      return c; /* remain in the initial state */
+   if (kb.seq_len < sizeof(tfb_key_t)) {
+      kb.seq[kb.seq_len] = c;
+   } else {
+      /*
+       * Sequence too long for our 64-bit int: keep consuming it until its
+       * final byte, which always overwrites the last slot. In the worst case
+       * that makes two long sequences with the same prefix indistinguishable,
+       * but at least their bytes won't be returned as regular keystrokes.
+       */
+      kb.seq[sizeof(tfb_key_t) - 1] = c;
+   }
 
-   nb_ctx_append(c);
-   nb_ctx.state = NB_AFTER_ESC_READ;
-   return 0;
+   kb.seq_len++;
 }
 
-static tfb_key_t nb_handle_after_esc_state(int rc, char c)
+static tfb_key_t kb_decode(char c)
 {
-   if (rc <= 0) {
+   switch (kb.state) {
 
-      if (errno != EAGAIN)
-         nb_ctx.state = NB_INITIAL_STATE;
-
-      return 0;
-   }
-
-   if (c != '[') {
-
-      /* unknown escape sequence */
-      nb_ctx.state = NB_INITIAL_STATE;
-      return 0;
-   }
+      case KB_INITIAL_STATE:
 
-   /* c is '[' */
-   nb_ctx_append(c);
-   nb_ctx.state = NB_AFTER_OPEN_BRACKET_READ;
-   return 0;
-}
+         if (c != '\033')
+            return (u8)c;
 
-static tfb_key_t nb_handle_after_open_bracket_state(int rc, char c)
-{
-   if (rc < 0) {
+         kb.key = 0;
+         kb.seq_len = 0;
+         kb_seq_append(c);
+         kb.state = KB_AFTER_ESC_READ;
+         return 0;
 
-      if (errno != EAGAIN)
-         nb_ctx.state = NB_INITIAL_STATE;
+      case KB_AFTER_ESC_READ:
 
-      return 0;
-   }
+         if (c != '[' && c != 'O') {
+            /* unknown escape sequence */
+            kb.state = KB_INITIAL_STATE;
+            return 0;
+         }
 
-   if (rc == 0) {
+         kb_seq_append(c);
+         kb.state = c == '[' ? KB_AFTER_OPEN_BRACKET_READ : KB_AFTER_SS3_READ;
+         return 0;
 
-      nb_ctx.state = NB_INITIAL_STATE;
+      case KB_AFTER_SS3_READ:
 
-      if (nb_ctx.len > 2)
-         return nb_ctx.key;
+         /* SS3 sequences (e.g. ESC O P) have always a single final byte */
+         kb_seq_append(c);
+         kb.state = KB_INITIAL_STATE;
+         return kb.key;
 
-      return 0;
-   }
+      case KB_AFTER_OPEN_BRACKET_READ:
 
-   nb_ctx_append(c);
+         kb_seq_append(c);
 
-   if (0x40 <= c && c <= 0x7E && c != '[') {
-      nb_ctx.state = NB_INITIAL_STATE;
-      return nb_ctx.key;
-   }
+         /* The Linux console's F1-F5 keys have a second '[' (e.g. ESC[[A) */
+         if (0x40 <= c && c <= 0x7E && c != '[') {
+            kb.state = KB_INITIAL_STATE;
+            return kb.key;
+         }
 
-   if (nb_ctx.len == sizeof(tfb_key_t)) {
-      /* no more space in our 64-bit int (seq too long) */
-      nb_ctx.state = NB_INITIAL_STATE;
+         return 0;
    }
 
    return 0;
 }
 
-static tfb_key_t tfb_switch_state_read(int rc, char c)
+/*
+ * Refill the buffer. Returns the number of bytes read, 0 when nothing is
+ * available (non-blocking mode) or -1 on errors and EOF.
+ */
+static int kb_fill(void)
 {
-   switch (nb_ctx.state) {
+   int rc = read(__tfb_ttyfd, kb.buf, sizeof(kb.buf));
 
-      case NB_INITIAL_STATE:
-         return nb_handle_initial_state(rc, c);
+   if (rc <= 0) {
 
-      case NB_AFTER_ESC_READ:
-         return nb_handle_after_esc_state(rc, c);
+      if (rc < 0 && errno == EAGAIN)
+         return 0;
 
-      case NB_AFTER_OPEN_BRACKET_READ:
-         return nb_handle_after_open_bracket_state(rc, c);
+      /* Drop any partial sequence */
+      kb.state = KB_INITIAL_STATE;
+      return -1;
    }
 
-   return 0;
+   kb.pos = 0;
+   kb.len = rc;
+
+   if (__tfb_latency_enabled)
+      kb.read_ns = mono_time_ns();
+
+   return rc;
 }
 
-tfb_key_t tfb_read_keypress(void)
+int tfb_read_keypresses(tfb_key_t *keys, int max_keys)
 {
-   tfb_key_t ret = 0;
-   int rc = nb_ctx.readbuf_len;
-   char c;
+   tfb_key_t k;
+   int n = 0;
 
    if (!tfb_kb_raw_mode) {
       /*
-       * tfb_read_keypress() is supposed to be used only after a successful
+       * tfb_read_keypresses() is supposed to be used only after a successful
        * call to tfb_set_kb_raw_mode().
        */
       return 0;
    }
 
-   for (u32 i = 0; i < sizeof(tfb_key_t); i++) {
-
-      if (!nb_ctx.readbuf_len) {
-
-         rc = read(__tfb_ttyfd, nb_ctx.readbuf, sizeof(nb_ctx.readbuf));
-
-         if (rc <= 0)
-            break;
-
-         nb_ctx.readbuf_len = rc;
-      }
+   while (n < max_keys) {
 
-      c = nb_ctx.readbuf[0];
-      memmove(nb_ctx.readbuf, nb_ctx.readbuf + 1, sizeof(nb_ctx.readbuf) - 1);
-      nb_ctx.readbuf_len--;
+      while (kb.pos < kb.len && n < max_keys)
+         if ((k = kb_decode(kb.buf[kb.pos++]))) {
+            tfb_int_latency_input(k, 0, kb.read_ns);
+            keys[n++] = k;
+         }
 
-      ret = tfb_switch_state_read(rc, c);
+      /* In blocking mode, read() must not be called once we have a key */
+      if (n == max_keys || (n > 0 && !tfb_kb_nonblock))
+         break;
 
-      if (ret != 0)
+      if (kb_fill() <= 0)
          break;
    }
 
-   return ret;
+   return n;
+}
+
+tfb_key_t tfb_read_keypress(void)
+{
+   tfb_key_t k;
+   return tfb_read_keypresses(&k, 1) ? k : 0;
 }
 
 static char tfb_fn_key_seq_char[12][8] =
@@ -271,11 +284,129 @@ static char tfb_fn_key_seq_char[12][8] =
 
 tfb_key_t *tfb_int_fn_key_sequences = (tfb_key_t *)tfb_fn_key_seq_char;
 
+/*
+ * Special keys decoding.
+ *
+ * A sequence is split into its introducer (CSI, SS3 or the Linux console's
+ * ESC [[), up to two numeric parameters and a final byte. Then, the symbol is
+ * found by directly indexing a table with the final byte or, for the
+ * sequences ending with '~', with the first parameter. The second parameter,
+ * when present, is xterm's modifier value: 1 + the TFB_MOD_* bits.
+ */
+
+#define MAX_TILDE_CODE 34
+
+static const u8 csi_final_syms[128] =
+{
+   ['A'] = TFB_SYM_UP,
+   ['B'] = TFB_SYM_DOWN,
+   ['C'] = TFB_SYM_RIGHT,
+   ['D'] = TFB_SYM_LEFT,
+   ['E'] = TFB_SYM_KP_CENTER,
+   ['F'] = TFB_SYM_END,
+   ['G'] = TFB_SYM_KP_CENTER,
+   ['H'] = TFB_SYM_HOME,
+   ['P'] = TFB_SYM_F1,
+   ['Q'] = TFB_SYM_F2,
+   ['R'] = TFB_SYM_F3,
+   ['S'] = TFB_SYM_F4,
+   ['Z'] = TFB_SYM_BACK_TAB,
+};
+
+/* Linux console: ESC [[A ... ESC [[E */
+static const u8 console_final_syms[128] =
+{
+   ['A'] = TFB_SYM_F1,
+   ['B'] = TFB_SYM_F2,
+   ['C'] = TFB_SYM_F3,
+   ['D'] = TFB_SYM_F4,
+   ['E'] = TFB_SYM_F5,
+};
+
+static const u8 tilde_syms[MAX_TILDE_CODE + 1] =
+{
+   [1] = TFB_SYM_HOME,
+   [2] = TFB_SYM_INS,
+   [3] = TFB_SYM_DEL,
+   [4] = TFB_SYM_END,
+   [5] = TFB_SYM_PAGE_UP,
+   [6] = TFB_SYM_PAGE_DOWN,
+   [7] = TFB_SYM_HOME,           /* rxvt */
+   [8] = TFB_SYM_END,            /* rxvt */
+   [11] = TFB_SYM_F1,            /* vt220-style F1-F4 */
+   [12] = TFB_SYM_F2,
+   [13] = TFB_SYM_F3,
+   [14] = TFB_SYM_F4,
+   [15] = TFB_SYM_F5,
+   [17] = TFB_SYM_F6,
+   [18] = TFB_SYM_F7,
+   [19] = TFB_SYM_F8,
+   [20] = TFB_SYM_F9,
+   [21] = TFB_SYM_F10,
+   [23] = TFB_SYM_F11,
+   [24] = TFB_SYM_F12,
+};
+
+enum tfb_key_sym tfb_get_key_sym(tfb_key_t k, u32 *mods)
+{
+   const u8 *b = (const u8 *)&k;
+   u32 params[2] = {0};
+   u32 np = 0, i;
+   u8 final;
+
+   if (mods)
+      *mods = 0;
+
+   if (b[0] != '\033')
+      return TFB_SYM_NONE;
+
+   if (b[1] == 'O')
+      return b[2] < 128 && !b[3] ? csi_final_syms[b[2]] : TFB_SYM_NONE;
+
+   if (b[1] != '[')
+      return TFB_SYM_NONE;
+
+   if (b[2] == '[')
+      return b[3] < 128 && !b[4] ? console_final_syms[b[3]] : TFB_SYM_NONE;
+
+   for (i = 2; i < sizeof(k); i++) {
+
+      if ('0' <= b[i] && b[i] <= '9') {
+         params[np] = params[np] * 10 + (b[i] - '0');
+      } else if (b[i] == ';' && np == 0) {
+         np = 1;
+      } else {
+         break;
+      }
+   }
+
+   if (i == sizeof(k) || (final = b[i]) >= 128)
+      return TFB_SYM_NONE;
+
+   if (mods && params[1] > 1)
+      *mods = (params[1] - 1) & 0xf;
+
+   if (final == '~')
+      return params[0] <= MAX_TILDE_CODE ? tilde_syms[params[0]] : TFB_SYM_NONE;
+
+   return csi_final_syms[final];
+}
+
 int tfb_get_fn_key_num(tfb_key_t k)
 {
-   for (u32 i = 0; i < 12; i++)
-      if (tfb_int_fn_key_sequences[i] == k)
-         return i + 1;
+   const enum tfb_key_sym sym = tfb_get_key_sym(k, NULL);
+
+   if (TFB_SYM_F1 <= sym && sym <= TFB_SYM_F12)
+      return sym - TFB_SYM_F1 + 1;
 
    return 0;
 }
+
+int tfb_int_kb_pollable_fd(void)
+{
+   /*
+    * The event loop can wait on the TTY only when it's non-blocking, because
+    * it drains all the available keystrokes each time the fd becomes ready.
+    */
+   return tfb_kb_raw_mode && tfb_kb_nonblock ? __tfb_ttyfd : -1;
+}
@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <tfblib/tfblib.h>
+#include <tfblib/tfb_input.h>
+#include "utils.h"
+#include "input.h"
+
+/*
+ * Input latency instrumentation.
+ *
+ * The input paths register each input as 'pending'. At the end of the next
+ * flush, the pending inputs are handed over to the frame being flushed, which
+ * gets an increasing id. Once a frame is on the device, its inputs and those
+ * of all the older frames (which might have been dropped, with triple
+ * buffering) become samples: they're added to the histogram and to a ring of
+ * recent samples, used for the CSV dump. Frames might reach the device in
+ * another thread (the presenter or the flush thread), so everything here is
+ * protected by a lock.
+ */
+
+#define MAX_PENDING           64
+#define MAX_SAMPLES           4096     /* must be a power of 2 */
+
+struct sample {
+   u64 code;
+   u64 kernel_ns;
+   u64 read_ns;
+   u64 flush_ns;
+   u64 frame;                 /* 0 until handed over to a frame */
+};
+
+bool __tfb_latency_enabled;
+
+static pthread_mutex_t lat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct sample pending[MAX_PENDING];
+static int pending_count;
+static u64 frames_count;      /* never reset: frames in flight keep their id */
+
+static struct sample samples[MAX_SAMPLES];
+static u32 samples_count;
+
+static struct tfb_latency_stats stats;
+static u64 total_ns;
+
+void tfb_latency_enable(bool enable)
+{
+   if (enable) {
+      pthread_mutex_lock(&lat_lock);
+      {
+         memset(&stats, 0, sizeof(stats));
+         total_ns = 0;
+         pending_count = 0;
+         samples_count = 0;
+      }
+      pthread_mutex_unlock(&lat_lock);
+   }
+
+   __tfb_latency_enabled = enable;
+}
+
+void tfb_int_latency_record_input(u64 code, u64 kernel_ns, u64 read_ns)
+{
+   pthread_mutex_lock(&lat_lock);
+   {
+      /* When full, no flush for a long time: these samples don't matter */
+      if (pending_count < MAX_PENDING)
+         pending[pending_count++] =
+            (struct sample) { code, kernel_ns, read_ns, 0, 0 };
+   }
+   pthread_mutex_unlock(&lat_lock);
+}
+
+static inline u64 sample_latency(const struct sample *s)
+{
+   const u64 start = s->kernel_ns ? s->kernel_ns : s->read_ns;
+   return s->flush_ns > start ? s->flush_ns - start : 0;
+}
+
+static void add_sample(struct sample *s, u64 now)
+{
+   u64 lat;
+   u32 b;
+
+   s->flush_ns = now;
+   lat = sample_latency(s);
+   b = MIN(lat / (TFB_LAT_BUCKET_US * 1000ull), (u64)TFB_LAT_BUCKETS - 1);
+
+   stats.min_ns = stats.count ? MIN(stats.min_ns, lat) : lat;
+   stats.max_ns = MAX(stats.max_ns, lat);
+   stats.hist[b]++;
+   stats.count++;
+   total_ns += lat;
+
+   samples[samples_count++ & (MAX_SAMPLES - 1)] = *s;
+}
+
+u64 tfb_int_latency_record_frame(void)
+{
+   u64 frame;
+
+   pthread_mutex_lock(&lat_lock);
+   {
+      frame = ++frames_count;
+
+      /* The inputs not handed over yet are always at the end */
+      for (int i = pending_count - 1; i >= 0 && !pending[i].frame; i--)
+         pending[i].frame = frame;
+   }
+   pthread_mutex_unlock(&lat_lock);
+   return frame;
+}
+
+void tfb_int_latency_record_present(u64 frame)
+{
+   pthread_mutex_lock(&lat_lock);
+   {
+      const u64 now = mono_time_ns();
+      int n = 0;
+
+      while (n < pending_count && pending[n].frame &&
+             pending[n].frame <= frame)
+      {
+         add_sample(&pending[n++], now);
+      }
+
+      pending_count -= n;
+      memmove(pending, pending + n, pending_count * sizeof(pending[0]));
+   }
+   pthread_mutex_unlock(&lat_lock);
+}
+
+static u64 percentile(u32 p)
+{
+   const u64 target = ((u64)stats.count * p + 99) / 100;
+   u64 sum = 0;
+
+   for (int b = 0; b < TFB_LAT_BUCKETS - 1; b++) {
+
+      sum += stats.hist[b];
+
+      if (sum >= target)
+         return MIN((b + 1) * TFB_LAT_BUCKET_US * 1000ull, stats.max_ns);
+   }
+
+   return stats.max_ns;
+}
+
+void tfb_latency_get_stats(struct tfb_latency_stats *s)
+{
+   pthread_mutex_lock(&lat_lock);
+   {
+      *s = stats;
+
+      if (stats.count) {
+         s->mean_ns = total_ns / stats.count;
+         s->p50_ns = percentile(50);
+         s->p90_ns = percentile(90);
+         s->p99_ns = percentile(99);
+      }
+   }
+   pthread_mutex_unlock(&lat_lock);
+}
+
+int tfb_latency_dump_csv(const char *path)
+{
+   FILE *fh = fopen(path, "w");
+   int rc = TFB_SUCCESS;
+   u32 n;
+
+   if (!fh)
+      return TFB_ERR_WRITE_FILE_FAILED;
+
+   fprintf(fh, "code,kernel_ns,read_ns,flush_ns,latency_us\n");
+   pthread_mutex_lock(&lat_lock);
+
+   n = MIN(samples_count, (u32)MAX_SAMPLES);
+
+   for (u32 i = samples_count - n; i != samples_count; i++) {
+
+      const struct sample *s = &samples[i & (MAX_SAMPLES - 1)];
+
+      fprintf(fh, "0x%llx,%llu,%llu,%llu,%.1f\n",
+              (unsigned long long)s->code,
+              (unsigned long long)s->kernel_ns,
+              (unsigned long long)s->read_ns,
+              (unsigned long long)s->flush_ns,
+              sample_latency(s) / 1000.0);
+   }
+
+   pthread_mutex_unlock(&lat_lock);
+
+   if (ferror(fh))
+      rc = TFB_ERR_WRITE_FILE_FAILED;
+
+   if (fclose(fh) != 0)
+      rc = TFB_ERR_WRITE_FILE_FAILED;
+
+   return rc;
+}
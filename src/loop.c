@@ -0,0 +1,408 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tfblib/tfblib.h>
+#include <tfblib/tfb_input.h>
+#include "utils.h"
+#include "input.h"
+#include "vt.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+/*
+ * Event loop.
+ *
+ * Everything the loop waits on is a file descriptor: the evdev devices, the
+ * TTY, the timers (timerfd), the frame ticks (timerfd too) and the VT
+ * switches (a pipe written by the signal handlers, see vt.c). A single
+ * epoll_wait() call blocks until any of them is ready. Each epoll entry
+ * carries a tag (the source kind) and an index, so that no lookup is needed.
+ */
+
+#define MAX_TIMERS            16
+#define MAX_EPOLL_EVENTS      32
+
+#define SRC_INPUT             1
+#define SRC_TTY               2
+#define SRC_TIMER             3
+#define SRC_FRAME             4
+#define SRC_VT                5
+
+#define EP_DATA(src, idx)     (((u64)(src) << 32) | (u32)(idx))
+#define EP_SRC(data)          ((u32)((data) >> 32))
+#define EP_IDX(data)          ((u32)(data))
+
+struct timer {
+   int fd;                    /* -1 if the slot is free */
+   bool fired;
+   tfb_timer_cb cb;
+   void *arg;
+   u32 period_us;
+};
+
+static struct {
+
+   int epfd;
+   bool running;
+   bool quit;
+
+   tfb_event_cb ev_cb;
+   void *ev_arg;
+
+   struct timer timers[MAX_TIMERS];
+   struct timer frame;
+   bool frame_paused;            /* while the VT is not active */
+
+} loop = {
+   .epfd = -1,
+   .frame = { .fd = -1 },
+};
+
+static void init_timer_slots(void)
+{
+   static bool done;
+
+   if (done)
+      return;
+
+   for (int i = 0; i < MAX_TIMERS; i++)
+      loop.timers[i].fd = -1;
+
+   done = true;
+}
+
+static int ep_add(int fd, u32 src, u32 idx)
+{
+   struct epoll_event e = { .events = EPOLLIN, .data.u64 = EP_DATA(src, idx) };
+
+   if (epoll_ctl(loop.epfd, EPOLL_CTL_ADD, fd, &e) < 0)
+      return TFB_ERR_LOOP_SETUP_FAILED;
+
+   return TFB_SUCCESS;
+}
+
+static int arm_timerfd(int fd, u32 period_us)
+{
+   const struct timespec ts = {
+      .tv_sec = period_us / 1000000,
+      .tv_nsec = (period_us % 1000000) * 1000,
+   };
+
+   const struct itimerspec its = { .it_interval = ts, .it_value = ts };
+   return timerfd_settime(fd, 0, &its, NULL);
+}
+
+static int make_timerfd(u32 period_us)
+{
+   int fd;
+
+   if (!period_us)
+      return -1;
+
+   fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+   if (fd < 0)
+      return -1;
+
+   if (arm_timerfd(fd, period_us) < 0) {
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+/* Consume the expirations of a timer. Returns false on a spurious wake-up */
+static bool ack_timer(int fd)
+{
+   u64 expirations;
+   return read(fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+}
+
+void tfb_loop_set_event_cb(tfb_event_cb cb, void *user_arg)
+{
+   loop.ev_cb = cb;
+   loop.ev_arg = user_arg;
+}
+
+int tfb_loop_add_timer(u32 period_us, tfb_timer_cb cb,
+                       void *user_arg, int *timer_id)
+{
+   int i, fd;
+
+   init_timer_slots();
+
+   for (i = 0; i < MAX_TIMERS; i++)
+      if (loop.timers[i].fd < 0)
+         break;
+
+   if (i == MAX_TIMERS)
+      return TFB_ERR_LOOP_SETUP_FAILED;
+
+   if ((fd = make_timerfd(period_us)) < 0)
+      return TFB_ERR_LOOP_SETUP_FAILED;
+
+   if (loop.running && ep_add(fd, SRC_TIMER, i) != TFB_SUCCESS) {
+      close(fd);
+      return TFB_ERR_LOOP_SETUP_FAILED;
+   }
+
+   loop.timers[i] = (struct timer) { fd, false, cb, user_arg, period_us };
+
+   if (timer_id)
+      *timer_id = i;
+
+   return TFB_SUCCESS;
+}
+
+static void remove_timer(struct timer *t)
+{
+   if (t->fd < 0)
+      return;
+
+   /* Closing the fd removes it from the epoll set as well */
+   close(t->fd);
+   t->fd = -1;
+   t->fired = false;
+}
+
+void tfb_loop_remove_timer(int timer_id)
+{
+   if (timer_id < 0 || timer_id >= MAX_TIMERS)
+      return;
+
+   remove_timer(&loop.timers[timer_id]);
+}
+
+int tfb_loop_set_frame_cb(u32 fps, tfb_timer_cb cb, void *user_arg)
+{
+   const u32 period_us = fps ? MAX(1000000 / fps, 1u) : 0;
+   int fd = -1;
+
+   remove_timer(&loop.frame);
+   loop.frame_paused = false;
+
+   if (!fps)
+      return TFB_SUCCESS;
+
+   if ((fd = make_timerfd(period_us)) < 0)
+      return TFB_ERR_LOOP_SETUP_FAILED;
+
+   if (loop.running && ep_add(fd, SRC_FRAME, 0) != TFB_SUCCESS) {
+      close(fd);
+      return TFB_ERR_LOOP_SETUP_FAILED;
+   }
+
+   loop.frame = (struct timer) { fd, false, cb, user_arg, period_us };
+   return TFB_SUCCESS;
+}
+
+void tfb_loop_quit(void)
+{
+   loop.quit = true;
+}
+
+static void read_tty_keys(void)
+{
+   struct tfb_event ev = { .type = TFB_EV_TTY_KEY };
+   tfb_key_t keys[64];
+   int n;
+
+   while (tfb_int_evq_room() >= ARRAY_SIZE(keys)) {
+
+      n = tfb_read_keypresses(keys, ARRAY_SIZE(keys));
+      ev.time_ns = mono_time_ns();
+
+      for (int i = 0; i < n; i++) {
+         ev.key = keys[i];
+         tfb_int_evq_push(&ev);
+      }
+
+      if (n != ARRAY_SIZE(keys))
+         break;
+   }
+}
+
+/*
+ * The fds are level-triggered: one reporting an error or a hang-up forever
+ * (an unplugged device, a hung-up TTY) must be removed or epoll_wait() would
+ * never block again.
+ */
+static void handle_ready_fd(const struct epoll_event *e)
+{
+   const bool gone = e->events & (EPOLLERR | EPOLLHUP);
+   const u32 src = EP_SRC(e->data.u64);
+   const u32 idx = EP_IDX(e->data.u64);
+   struct timer *t;
+   const int *fds;
+
+   switch (src) {
+
+      case SRC_INPUT:
+         if ((int)idx >= tfb_int_input_fds(&fds) || fds[idx] < 0)
+            break;
+
+         if (gone || !tfb_int_input_read(idx)) {
+            epoll_ctl(loop.epfd, EPOLL_CTL_DEL, fds[idx], NULL);
+            tfb_int_input_remove(idx);
+         }
+
+         break;
+
+      case SRC_TTY:
+         /* The TTY belongs to the keyboard code: just stop waiting on it */
+         if (gone)
+            epoll_ctl(loop.epfd, EPOLL_CTL_DEL, tfb_int_kb_pollable_fd(), NULL);
+         else
+            read_tty_keys();
+
+         break;
+
+      case SRC_VT:
+         /* Drained by tfb_int_vt_process_pending(), after epoll_wait() */
+         break;
+
+      case SRC_TIMER:
+      case SRC_FRAME:
+         t = src == SRC_FRAME ? &loop.frame : &loop.timers[idx];
+
+         if (t->fd >= 0 && ack_timer(t->fd))
+            t->fired = true;
+
+         break;
+   }
+}
+
+static void dispatch_input(void)
+{
+   struct tfb_event ev;
+
+   while (tfb_int_evq_pop(&ev))
+      if (loop.ev_cb)
+         loop.ev_cb(&ev, loop.ev_arg);
+}
+
+static void dispatch(void)
+{
+   /*
+    * Input first, then the timers and, at the end, the frame. When there is
+    * a frame callback, the pointer motion is kept in the queue (where it gets
+    * coalesced into a single event) until the next frame: nobody would see
+    * its effects earlier anyway. Everything else is dispatched immediately,
+    * because the frames might not come for a long time (e.g. while the VT is
+    * not active) and the queue must never overflow.
+    */
+   if (loop.frame.fd < 0 || loop.frame.fired || !tfb_int_evq_motion_only())
+      dispatch_input();
+
+   for (int i = 0; i < MAX_TIMERS; i++) {
+
+      struct timer *t = &loop.timers[i];
+
+      if (t->fired) {
+         t->fired = false;
+         t->cb(t->arg);
+      }
+   }
+
+   if (loop.frame.fired) {
+      loop.frame.fired = false;
+      loop.frame.cb(loop.frame.arg);
+   }
+}
+
+/*
+ * Stop the frame ticks while the VT is not active, so that a background
+ * application doesn't wake up at all just for rendering frames nobody sees.
+ */
+static void update_frame_timer(void)
+{
+   const bool active = tfb_is_vt_active();
+
+   if (loop.frame.fd < 0 || active != loop.frame_paused)
+      return;
+
+   if (arm_timerfd(loop.frame.fd, active ? loop.frame.period_us : 0) == 0) {
+      loop.frame_paused = !active;
+      loop.frame.fired = false;
+   }
+}
+
+static int register_all(void)
+{
+   const int *fds;
+   const int nfds = tfb_int_input_fds(&fds);
+   const int tty_fd = tfb_int_kb_pollable_fd();
+   const int vt_fd = tfb_int_vt_pollable_fd();
+
+   for (int i = 0; i < nfds; i++)
+      if (fds[i] >= 0 && ep_add(fds[i], SRC_INPUT, i) != TFB_SUCCESS)
+         return TFB_ERR_LOOP_SETUP_FAILED;
+
+   if (tty_fd >= 0 && ep_add(tty_fd, SRC_TTY, 0) != TFB_SUCCESS)
+      return TFB_ERR_LOOP_SETUP_FAILED;
+
+   if (vt_fd >= 0 && ep_add(vt_fd, SRC_VT, 0) != TFB_SUCCESS)
+      return TFB_ERR_LOOP_SETUP_FAILED;
+
+   for (int i = 0; i < MAX_TIMERS; i++)
+      if (loop.timers[i].fd >= 0)
+         if (ep_add(loop.timers[i].fd, SRC_TIMER, i) != TFB_SUCCESS)
+            return TFB_ERR_LOOP_SETUP_FAILED;
+
+   if (loop.frame.fd >= 0)
+      if (ep_add(loop.frame.fd, SRC_FRAME, 0) != TFB_SUCCESS)
+         return TFB_ERR_LOOP_SETUP_FAILED;
+
+   return TFB_SUCCESS;
+}
+
+int tfb_loop_run(void)
+{
+   struct epoll_event events[MAX_EPOLL_EVENTS];
+   int rc = TFB_SUCCESS;
+   int n;
+
+   init_timer_slots();
+
+   if ((loop.epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+      return TFB_ERR_LOOP_SETUP_FAILED;
+
+   if ((rc = register_all()) != TFB_SUCCESS)
+      goto out;
+
+   loop.running = true;
+   loop.quit = false;
+
+   while (!loop.quit) {
+
+      n = epoll_wait(loop.epfd, events, MAX_EPOLL_EVENTS, -1);
+
+      /* The VT signal handlers wake us up through the pipe (SRC_VT) */
+      tfb_int_vt_process_pending();
+      update_frame_timer();
+
+      if (n < 0) {
+
+         if (errno == EINTR)
+            continue;
+
+         rc = TFB_ERR_LOOP_SETUP_FAILED;
+         break;
+      }
+
+      for (int i = 0; i < n; i++)
+         handle_ready_fd(&events[i]);
+
+      dispatch();
+   }
+
+   loop.running = false;
+
+out:
+   close(loop.epfd);
+   loop.epfd = -1;
+   return rc;
+}
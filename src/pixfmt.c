@@ -0,0 +1,296 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <string.h>
+#include <linux/fb.h>
+
+#include <tfblib/tfblib.h>
+#include "utils.h"
+#include "raster.h"
+
+/*
+ * Pixel kernels for each supported bits-per-pixel value. The right set is
+ * selected once by tfb_acquire_fb(), so that the drawing code never has to
+ * check the pixel size in its inner loops. Colors are always passed around
+ * as u32 values already in the framebuffer's format (see tfb_make_color()):
+ * these kernels just store them with the right size. Little-endian only, as
+ * the rest of the library.
+ */
+
+/* 32 bpp */
+
+static void put32(void *dst, u32 color)
+{
+   *(volatile u32 *)dst = color;
+}
+
+static void fill32(void *dst, u32 color, size_t n)
+{
+   memset32(dst, color, n);
+}
+
+static void copy32(void *dst, const u32 *src, size_t n)
+{
+   memcpy(dst, src, n * sizeof(u32));
+}
+
+static void load32(u32 *dst, const void *src, size_t n)
+{
+   memcpy(dst, src, n * sizeof(u32));
+}
+
+/* 16 bpp */
+
+static void put16(void *dst, u32 color)
+{
+   *(volatile u16 *)dst = color;
+}
+
+static void fill16(void *dst, u32 color, size_t n)
+{
+   u16 *d = dst;
+
+   if (n && ((uintptr_t)d & 2)) {
+      *d++ = color;
+      n--;
+   }
+
+   /* Two pixels at a time, with aligned 32-bit stores */
+   memset32(d, (color & 0xffff) * 0x10001, n >> 1);
+
+   if (n & 1)
+      d[n - 1] = color;
+}
+
+static void copy16(void *dst, const u32 *src, size_t n)
+{
+   u16 *d = dst;
+
+   for (size_t i = 0; i < n; i++)
+      d[i] = src[i];
+}
+
+static void load16(u32 *dst, const void *src, size_t n)
+{
+   const u16 *s = src;
+
+   for (size_t i = 0; i < n; i++)
+      dst[i] = s[i];
+}
+
+/* 24 bpp */
+
+static inline void store24(u8 *d, u32 color)
+{
+   d[0] = color;
+   d[1] = color >> 8;
+   d[2] = color >> 16;
+}
+
+static void put24(void *dst, u32 color)
+{
+   store24(dst, color);
+}
+
+static void fill24(void *dst, u32 color, size_t n)
+{
+   u8 *d = dst;
+   u32 c = color & 0xffffff;
+
+   /* 4 pixels are exactly 3 u32 words: store them with full-size writes */
+   const u32 p0 = c | (c << 24);
+   const u32 p1 = (c >> 8) | (c << 16);
+   const u32 p2 = (c >> 16) | (c << 8);
+
+   for (; n >= 4; n -= 4, d += 12) {
+      memcpy(d, &p0, 4);
+      memcpy(d + 4, &p1, 4);
+      memcpy(d + 8, &p2, 4);
+   }
+
+   for (; n > 0; n--, d += 3)
+      store24(d, c);
+}
+
+static void copy24(void *dst, const u32 *src, size_t n)
+{
+   u8 *d = dst;
+
+   for (size_t i = 0; i < n; i++, d += 3)
+      store24(d, src[i]);
+}
+
+static void load24(u32 *dst, const void *src, size_t n)
+{
+   const u8 *s = src;
+
+   for (size_t i = 0; i < n; i++, s += 3)
+      dst[i] = s[0] | (s[1] << 8) | ((u32)s[2] << 16);
+}
+
+/*
+ * Layout-specific kernels, generated from a single template. The specialized
+ * sets have all the channel shifts and masks known at compile time, so their
+ * loops read no layout globals and can be vectorized. The 'generic' set
+ * works with any layout, reading it from the __fb_* globals.
+ */
+
+#define CH_MASK(len)    ((1u << (len)) - 1)
+
+/* Expand a channel of 'len' bits to 8 bits, replicating its high bits */
+static inline u32 expand_channel(u32 v, u32 len)
+{
+   v <<= 8 - len;
+   return v | (v >> len);
+}
+
+#define DEFINE_LAYOUT(name, R_POS, R_LEN, G_POS, G_LEN, B_POS, B_LEN)      \
+                                                                           \
+static u32 name##_make_color(u8 r, u8 g, u8 b)                             \
+{                                                                          \
+   return (((u32)r >> (8 - (R_LEN))) << (R_POS)) |                         \
+          (((u32)g >> (8 - (G_LEN))) << (G_POS)) |                         \
+          (((u32)b >> (8 - (B_LEN))) << (B_POS));                          \
+}                                                                          \
+                                                                           \
+static void name##_make_colors(u32 *restrict dst,                          \
+                               const struct tfb_rgb *restrict src, u32 n)  \
+{                                                                          \
+   for (u32 i = 0; i < n; i++)                                             \
+      dst[i] = name##_make_color(src[i].r, src[i].g, src[i].b);            \
+}                                                                          \
+                                                                           \
+static void name##_from_xrgb(u32 *restrict dst,                            \
+                             const u32 *restrict src, u32 n)               \
+{                                                                          \
+   for (u32 i = 0; i < n; i++)                                             \
+      dst[i] = name##_make_color(src[i] >> 16, src[i] >> 8, src[i]);       \
+}                                                                          \
+                                                                           \
+static void name##_to_xrgb(u32 *restrict dst,                              \
+                           const u32 *restrict src, u32 n)                 \
+{                                                                          \
+   for (u32 i = 0; i < n; i++) {                                           \
+      const u32 c = src[i];                                                \
+      dst[i] =                                                             \
+         expand_channel((c >> (R_POS)) & CH_MASK(R_LEN), R_LEN) << 16 |    \
+         expand_channel((c >> (G_POS)) & CH_MASK(G_LEN), G_LEN) << 8 |     \
+         expand_channel((c >> (B_POS)) & CH_MASK(B_LEN), B_LEN);           \
+   }                                                                       \
+}                                                                          \
+                                                                           \
+static void name##_ramp(u32 *ramp, u32 n, u32 c0, u32 c1)                  \
+{                                                                          \
+   /* Channels in their native size (e.g. 5 or 6 bits), in 16.16 fp */     \
+   int r = (int)((c0 >> (R_POS)) & CH_MASK(R_LEN)) << 16;                  \
+   int g = (int)((c0 >> (G_POS)) & CH_MASK(G_LEN)) << 16;                  \
+   int b = (int)((c0 >> (B_POS)) & CH_MASK(B_LEN)) << 16;                  \
+                                                                           \
+   const int div = (int)n - 1;                                             \
+   const int dr = (((int)((c1 >> (R_POS)) & CH_MASK(R_LEN)) << 16) - r)    \
+                  / div;                                                   \
+   const int dg = (((int)((c1 >> (G_POS)) & CH_MASK(G_LEN)) << 16) - g)    \
+                  / div;                                                   \
+   const int db = (((int)((c1 >> (B_POS)) & CH_MASK(B_LEN)) << 16) - b)    \
+                  / div;                                                   \
+                                                                           \
+   for (u32 i = 0; i < n; i++, r += dr, g += dg, b += db) {                \
+      ramp[i] = ((u32)((r + 0x8000) >> 16) << (R_POS)) |                   \
+                ((u32)((g + 0x8000) >> 16) << (G_POS)) |                   \
+                ((u32)((b + 0x8000) >> 16) << (B_POS));                    \
+   }                                                                       \
+}
+
+DEFINE_LAYOUT(xrgb8888, 16, 8, 8, 8, 0, 8)
+DEFINE_LAYOUT(xbgr8888, 0, 8, 8, 8, 16, 8)
+DEFINE_LAYOUT(rgb565, 11, 5, 5, 6, 0, 5)
+
+DEFINE_LAYOUT(generic,
+              __fb_r_pos, __fb_r_mask_size,
+              __fb_g_pos, __fb_g_mask_size,
+              __fb_b_pos, __fb_b_mask_size)
+
+#define OPS(bpp, layout)                                                   \
+   {                                                                       \
+      put##bpp, fill##bpp, copy##bpp, load##bpp,                           \
+      layout##_make_color, layout##_make_colors,                           \
+      layout##_from_xrgb, layout##_to_xrgb, layout##_ramp                  \
+   }
+
+static const struct pixel_ops ops_xrgb8888 = OPS(32, xrgb8888);
+static const struct pixel_ops ops_xbgr8888 = OPS(32, xbgr8888);
+static const struct pixel_ops ops_rgb565 = OPS(16, rgb565);
+static const struct pixel_ops ops32 = OPS(32, generic);
+static const struct pixel_ops ops24 = OPS(24, generic);
+static const struct pixel_ops ops16 = OPS(16, generic);
+
+struct pixel_ops __tfb_px = OPS(32, xrgb8888);
+void (*__fb_put_pixel)(void *dst, u32 color) = put32;
+bool __fb_is_xrgb8888 = true;
+
+static bool is_layout(const struct fb_bitfield *r,
+                      const struct fb_bitfield *g,
+                      const struct fb_bitfield *b,
+                      u32 r_pos, u32 r_len,
+                      u32 g_pos, u32 g_len,
+                      u32 b_pos, u32 b_len)
+{
+   return r->offset == r_pos && r->length == r_len &&
+          g->offset == g_pos && g->length == g_len &&
+          b->offset == b_pos && b->length == b_len;
+}
+
+static void set_channel(const struct fb_bitfield *bf,
+                        u8 *pos, u8 *mask_size, u32 *mask)
+{
+   *pos = bf->offset;
+   *mask_size = bf->length;
+   *mask = CH_MASK(bf->length) << bf->offset;
+}
+
+int tfb_int_set_pixel_format(u32 bits_per_pixel,
+                             const struct fb_bitfield *r,
+                             const struct fb_bitfield *g,
+                             const struct fb_bitfield *b)
+{
+   if (r->msb_right || g->msb_right || b->msb_right)
+      return TFB_ERR_UNSUPPORTED_VIDEO_MODE;
+
+   /* See tfb_make_color() */
+   if (r->length > 8 || g->length > 8 || b->length > 8)
+      return TFB_ERR_UNSUPPORTED_VIDEO_MODE;
+
+   switch (bits_per_pixel) {
+
+      case 32:
+         __tfb_px = ops32;
+         break;
+
+      case 24:
+         __tfb_px = ops24;
+         break;
+
+      case 16:
+         __tfb_px = ops16;
+         break;
+
+      default:
+         return TFB_ERR_UNSUPPORTED_VIDEO_MODE;
+   }
+
+   __fb_bytespp = bits_per_pixel / 8;
+
+   if (bits_per_pixel == 32 && is_layout(r, g, b, 16, 8, 8, 8, 0, 8))
+      __tfb_px = ops_xrgb8888;
+   else if (bits_per_pixel == 32 && is_layout(r, g, b, 0, 8, 8, 8, 16, 8))
+      __tfb_px = ops_xbgr8888;
+   else if (bits_per_pixel == 16 && is_layout(r, g, b, 11, 5, 5, 6, 0, 5))
+      __tfb_px = ops_rgb565;
+
+   set_channel(r, &__fb_r_pos, &__fb_r_mask_size, &__fb_r_mask);
+   set_channel(g, &__fb_g_pos, &__fb_g_mask_size, &__fb_g_mask);
+   set_channel(b, &__fb_b_pos, &__fb_b_mask_size, &__fb_b_mask);
+
+   __fb_put_pixel = __tfb_px.put;
+   __fb_is_xrgb8888 = __tfb_px.make_color == xrgb8888_make_color;
+   return TFB_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <string.h>
+
+#ifdef __SSE2__
+   #include <emmintrin.h>
+#endif
+
+#include "utils.h"
+#include "qoi.h"
+
+#define OPAQUE       0xff000000u
+
+static inline u32 hash_xrgb(u32 px)
+{
+   /* The alpha is always 255: 255 * 11 = 2805 */
+   return (((px >> 16) & 0xff) * 3 + ((px >> 8) & 0xff) * 5 +
+           (px & 0xff) * 7 + 2805) & 63;
+}
+
+void tfb_int_qoi_header(u8 *out, u32 w, u32 h)
+{
+   memcpy(out, QOI_MAGIC, 4);
+
+   out[4] = w >> 24;
+   out[5] = w >> 16;
+   out[6] = w >> 8;
+   out[7] = w;
+   out[8] = h >> 24;
+   out[9] = h >> 16;
+   out[10] = h >> 8;
+   out[11] = h;
+   out[12] = 3;      /* channels: RGB */
+   out[13] = 0;      /* colorspace: sRGB with linear alpha */
+}
+
+void tfb_int_qoi_enc_init(struct qoi_enc *e)
+{
+   memset(e->index, 0, sizeof(e->index));
+   e->prev = OPAQUE;
+   e->run = 0;
+}
+
+/*
+ * The full-length runs are emitted as soon as they're complete, so that the
+ * size of the output is bounded by the number of pixels passed in each call.
+ */
+static inline u8 *emit_full_runs(struct qoi_enc *e, u8 *out)
+{
+   for (; e->run >= QOI_MAX_RUN; e->run -= QOI_MAX_RUN)
+      *out++ = QOI_OP_RUN | (QOI_MAX_RUN - 1);
+
+   return out;
+}
+
+static inline u8 *emit_run(struct qoi_enc *e, u8 *out)
+{
+   if (e->run) {
+      *out++ = QOI_OP_RUN | (e->run - 1);
+      e->run = 0;
+   }
+
+   return out;
+}
+
+/* How many pixels starting from px[i] are equal to 'prev' */
+static inline u32 run_length(const u32 *px, u32 i, u32 n, u32 prev)
+{
+   const u32 start = i;
+
+#ifdef __SSE2__
+   const __m128i p = _mm_set1_epi32(prev & ~OPAQUE);
+   const __m128i mask = _mm_set1_epi32(~OPAQUE);
+
+   for (; i + 4 <= n; i += 4) {
+
+      const __m128i v = _mm_loadu_si128((const __m128i *)(px + i));
+      const __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(v, mask), p);
+
+      if (_mm_movemask_epi8(eq) != 0xffff)
+         break;
+   }
+#endif
+
+   while (i < n && ((px[i] | OPAQUE) == prev))
+      i++;
+
+   return i - start;
+}
+
+u32 tfb_int_qoi_encode(struct qoi_enc *e, const u32 *px, u32 n, u8 *out)
+{
+   u8 *const begin = out;
+   u32 i = 0;
+
+   while (i < n) {
+
+      const u32 p = px[i] | OPAQUE;
+      u32 h;
+
+      if (p == e->prev) {
+         const u32 len = run_length(px, i, n, e->prev);
+         e->run += len;
+         i += len;
+         out = emit_full_runs(e, out);
+         continue;
+      }
+
+      out = emit_run(e, out);
+      h = hash_xrgb(p);
+
+      if (e->index[h] == p) {
+
+         *out++ = QOI_OP_INDEX | h;
+
+      } else {
+
+         const int8_t vr = ((p >> 16) & 0xff) - ((e->prev >> 16) & 0xff);
+         const int8_t vg = ((p >> 8) & 0xff) - ((e->prev >> 8) & 0xff);
+         const int8_t vb = (p & 0xff) - (e->prev & 0xff);
+         const int8_t vg_r = vr - vg;
+         const int8_t vg_b = vb - vg;
+
+         e->index[h] = p;
+
+         if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+
+            *out++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+
+         } else if (vg_r > -9 && vg_r < 8 &&
+                    vg > -33 && vg < 32 &&
+                    vg_b > -9 && vg_b < 8)
+         {
+            *out++ = QOI_OP_LUMA | (vg + 32);
+            *out++ = (vg_r + 8) << 4 | (vg_b + 8);
+
+         } else {
+
+            *out++ = QOI_OP_RGB;
+            *out++ = p >> 16;
+            *out++ = p >> 8;
+            *out++ = p;
+         }
+      }
+
+      e->prev = p;
+      i++;
+   }
+
+   return out - begin;
+}
+
+u32 tfb_int_qoi_enc_finish(struct qoi_enc *e, u8 *out)
+{
+   u8 *const begin = out;
+
+   out = emit_run(e, out);
+   memcpy(out, QOI_END_MARKER, QOI_END_SIZE);
+   out += QOI_END_SIZE;
+   return out - begin;
+}
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include "utils.h"
+
+/*
+ * QOI (Quite OK Image format) definitions, see https://qoiformat.org/
+ */
+
+#define QOI_MAGIC          "qoif"
+#define QOI_HEADER_SIZE    14
+#define QOI_END_MARKER     "\0\0\0\0\0\0\0\1"
+#define QOI_END_SIZE       8
+
+#define QOI_OP_INDEX       0x00     /* 00xxxxxx */
+#define QOI_OP_DIFF        0x40     /* 01xxxxxx */
+#define QOI_OP_LUMA        0x80     /* 10xxxxxx */
+#define QOI_OP_RUN         0xc0     /* 11xxxxxx */
+#define QOI_OP_RGB         0xfe     /* 11111110 */
+#define QOI_OP_RGBA        0xff     /* 11111111 */
+#define QOI_MASK_2         0xc0
+
+#define QOI_MAX_RUN        62
+
+struct qoi_rgba {
+   u8 r;
+   u8 g;
+   u8 b;
+   u8 a;
+};
+
+static inline u32 qoi_hash(struct qoi_rgba p)
+{
+   return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) & 63;
+}
+
+static inline u32 qoi_rgba_to_xrgb(struct qoi_rgba p)
+{
+   return ((u32)p.r << 16) | ((u32)p.g << 8) | p.b;
+}
+
+/*
+ * Streaming QOI encoder (qoi.c), for XRGB8888 pixels, always with 3 channels.
+ * The pixels of an image can be passed in any number of chunks (e.g. rows):
+ * the encoder's state carries over.
+ */
+struct qoi_enc {
+   u32 index[64];             /* 0xff000000 | XRGB, or 0 (never matches) */
+   u32 prev;
+   u32 run;
+};
+
+/* Worst case size of the encoding of 'n' pixels */
+#define QOI_MAX_ENC_SIZE(n)   ((n) * 4 + 2)
+
+void tfb_int_qoi_header(u8 *out, u32 w, u32 h);
+void tfb_int_qoi_enc_init(struct qoi_enc *e);
+u32 tfb_int_qoi_encode(struct qoi_enc *e, const u32 *px, u32 n, u8 *out);
+u32 tfb_int_qoi_enc_finish(struct qoi_enc *e, u8 *out);
@@ -0,0 +1,344 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include <tfblib/tfblib.h>
+#include "utils.h"
+
+/*
+ * Clipping rectangle in absolute (screen) coordinates, covering the pixels
+ * in [x0, x1) x [y0, y1). The internal rasterizers never look at the window
+ * directly: they just stay inside the clip rectangle they've been given. That
+ * allows the same code to be used both for immediate drawing (clip = current
+ * clip, see win_clip()) and for the tiles of the deferred mode (clip = current
+ * clip & tile).
+ */
+struct clip_rect {
+   int x0;
+   int y0;
+   int x1;
+   int y1;
+};
+
+/* The clip of the drawing functions: the window & the clip stack's top */
+static inline struct clip_rect win_clip(void)
+{
+   return (struct clip_rect) {
+      __fb_clip_x0, __fb_clip_y0, __fb_clip_x1, __fb_clip_y1
+   };
+}
+
+/* The whole window, no matter the clip stack (flushes, screenshots) */
+static inline struct clip_rect win_rect(void)
+{
+   return (struct clip_rect) {
+      __fb_off_x, __fb_off_y, __fb_win_end_x, __fb_win_end_y
+   };
+}
+
+static inline struct clip_rect
+clip_intersect(const struct clip_rect *a, const struct clip_rect *b)
+{
+   return (struct clip_rect) {
+      MAX(a->x0, b->x0), MAX(a->y0, b->y0),
+      MIN(a->x1, b->x1), MIN(a->y1, b->y1)
+   };
+}
+
+static inline bool clip_is_empty(const struct clip_rect *c)
+{
+   return c->x0 >= c->x1 || c->y0 >= c->y1;
+}
+
+/*
+ * Per-format pixel kernels (pixfmt.c), selected by tfb_acquire_fb(). The 'n'
+ * and 'src' parameters are in pixels, while 'dst' points to the framebuffer.
+ */
+struct pixel_ops {
+   void (*put)(void *dst, u32 color);
+   void (*fill)(void *dst, u32 color, size_t n);
+   void (*copy)(void *dst, const u32 *src, size_t n);
+
+   /* The opposite of copy(): read 'n' pixels from the framebuffer */
+   void (*load)(u32 *dst, const void *src, size_t n);
+
+   /* Layout-specific: see tfb_make_color() */
+   u32 (*make_color)(u8 r, u8 g, u8 b);
+   void (*make_colors)(u32 *dst, const struct tfb_rgb *src, u32 n);
+
+   /* Convert XRGB8888 pixels, like the ones of most image formats */
+   void (*from_xrgb)(u32 *dst, const u32 *src, u32 n);
+
+   /* The opposite of from_xrgb(), with the channels expanded to 8 bits */
+   void (*to_xrgb)(u32 *dst, const u32 *src, u32 n);
+
+   /* Fill 'ramp' with 'n' colors going from c0 to c1, both included */
+   void (*ramp)(u32 *ramp, u32 n, u32 c0, u32 c1);
+};
+
+struct fb_bitfield;
+extern struct pixel_ops __tfb_px;
+
+int tfb_int_set_pixel_format(u32 bits_per_pixel,
+                             const struct fb_bitfield *r,
+                             const struct fb_bitfield *g,
+                             const struct fb_bitfield *b);
+
+/*
+ * Conversion of a row of XRGB8888 pixels to the framebuffer's format, used
+ * with TFB_FL_CONVERT_ON_FLUSH (convert.c). 'x' and 'y' are the absolute
+ * coordinates of the first pixel, needed for the dithering.
+ */
+typedef void (*convert_func)(void *dst, const u32 *src, u32 n, int x, int y);
+
+struct fb_var_screeninfo;
+convert_func
+tfb_int_get_converter(const struct fb_var_screeninfo *fbi, bool dither);
+
+/*
+ * Copy (or convert) the given rect, in absolute coordinates, from 'buf' to
+ * the framebuffer (fb.c). 'buf' is the back buffer or a buffer with the same
+ * layout. The caller does all the clipping.
+ */
+void tfb_int_copy_rect(const void *buf, int x, int y, int w, int h);
+
+/*
+ * The whole flush of a clipped rect from 'buf' (see tfb_int_copy_rect()),
+ * between tfb_int_flush_begin() and tfb_int_flush_end() and with the flush
+ * statistics (fb.c). Returns false when the VT is not active.
+ */
+bool tfb_int_flush_abs(const void *buf, int x, int y, int w, int h);
+
+/*
+ * The back buffer with the last frame flushed (fb.c): __fb_buffer, except
+ * with TFB_FL_TRIPLE_BUFFER. Valid only after tfb_wait_flush().
+ */
+const void *tfb_int_screen_buffer(void);
+
+/*
+ * Record the given rect, in window-relative coordinates, if a recording is
+ * active (record.c). Called by tfb_flush_rect().
+ */
+void tfb_int_record_flush(int x, int y, int w, int h);
+
+/*
+ * The back buffer shared with other processes, with TFB_FL_SHARED_BUFFER
+ * (shared.c). tfb_int_shared_publish() takes the clipped rect, in absolute
+ * coordinates, like tfb_int_copy_rect().
+ */
+void *tfb_int_shared_alloc(size_t size, bool prefault);
+void tfb_int_shared_free(void);
+void tfb_int_shared_publish(int x, int y, int w, int h);
+
+/*
+ * Per-tile hashes of the pixels last copied to the framebuffer, with
+ * TFB_FL_SKIP_UNCHANGED (tilehash.c). tfb_int_copy_changed() is like
+ * tfb_int_copy_rect(), but skips the tiles which haven't changed since the
+ * last copy and returns the number of bytes actually copied. The hashes must
+ * be invalidated when the framebuffer's contents are lost (VT switches).
+ */
+bool tfb_int_tilehash_alloc(void);
+void tfb_int_tilehash_free(void);
+void tfb_int_tilehash_invalidate(void);
+u64 tfb_int_copy_changed(const void *buf, int x, int y, int w, int h);
+
+/*
+ * The flush thread, with TFB_FL_ASYNC_FLUSH (async.c).
+ * tfb_int_async_flush() takes the clipped rect, in absolute coordinates. The
+ * latency samples are closed by the flush thread, once the rect is written.
+ */
+int tfb_int_async_start(void);
+void tfb_int_async_stop(void);
+void tfb_int_async_flush(int x, int y, int w, int h);
+void tfb_int_async_wait(void);
+
+static inline void *fb_ptr(int x, int y)
+{
+   return __fb_buffer + y * __fb_pitch + x * __fb_bytespp;
+}
+
+static inline void
+clip_pixel(const struct clip_rect *c, int x, int y, u32 color)
+{
+   if ((u32)(x - c->x0) < (u32)(c->x1 - c->x0) &&
+       (u32)(y - c->y0) < (u32)(c->y1 - c->y0))
+   {
+      if (LIKELY(__fb_bytespp == 4))
+         ((volatile u32 *)__fb_buffer)[x + y * __fb_pitch_div4] = color;
+      else
+         __tfb_px.put(fb_ptr(x, y), color);
+   }
+}
+
+/*
+ * Fill the pixels in [xs, xe) of the row 'y', where 'y' is already known to
+ * be inside the clip rectangle. The span is cut only once against the clip
+ * rectangle, instead of checking every single pixel.
+ */
+static inline void
+clip_span(const struct clip_rect *c, int y, int xs, int xe, u32 color)
+{
+   xs = MAX(xs, c->x0);
+   xe = MIN(xe, c->x1);
+
+   if (xs < xe)
+      __tfb_px.fill(fb_ptr(xs, y), color, xe - xs);
+}
+
+/*
+ * Polygon edge used by the scanline rasterizers. The X coordinate is kept in
+ * 16.16 fixed point and sampled at the vertical center of each row, while
+ * spans cover the pixels whose centers fall in [x_left, x_right). Each edge
+ * covers the rows in [ymin, ymax).
+ *
+ * The X is stepped exactly, as a quotient plus a remainder of 'den', so that
+ * its value at a given row does not depend on the row the stepping started
+ * from. That matters because clipping (e.g. to the tiles of the deferred
+ * mode) makes the edges start from different rows.
+ */
+struct edge {
+   int ymin;
+   int ymax;
+   int dir;          /* +1 for downward edges, -1 for upward ones */
+   int xt;           /* X coordinate of the top vertex */
+   int ddx;          /* X delta between the bottom and the top vertex */
+   int64_t den;      /* 2 * (ymax - ymin) */
+   int64_t x;
+   int64_t r;
+   int64_t dx;
+   int64_t dr;
+};
+
+/*
+ * Internal rasterizers (drawing.c, text.c). All the coordinates are absolute.
+ */
+void tfb_int_fill_rect(const struct clip_rect *c,
+                       int x, int y, int w, int h, u32 color);
+
+void tfb_int_draw_line(const struct clip_rect *c,
+                       int x0, int y0, int x1, int y1, u32 color);
+
+void tfb_int_draw_circle(const struct clip_rect *c,
+                         int cx, int cy, int r, u32 color);
+
+void tfb_int_fill_circle(const struct clip_rect *c,
+                         int cx, int cy, int r, u32 color);
+
+void tfb_int_fill_triangle(const struct clip_rect *c,
+                           int x0, int y0, int x1, int y1, int x2, int y2,
+                           u32 color);
+
+int tfb_int_fill_polygon(const struct clip_rect *c,
+                         const struct tfb_point *points, int n,
+                         int off_x, int off_y, u32 color, int rule);
+
+/*
+ * The two halves of tfb_int_fill_polygon(). The first one builds the edge
+ * table (room for n edges), sorted by ymin, and returns the number of edges.
+ * The second one never writes the table: the active edges are copied into
+ * 'work' and 'active' (room for ne elems each), so that the tiles of the
+ * deferred mode can all scan the same table in parallel.
+ */
+int tfb_int_polygon_edges(struct edge *edges,
+                          const struct tfb_point *points, int n,
+                          int off_x, int off_y);
+
+void tfb_int_scan_polygon(const struct clip_rect *c,
+                          const struct edge *edges, int ne,
+                          struct edge *work, struct edge **active,
+                          u32 color, int rule);
+
+struct glyph {
+   const u8 *data;
+   u32 w_bytes;
+   u32 h;
+};
+
+void tfb_int_draw_glyph(const struct clip_rect *c, int x, int y,
+                        u32 fg, u32 bg, const struct glyph *g);
+
+/*
+ * Gradient and pattern fills (fill.c)
+ */
+
+struct pattern {
+   const u32 *pixels;
+   u32 w;
+   u32 h;
+   u32 pitch;
+};
+
+void tfb_int_fill_linear_gradient(const struct clip_rect *c,
+                                  int x, int y, int w, int h,
+                                  int x0, int y0, int x1, int y1,
+                                  u32 c0, u32 c1);
+
+void tfb_int_fill_radial_gradient(const struct clip_rect *c,
+                                  int x, int y, int w, int h,
+                                  int cx, int cy, int r, u32 c0, u32 c1);
+
+void tfb_int_fill_pattern(const struct clip_rect *c,
+                          int x, int y, int w, int h, int ax, int ay,
+                          const struct pattern *p);
+
+/*
+ * Deferred mode (deferred.c)
+ */
+
+enum cmd_type {
+   CMD_FILL_RECT,
+   CMD_LINE,
+   CMD_CIRCLE,
+   CMD_FILL_CIRCLE,
+   CMD_TRIANGLE,
+   CMD_POLYGON,
+   CMD_GLYPH,
+   CMD_LINEAR_GRADIENT,
+   CMD_RADIAL_GRADIENT,
+   CMD_PATTERN,
+};
+
+struct cmd {
+   u8 type;
+   u8 rule;
+   u32 color;
+   u32 color2;
+   int a[8];
+   struct clip_rect clip;        /* the window at the time of the call */
+   struct clip_rect bbox;        /* bounding box, already cut with 'clip' */
+   union {
+      struct glyph glyph;
+      size_t edges_off;          /* offset in the edges arena */
+      size_t pixels_off;         /* offset in the patterns arena */
+   } u;
+};
+
+extern bool __tfb_deferred;
+
+/*
+ * Append a command to the list. The caller fills everything, while 'bbox'
+ * gets cut here against 'clip'.
+ * Returns false if the command could not be recorded: in that case the
+ * pending commands have been already rasterized, so the caller can just
+ * draw immediately without breaking the drawing order.
+ */
+bool tfb_int_defer(struct cmd *cmd);
+
+/*
+ * Like tfb_int_defer(), but also builds the polygon's edge table, offset by
+ * (a[0], a[1]). Sets a[2] to the number of edges.
+ */
+bool tfb_int_defer_polygon(struct cmd *cmd,
+                           const struct tfb_point *points, int n);
+
+/*
+ * Like tfb_int_defer(), but also copies the pattern's pixels, which the
+ * caller is free to change right after. Sets a[6] and a[7] to its size.
+ */
+bool tfb_int_defer_pattern(struct cmd *cmd, const struct pattern *p);
+
+/* Rasterize all the pending commands, if any */
+static inline void tfb_int_deferred_sync(void)
+{
+   if (__tfb_deferred)
+      tfb_flush_deferred();
+}
@@ -0,0 +1,325 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <tfblib/tfblib.h>
+#include <tfblib/tfb_video.h>
+#include "utils.h"
+#include "raster.h"
+#include "qoi.h"
+#include "record.h"
+
+/*
+ * Frame recording (see record.h for the file format).
+ *
+ * The flushing thread only copies the rect's rows, as they are, into a free
+ * slot: a slot is big enough for the whole screen and all of them are
+ * allocated and touched at the beginning, so that no page fault or malloc()
+ * can happen while recording. The writer thread converts the rows to
+ * XRGB8888, encodes them with QOI and writes the record.
+ */
+
+#define REC_SLOTS       4
+
+struct rec_slot {
+   struct rec_frame_header hdr;
+   u8 *pixels;                   /* hdr.h rows of hdr.w native pixels */
+};
+
+static struct {
+
+   bool active;
+   int fd;
+   u32 keyframe_interval;
+   u32 count;                    /* number of records so far */
+   u64 start_ns;
+
+   struct rec_slot slots[REC_SLOTS];
+   u32 head;                     /* next slot to fill */
+   u32 tail;                     /* next slot to write */
+   u32 used;
+
+   pthread_t writer;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   bool quit;
+   bool failed;
+
+   /* Owned by the writer thread */
+   u32 *native_row;
+   u32 *xrgb_row;
+   u8 *out;
+
+} rec = {
+   .fd = -1,
+   .lock = PTHREAD_MUTEX_INITIALIZER,
+   .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static u64 now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+   const u8 *p = buf;
+
+   while (len) {
+
+      const ssize_t rc = write(fd, p, len);
+
+      if (rc <= 0) {
+
+         if (rc < 0 && errno == EINTR)
+            continue;
+
+         return false;
+      }
+
+      p += rc;
+      len -= rc;
+   }
+
+   return true;
+}
+
+static bool write_record(struct rec_slot *s)
+{
+   const u32 w = s->hdr.w;
+   const size_t pitch = (size_t)w * __fb_bytespp;
+   const u8 *src = s->pixels;
+   struct qoi_enc enc;
+   u8 *out = rec.out;
+
+   tfb_int_qoi_header(out, w, s->hdr.h);
+   out += QOI_HEADER_SIZE;
+   tfb_int_qoi_enc_init(&enc);
+
+   for (u32 y = 0; y < s->hdr.h; y++, src += pitch) {
+
+      const u32 *row = rec.native_row;
+      __tfb_px.load(rec.native_row, src, w);
+
+      if (!__fb_is_xrgb8888) {
+         __tfb_px.to_xrgb(rec.xrgb_row, rec.native_row, w);
+         row = rec.xrgb_row;
+      }
+
+      out += tfb_int_qoi_encode(&enc, row, w, out);
+   }
+
+   out += tfb_int_qoi_enc_finish(&enc, out);
+   s->hdr.size = out - rec.out;
+
+   return write_all(rec.fd, &s->hdr, sizeof(s->hdr)) &&
+          write_all(rec.fd, rec.out, s->hdr.size);
+}
+
+static void *writer_thread(void *arg)
+{
+   while (true) {
+
+      struct rec_slot *s;
+
+      pthread_mutex_lock(&rec.lock);
+      {
+         while (!rec.used && !rec.quit)
+            pthread_cond_wait(&rec.cond, &rec.lock);
+
+         s = rec.used ? &rec.slots[rec.tail % REC_SLOTS] : NULL;
+      }
+      pthread_mutex_unlock(&rec.lock);
+
+      if (!s)
+         break; /* quit, with nothing left to write */
+
+      /* After a failure, just keep on consuming the slots */
+      if (!rec.failed && !write_record(s))
+         rec.failed = true;
+
+      pthread_mutex_lock(&rec.lock);
+      {
+         rec.tail++;
+         rec.used--;
+         pthread_cond_broadcast(&rec.cond);
+      }
+      pthread_mutex_unlock(&rec.lock);
+   }
+
+   return NULL;
+}
+
+/* Called by tfb_flush_rect(), with window-relative coordinates */
+void tfb_int_record_flush(int x, int y, int w, int h)
+{
+   const struct clip_rect win = win_rect();
+   const struct clip_rect screen = { 0, 0, __fb_screen_w, __fb_screen_h };
+   const struct clip_rect rect = {
+      x + __fb_off_x, y + __fb_off_y, x + __fb_off_x + w, y + __fb_off_y + h
+   };
+
+   const bool key = rec.count == 0 ||
+                    (rec.keyframe_interval &&
+                     rec.count % rec.keyframe_interval == 0);
+
+   struct clip_rect c = key ? screen : clip_intersect(&win, &rect);
+   struct rec_slot *s;
+   size_t row_size;
+   u8 *dst;
+
+   if (!rec.active || clip_is_empty(&c))
+      return;
+
+   pthread_mutex_lock(&rec.lock);
+   {
+      while (rec.used == REC_SLOTS)
+         pthread_cond_wait(&rec.cond, &rec.lock);
+
+      s = &rec.slots[rec.head % REC_SLOTS];
+   }
+   pthread_mutex_unlock(&rec.lock);
+
+   s->hdr = (struct rec_frame_header) {
+      .flags = key ? REC_FL_KEYFRAME : 0,
+      .x = c.x0,
+      .y = c.y0,
+      .w = c.x1 - c.x0,
+      .h = c.y1 - c.y0,
+      .time_ns = now_ns() - rec.start_ns,
+   };
+
+   row_size = (size_t)s->hdr.w * __fb_bytespp;
+   dst = s->pixels;
+
+   for (int r = c.y0; r < c.y1; r++, dst += row_size)
+      memcpy(dst, fb_ptr(c.x0, r), row_size);
+
+   rec.count++;
+
+   pthread_mutex_lock(&rec.lock);
+   {
+      rec.head++;
+      rec.used++;
+      pthread_cond_broadcast(&rec.cond);
+   }
+   pthread_mutex_unlock(&rec.lock);
+}
+
+static void free_buffers(void)
+{
+   for (int i = 0; i < REC_SLOTS; i++) {
+      free(rec.slots[i].pixels);
+      rec.slots[i].pixels = NULL;
+   }
+
+   free(rec.native_row);
+   free(rec.xrgb_row);
+   free(rec.out);
+
+   rec.native_row = rec.xrgb_row = NULL;
+   rec.out = NULL;
+}
+
+static bool alloc_buffers(void)
+{
+   const size_t pixels = (size_t)__fb_screen_w * __fb_screen_h;
+   const size_t slot_size = pixels * __fb_bytespp;
+
+   for (int i = 0; i < REC_SLOTS; i++) {
+
+      if (!(rec.slots[i].pixels = malloc(slot_size)))
+         return false;
+
+      /* Fault-in the pages now, not while recording */
+      memset(rec.slots[i].pixels, 0, slot_size);
+   }
+
+   rec.native_row = malloc(__fb_screen_w * sizeof(u32));
+   rec.xrgb_row = malloc(__fb_screen_w * sizeof(u32));
+   rec.out = malloc(QOI_HEADER_SIZE +
+                    QOI_MAX_ENC_SIZE(pixels) + QOI_END_SIZE);
+
+   return rec.native_row && rec.xrgb_row && rec.out;
+}
+
+int tfb_start_recording(const char *file, u32 keyframe_interval)
+{
+   struct rec_file_header hdr = {
+      .screen_w = __fb_screen_w,
+      .screen_h = __fb_screen_h,
+   };
+
+   int rc = TFB_SUCCESS;
+
+   if (rec.active)
+      tfb_stop_recording();
+
+   memcpy(hdr.magic, REC_MAGIC, REC_MAGIC_SIZE);
+
+   if (!alloc_buffers()) {
+      rc = TFB_ERR_OUT_OF_MEMORY;
+      goto err;
+   }
+
+   rec.fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+   if (rec.fd < 0 || !write_all(rec.fd, &hdr, sizeof(hdr))) {
+      rc = TFB_ERR_WRITE_FILE_FAILED;
+      goto err;
+   }
+
+   rec.keyframe_interval = keyframe_interval;
+   rec.count = rec.head = rec.tail = rec.used = 0;
+   rec.quit = rec.failed = false;
+   rec.start_ns = now_ns();
+
+   if (pthread_create(&rec.writer, NULL, writer_thread, NULL) != 0) {
+      rc = TFB_ERR_THREAD_CREATE_FAILED;
+      goto err;
+   }
+
+   rec.active = true;
+   return TFB_SUCCESS;
+
+err:
+   if (rec.fd >= 0) {
+      close(rec.fd);
+      rec.fd = -1;
+   }
+
+   free_buffers();
+   return rc;
+}
+
+int tfb_stop_recording(void)
+{
+   int rc = TFB_SUCCESS;
+
+   if (!rec.active)
+      return TFB_SUCCESS;
+
+   pthread_mutex_lock(&rec.lock);
+   {
+      rec.quit = true;
+      pthread_cond_broadcast(&rec.cond);
+   }
+   pthread_mutex_unlock(&rec.lock);
+   pthread_join(rec.writer, NULL);
+
+   if (close(rec.fd) != 0 || rec.failed)
+      rc = TFB_ERR_WRITE_FILE_FAILED;
+
+   rec.fd = -1;
+   rec.active = false;
+   free_buffers();
+   return rc;
+}
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include "utils.h"
+
+/*
+ * Format of the frame recordings made by tfb_start_recording(), shared with
+ * the tfb_replay tool. All the fields are little-endian.
+ *
+ * The file starts with a rec_file_header, followed by one record per flushed
+ * rect: a rec_frame_header and then 'size' bytes of pixels, encoded as a
+ * complete QOI image of w x h pixels (so, with its own header and end
+ * marker). Keyframes always cover the whole screen: a replay can start from
+ * any of them, while all the other records must be applied in order, each
+ * one on top of the result of the previous ones.
+ */
+
+#define REC_MAGIC             "TFBREC1\n"
+#define REC_MAGIC_SIZE        8
+
+#define REC_FL_KEYFRAME       (1 << 0)
+
+struct rec_file_header {
+   char magic[REC_MAGIC_SIZE];
+   u32 screen_w;
+   u32 screen_h;
+};
+
+struct rec_frame_header {
+   u32 flags;
+   u32 x;
+   u32 y;
+   u32 w;
+   u32 h;
+   u32 size;                  /* size of the QOI data that follows */
+   u64 time_ns;               /* since the beginning of the recording */
+};
@@ -0,0 +1,202 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <tfblib/tfblib.h>
+#include <tfblib/tfb_image.h>
+#include "utils.h"
+#include "raster.h"
+#include "qoi.h"
+
+/*
+ * Screenshots: the framebuffer is read one row at a time, converted to
+ * XRGB8888 (see pixel_ops.to_xrgb) and encoded on the fly into a fixed-size
+ * write buffer. No copy of the whole frame is ever made. Each row is read
+ * with a single sequential copy, because reading the framebuffer's memory
+ * pixel by pixel can be very slow.
+ */
+
+#define WRITE_BUF_SIZE        (64 * 1024)
+#define CHUNK_PIXELS          4096
+
+struct writer {
+   int fd;
+   u32 len;
+   bool failed;
+   u8 buf[WRITE_BUF_SIZE];
+};
+
+struct shot {
+   struct writer wr;
+   struct qoi_enc qoi;
+   u32 *native;                  /* the row, as read from the framebuffer */
+   u32 *row;                     /* the row, in XRGB8888 */
+};
+
+static void wr_flush(struct writer *w)
+{
+   const u8 *p = w->buf;
+   u32 left = w->len;
+
+   while (left && !w->failed) {
+
+      const ssize_t rc = write(w->fd, p, left);
+
+      if (rc <= 0) {
+
+         if (rc == 0 || errno != EINTR)
+            w->failed = true;
+
+         continue;
+      }
+
+      p += rc;
+      left -= rc;
+   }
+
+   w->len = 0;
+}
+
+/* Make room for at least 'n' bytes and return where to write them */
+static inline u8 *wr_reserve(struct writer *w, u32 n)
+{
+   if (w->len + n > sizeof(w->buf))
+      wr_flush(w);
+
+   return w->buf + w->len;
+}
+
+static const u32 *read_row(struct shot *s, int x, int y, u32 w)
+{
+   __tfb_px.load(s->native, fb_ptr(x, y), w);
+
+   if (__fb_is_xrgb8888)
+      return s->native;
+
+   __tfb_px.to_xrgb(s->row, s->native, w);
+   return s->row;
+}
+
+static void ppm_header(struct writer *wr, u32 w, u32 h)
+{
+   u8 *p = wr_reserve(wr, 32);
+   wr->len += sprintf((char *)p, "P6\n%u %u\n255\n", w, h);
+}
+
+static void ppm_row(struct writer *wr, const u32 *row, u32 w)
+{
+   for (u32 i = 0; i < w; i += CHUNK_PIXELS) {
+
+      const u32 n = MIN(w - i, (u32)CHUNK_PIXELS);
+      u8 *p = wr_reserve(wr, n * 3);
+
+      for (u32 j = 0; j < n; j++, p += 3) {
+         const u32 c = row[i + j];
+         p[0] = c >> 16;
+         p[1] = c >> 8;
+         p[2] = c;
+      }
+
+      wr->len += n * 3;
+   }
+}
+
+static void qoi_row(struct shot *s, const u32 *row, u32 w)
+{
+   for (u32 i = 0; i < w; i += CHUNK_PIXELS) {
+
+      const u32 n = MIN(w - i, (u32)CHUNK_PIXELS);
+      u8 *p = wr_reserve(&s->wr, QOI_MAX_ENC_SIZE(n));
+
+      s->wr.len += tfb_int_qoi_encode(&s->qoi, row + i, n, p);
+   }
+}
+
+int tfb_screenshot_fd(int fd, int x, int y, int w, int h, u32 format)
+{
+   const struct clip_rect win = win_rect();
+   const struct clip_rect rect = {
+      x + __fb_off_x, y + __fb_off_y,
+      x + __fb_off_x + w, y + __fb_off_y + h
+   };
+
+   const struct clip_rect c = clip_intersect(&win, &rect);
+   struct shot *s;
+   int rc = TFB_SUCCESS;
+
+   if (format != TFB_IMG_PNM && format != TFB_IMG_QOI)
+      return TFB_ERR_INVALID_IMAGE;
+
+   if (clip_is_empty(&c))
+      return TFB_ERR_INVALID_WINDOW;
+
+   w = c.x1 - c.x0;
+   h = c.y1 - c.y0;
+
+   if (!(s = malloc(sizeof(struct shot))))
+      return TFB_ERR_OUT_OF_MEMORY;
+
+   if (!(s->native = malloc(2 * w * sizeof(u32)))) {
+      free(s);
+      return TFB_ERR_OUT_OF_MEMORY;
+   }
+
+   s->row = s->native + w;
+
+   s->wr.fd = fd;
+   s->wr.len = 0;
+   s->wr.failed = false;
+
+   tfb_int_deferred_sync();
+
+   if (format == TFB_IMG_PNM) {
+
+      ppm_header(&s->wr, w, h);
+
+      for (int r = c.y0; r < c.y1 && !s->wr.failed; r++)
+         ppm_row(&s->wr, read_row(s, c.x0, r, w), w);
+
+   } else {
+
+      tfb_int_qoi_header(wr_reserve(&s->wr, QOI_HEADER_SIZE), w, h);
+      s->wr.len += QOI_HEADER_SIZE;
+      tfb_int_qoi_enc_init(&s->qoi);
+
+      for (int r = c.y0; r < c.y1 && !s->wr.failed; r++)
+         qoi_row(s, read_row(s, c.x0, r, w), w);
+
+      s->wr.len += tfb_int_qoi_enc_finish(
+         &s->qoi, wr_reserve(&s->wr, 1 + QOI_END_SIZE)
+      );
+   }
+
+   wr_flush(&s->wr);
+
+   if (s->wr.failed)
+      rc = TFB_ERR_WRITE_FILE_FAILED;
+
+   free(s->native);
+   free(s);
+   return rc;
+}
+
+int tfb_screenshot(const char *file, int x, int y, int w, int h, u32 format)
+{
+   int fd, rc;
+
+   fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+   if (fd < 0)
+      return TFB_ERR_WRITE_FILE_FAILED;
+
+   rc = tfb_screenshot_fd(fd, x, y, w, h, format);
+
+   if (close(fd) != 0 && rc == TFB_SUCCESS)
+      rc = TFB_ERR_WRITE_FILE_FAILED;
+
+   return rc;
+}
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <tfblib/tfblib.h>
+#include <tfblib/tfb_shared.h>
+#include "utils.h"
+#include "raster.h"
+
+/*
+ * Shared back buffer (see tfb_shared.h for the layout). The header takes a
+ * whole page, so that the pixels are page-aligned as well.
+ */
+
+#define SHARED_HEADER_SIZE    4096
+
+static int shared_fd = -1;
+static void *shared_map;
+static size_t shared_size;
+
+int tfb_get_shared_fd(void)
+{
+   return shared_fd;
+}
+
+void *tfb_int_shared_alloc(size_t size, bool prefault)
+{
+   struct tfb_shared_header *h;
+
+   shared_fd = memfd_create("tfblib-shared", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+   if (shared_fd < 0)
+      return NULL;
+
+   shared_size = SHARED_HEADER_SIZE + size;
+
+   if (ftruncate(shared_fd, shared_size) != 0)
+      goto err;
+
+   /* The viewers can rely on the size: it won't change anymore */
+   fcntl(shared_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+   shared_map = mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | (prefault ? MAP_POPULATE : 0),
+                     shared_fd, 0);
+
+   if (shared_map == MAP_FAILED) {
+      shared_map = NULL;
+      goto err;
+   }
+
+   h = shared_map;
+   *h = (struct tfb_shared_header) {
+      .magic = TFB_SHARED_MAGIC,
+      .header_size = SHARED_HEADER_SIZE,
+      .width = __fb_screen_w,
+      .height = __fb_screen_h,
+      .pitch = __fb_pitch,
+      .bits_per_pixel = __fb_bytespp * 8,
+      .red_pos = __fb_r_pos,
+      .red_len = __fb_r_mask_size,
+      .green_pos = __fb_g_pos,
+      .green_len = __fb_g_mask_size,
+      .blue_pos = __fb_b_pos,
+      .blue_len = __fb_b_mask_size,
+   };
+
+   return shared_map + SHARED_HEADER_SIZE;
+
+err:
+   close(shared_fd);
+   shared_fd = -1;
+   return NULL;
+}
+
+void tfb_int_shared_free(void)
+{
+   if (shared_map)
+      munmap(shared_map, shared_size);
+
+   if (shared_fd >= 0)
+      close(shared_fd);
+
+   shared_map = NULL;
+   shared_fd = -1;
+}
+
+/*
+ * Called by tfb_flush_rect() with the clipped rect, in absolute coordinates.
+ * Only the renderer writes the header, so plain loads are fine here: the
+ * release stores of 'seq' order the updates (and the pixels drawn before the
+ * flush) with respect to the readers.
+ */
+void tfb_int_shared_publish(int x, int y, int w, int h)
+{
+   struct tfb_shared_header *hdr = shared_map;
+   const u32 seq = hdr->seq;
+
+   __atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+
+   hdr->rects[hdr->rect_count % TFB_SHARED_RECTS] =
+      (struct tfb_shared_rect) { x, y, w, h };
+
+   hdr->rect_count++;
+   __atomic_store_n(&hdr->seq, seq + 2, __ATOMIC_RELEASE);
+}
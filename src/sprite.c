@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <tfblib/tfblib.h>
+#include "utils.h"
+#include "raster.h"
+
+/*
+ * Run-length encoded sprites.
+ *
+ * Each row is stored as a sequence of runs. A run starts with a 32-bit header
+ * containing the number of transparent pixels to skip (upper 16 bits) and the
+ * number of opaque pixels to copy (lower 16 bits), followed by the opaque
+ * pixels themselves. Rows end at the offset of the next row: trailing
+ * transparent pixels are not stored at all. Runs longer than 0xffff pixels
+ * are simply split.
+ */
+
+#define RLE_MAX_RUN           0xffff
+#define RLE_RUN(skip, copy)   (((u32)(skip) << 16) | (u32)(copy))
+#define RLE_SKIP(run)         ((run) >> 16)
+#define RLE_COPY(run)         ((run) & RLE_MAX_RUN)
+
+struct rle_sprite {
+   u32 w;
+   u32 h;
+   u32 *row_off;     /* h + 1 offsets in 'data', in 32-bit units */
+   u32 data[];
+};
+
+static inline const u32 *rle_row(const u32 *pixels, u32 pitch, u32 row)
+{
+   return (const u32 *)((const u8 *)pixels + (size_t)row * pitch);
+}
+
+/*
+ * Encode a single row into 'out' (if not NULL) and return the number of
+ * 32-bit elements needed for it.
+ */
+static size_t rle_encode_row(const u32 *row, u32 w, u32 key, u32 *out)
+{
+   size_t len = 0;
+   u32 x = 0;
+
+   while (x < w) {
+
+      u32 skip = 0, copy = 0;
+
+      while (x < w && row[x] == key && skip < RLE_MAX_RUN) {
+         x++;
+         skip++;
+      }
+
+      while (x < w && row[x] != key && copy < RLE_MAX_RUN) {
+         x++;
+         copy++;
+      }
+
+      if (!copy && (x == w || skip < RLE_MAX_RUN))
+         break; /* trailing transparent pixels: nothing to store */
+
+      if (out) {
+         out[len] = RLE_RUN(skip, copy);
+         memcpy(out + len + 1, row + x - copy, copy * sizeof(u32));
+      }
+
+      len += 1 + copy;
+   }
+
+   return len;
+}
+
+int tfb_make_rle_sprite(const u32 *pixels, u32 w, u32 h, u32 pitch,
+                        u32 color_key, tfb_rle_sprite_t *sprite)
+{
+   struct rle_sprite *s;
+   size_t data_len = 0;
+
+   *sprite = NULL;
+
+   /* First pass: just calculate the total size */
+   for (u32 r = 0; r < h; r++)
+      data_len += rle_encode_row(rle_row(pixels, pitch, r), w, color_key, NULL);
+
+   s = malloc(sizeof(*s) + (data_len + h + 1) * sizeof(u32));
+
+   if (!s)
+      return TFB_ERR_OUT_OF_MEMORY;
+
+   s->w = w;
+   s->h = h;
+   s->row_off = s->data + data_len;
+   s->row_off[0] = 0;
+
+   /* Second pass: the actual encoding */
+   for (u32 r = 0; r < h; r++) {
+
+      const u32 off = s->row_off[r];
+      const u32 *row = rle_row(pixels, pitch, r);
+
+      s->row_off[r + 1] = off + rle_encode_row(row, w, color_key,
+                                               s->data + off);
+   }
+
+   *sprite = s;
+   return TFB_SUCCESS;
+}
+
+void tfb_free_rle_sprite(tfb_rle_sprite_t sprite)
+{
+   free(sprite);
+}
+
+void tfb_draw_rle_sprite(int x, int y, tfb_rle_sprite_t sprite)
+{
+   const struct rle_sprite *s = sprite;
+   const struct clip_rect c = win_clip();
+   int ystart, yend;
+
+   tfb_int_deferred_sync();
+
+   x += __fb_off_x;
+   y += __fb_off_y;
+
+   ystart = MAX(y, c.y0);
+   yend = MIN(y + (int)s->h, c.y1);
+
+   if (x >= c.x1 || x + (int)s->w <= c.x0)
+      return;
+
+   for (int cy = ystart; cy < yend; cy++) {
+
+      const u32 *run = s->data + s->row_off[cy - y];
+      const u32 *end = s->data + s->row_off[cy - y + 1];
+      void *dest = fb_ptr(0, cy);
+      int cx = x;
+
+      while (run < end && cx < c.x1) {
+
+         const int copy = RLE_COPY(*run);
+
+         cx += RLE_SKIP(*run);
+         run++;
+
+         const int xs = MAX(cx, c.x0);
+         const int xe = MIN(cx + copy, c.x1);
+
+         if (xs < xe)
+            __tfb_px.copy(dest + xs * __fb_bytespp, run + (xs - cx), xe - xs);
+
+         cx += copy;
+         run += copy;
+      }
+   }
+}
@@ -8,6 +8,7 @@
 #include <tfblib/tfblib.h>
 #include "utils.h"
 #include "font.h"
+#include "raster.h"
 
 static void *curr_font;
 static u32 curr_font_w;
@@ -196,25 +197,22 @@ int tfb_set_current_font(tfb_font_t font_id)
 
 #define draw_char_partial(b)                                                \
    do {                                                                     \
-      tfb_draw_pixel(x + (b << 3) + 7, row, arr[!(data[b] & (1 << 0))]);    \
-      tfb_draw_pixel(x + (b << 3) + 6, row, arr[!(data[b] & (1 << 1))]);    \
-      tfb_draw_pixel(x + (b << 3) + 5, row, arr[!(data[b] & (1 << 2))]);    \
-      tfb_draw_pixel(x + (b << 3) + 4, row, arr[!(data[b] & (1 << 3))]);    \
-      tfb_draw_pixel(x + (b << 3) + 3, row, arr[!(data[b] & (1 << 4))]);    \
-      tfb_draw_pixel(x + (b << 3) + 2, row, arr[!(data[b] & (1 << 5))]);    \
-      tfb_draw_pixel(x + (b << 3) + 1, row, arr[!(data[b] & (1 << 6))]);    \
-      tfb_draw_pixel(x + (b << 3) + 0, row, arr[!(data[b] & (1 << 7))]);    \
+      clip_pixel(c, x + (b << 3) + 7, row, arr[!(data[b] & (1 << 0))]);     \
+      clip_pixel(c, x + (b << 3) + 6, row, arr[!(data[b] & (1 << 1))]);     \
+      clip_pixel(c, x + (b << 3) + 5, row, arr[!(data[b] & (1 << 2))]);     \
+      clip_pixel(c, x + (b << 3) + 4, row, arr[!(data[b] & (1 << 3))]);     \
+      clip_pixel(c, x + (b << 3) + 3, row, arr[!(data[b] & (1 << 4))]);     \
+      clip_pixel(c, x + (b << 3) + 2, row, arr[!(data[b] & (1 << 5))]);     \
+      clip_pixel(c, x + (b << 3) + 1, row, arr[!(data[b] & (1 << 6))]);     \
+      clip_pixel(c, x + (b << 3) + 0, row, arr[!(data[b] & (1 << 7))]);     \
    } while (0)
 
-void tfb_draw_char(int x, int y, u32 fg_color, u32 bg_color, u8 c)
+void tfb_int_draw_glyph(const struct clip_rect *c, int x, int y,
+                        u32 fg_color, u32 bg_color, const struct glyph *g)
 {
-   if (!curr_font) {
-      fprintf(stderr, "[tfblib] ERROR: no font currently selected\n");
-      return;
-   }
-
-   u8 *data = curr_font_data + curr_font_bytes_per_glyph * c;
+   const u8 *data = g->data;
    const u32 arr[] = { fg_color, bg_color };
+   const int yend = y + g->h;
 
    /*
     * NOTE: the following algorithm is certainly not the fastest way to draw
@@ -232,33 +230,71 @@ void tfb_draw_char(int x, int y, u32 fg_color, u32 bg_color, u8 c)
     *     https://github.com/vvaltchev/tilck
     */
 
-   if (curr_font_w_bytes == 1)
+   if (g->w_bytes == 1)
 
-      for (u32 row = y; row < (y + curr_font_h); row++) {
+      for (int row = y; row < yend; row++) {
          draw_char_partial(0);
-         data += curr_font_w_bytes;
+         data += g->w_bytes;
       }
 
-   else if (curr_font_w_bytes == 2)
+   else if (g->w_bytes == 2)
 
-      for (u32 row = y; row < (y + curr_font_h); row++) {
+      for (int row = y; row < yend; row++) {
          draw_char_partial(0);
          draw_char_partial(1);
-         data += curr_font_w_bytes;
+         data += g->w_bytes;
       }
 
    else
 
-      for (u32 row = y; row < (y + curr_font_h); row++) {
+      for (int row = y; row < yend; row++) {
 
-         for (u32 b = 0; b < curr_font_w_bytes; b++) {
+         for (u32 b = 0; b < g->w_bytes; b++) {
             draw_char_partial(b);
          }
 
-         data += curr_font_w_bytes;
+         data += g->w_bytes;
       }
 }
 
+void tfb_draw_char(int x, int y, u32 fg_color, u32 bg_color, u8 c)
+{
+   const struct clip_rect clip = win_clip();
+   struct glyph g;
+
+   if (!curr_font) {
+      fprintf(stderr, "[tfblib] ERROR: no font currently selected\n");
+      return;
+   }
+
+   g = (struct glyph) {
+      .data = curr_font_data + curr_font_bytes_per_glyph * c,
+      .w_bytes = curr_font_w_bytes,
+      .h = curr_font_h,
+   };
+
+   x += __fb_off_x;
+   y += __fb_off_y;
+
+   if (__tfb_deferred) {
+
+      struct cmd cmd = {
+         .type = CMD_GLYPH,
+         .color = fg_color,
+         .color2 = bg_color,
+         .a = { x, y },
+         .clip = clip,
+         .bbox = { x, y, x + 8 * g.w_bytes, y + g.h },
+         .u.glyph = g,
+      };
+
+      if (tfb_int_defer(&cmd))
+         return;
+   }
+
+   tfb_int_draw_glyph(&clip, x, y, fg_color, bg_color, &g);
+}
+
 void tfb_draw_char_scaled(int x, int y,
                           u32 fg, u32 bg, int xscale, int yscale, u8 c)
 {
@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <string.h>
+
+#ifdef __SSE2__
+   #include <emmintrin.h>
+#endif
+
+#include <tfblib/tfblib.h>
+#include "utils.h"
+#include "raster.h"
+
+/*
+ * Skipping the unchanged parts of the flushed rects (TFB_FL_SKIP_UNCHANGED).
+ *
+ * Each row of the screen is split in tiles of TILE_W pixels and, for each
+ * tile, we keep the hash of the pixels last copied to the framebuffer (0 means
+ * unknown). On flush, the tiles entirely inside the rect are hashed and the
+ * ones with the same hash as before are skipped, while the others are copied
+ * in runs, as few as possible. Hashing reads memory at a fraction of the cost
+ * of writing it to the video memory, which is typically uncached or
+ * write-combined and often behind a slow bus.
+ *
+ * The hash is the accumulation step of XXH3: for each 16 bytes, the data XOR
+ * a per-position key gets its 32-bit halves multiplied together and the
+ * products, plus the data itself, are added to two 64-bit accumulators. With
+ * SSE2 that's a single multiply for the whole block and no dependency between
+ * blocks except the final addition.
+ */
+
+#define TILE_W             64
+#define TILE_MAX_BYTES     (TILE_W * 4)
+
+static u64 *hashes;
+static u32 tiles_per_row;
+static u64 keys[TILE_MAX_BYTES / 8] __attribute__((aligned(16)));
+
+#ifdef __SSE2__
+
+typedef __m128i hash_acc;
+
+#define HASH_ACC_INIT \
+   _mm_set_epi64x((long long)0x9e3779b185ebca87ull, \
+                  (long long)0xc2b2ae3d27d4eb4full)
+
+static inline hash_acc hash_step(hash_acc acc, const u8 *p, const u64 *key)
+{
+   const __m128i d = _mm_loadu_si128((const __m128i *)p);
+   const __m128i dk = _mm_xor_si128(d, _mm_load_si128((const __m128i *)key));
+   const __m128i hi = _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1));
+   const __m128i prod = _mm_mul_epu32(dk, hi);
+   const __m128i swap = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+
+   return _mm_add_epi64(acc, _mm_add_epi64(prod, swap));
+}
+
+static inline u64 hash_fold(hash_acc acc)
+{
+   u64 a[2];
+   _mm_storeu_si128((__m128i *)a, acc);
+   return a[0] ^ (a[1] << 31 | a[1] >> 33);
+}
+
+#else
+
+typedef struct { u64 a0, a1; } hash_acc;
+
+#define HASH_ACC_INIT \
+   ((hash_acc) { 0xc2b2ae3d27d4eb4full, 0x9e3779b185ebca87ull })
+
+static inline hash_acc hash_step(hash_acc acc, const u8 *p, const u64 *key)
+{
+   u64 d0, d1, dk0, dk1;
+
+   memcpy(&d0, p, 8);
+   memcpy(&d1, p + 8, 8);
+   dk0 = d0 ^ key[0];
+   dk1 = d1 ^ key[1];
+
+   acc.a0 += d1 + (dk0 & 0xffffffff) * (dk0 >> 32);
+   acc.a1 += d0 + (dk1 & 0xffffffff) * (dk1 >> 32);
+   return acc;
+}
+
+static inline u64 hash_fold(hash_acc acc)
+{
+   return acc.a0 ^ (acc.a1 << 31 | acc.a1 >> 33);
+}
+
+#endif
+
+static u64 hash_tile(const u8 *p, u32 n)
+{
+   hash_acc acc = HASH_ACC_INIT, acc2 = HASH_ACC_INIT;
+   u64 h;
+   u32 i;
+
+   /* Two independent accumulators, to keep both multipliers busy */
+   for (i = 0; i + 32 <= n; i += 32) {
+      acc = hash_step(acc, p + i, keys + i / 8);
+      acc2 = hash_step(acc2, p + i + 16, keys + i / 8 + 2);
+   }
+
+   if (i + 16 <= n) {
+      acc = hash_step(acc, p + i, keys + i / 8);
+      i += 16;
+   }
+
+   if (i < n) {
+      u8 tail[16] = {0};
+      memcpy(tail, p + i, n - i);
+      acc = hash_step(acc, tail, keys + i / 8);
+   }
+
+   h = hash_fold(acc) ^ hash_fold(acc2) * 0x9e3779b97f4a7c15ull;
+   return h ? h : 1;
+}
+
+bool tfb_int_tilehash_alloc(void)
+{
+   u64 s = 0x853c49e6748fea9bull;
+
+   /* splitmix64, just to get some well-distributed constants */
+   for (int i = 0; i < ARRAY_SIZE(keys); i++) {
+      u64 z = (s += 0x9e3779b97f4a7c15ull);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      keys[i] = z ^ (z >> 31);
+   }
+
+   tiles_per_row = (__fb_screen_w + TILE_W - 1) / TILE_W;
+   hashes = calloc((size_t)tiles_per_row * __fb_screen_h, sizeof(u64));
+   return hashes != NULL;
+}
+
+void tfb_int_tilehash_free(void)
+{
+   free(hashes);
+   hashes = NULL;
+}
+
+void tfb_int_tilehash_invalidate(void)
+{
+   if (hashes)
+      memset(hashes, 0, (size_t)tiles_per_row * __fb_screen_h * sizeof(u64));
+}
+
+u64 tfb_int_copy_changed(const void *buf, int x, int y, int w, int h)
+{
+   const int xend = x + w;
+   u64 copied = 0;
+
+   for (int r = y; r < y + h; r++) {
+
+      u64 *row_hashes = hashes + (size_t)r * tiles_per_row;
+      int run = -1;           /* start of the current run to copy */
+
+      for (int tx = x - x % TILE_W; tx < xend; tx += TILE_W) {
+
+         const int tx_end = MIN(tx + TILE_W, __fb_screen_w);
+         u64 *th = &row_hashes[tx / TILE_W];
+         bool changed = true;
+
+         if (tx >= x && tx_end <= xend) {
+
+            const u8 *p = buf + r * __fb_pitch + tx * __fb_bytespp;
+            const u64 hash = hash_tile(p, (tx_end - tx) * __fb_bytespp);
+
+            changed = hash != *th;
+            *th = hash;
+
+         } else {
+
+            /* Partially flushed: its old hash is meaningless from now on */
+            *th = 0;
+         }
+
+         if (changed && run < 0)
+            run = MAX(tx, x);
+
+         if (!changed && run >= 0) {
+            tfb_int_copy_rect(buf, run, r, tx - run, 1);
+            copied += tx - run;
+            run = -1;
+         }
+      }
+
+      if (run >= 0) {
+         tfb_int_copy_rect(buf, run, r, xend - run, 1);
+         copied += xend - run;
+      }
+   }
+
+   return copied * __fb_bytespp;
+}
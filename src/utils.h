@@ -4,7 +4,11 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#define LIKELY(x) __builtin_expect(!!(x), 1)
+#define UNLIKELY(x) __builtin_expect(!!(x), 0)
+
 #define ARRAY_SIZE(a) ((int)(sizeof(a)/sizeof(a[0])))
+#define ALIGN_UP(n, a) (((n) + (a) - 1) & ~((__typeof__(n))(a) - 1))
 #define INT_ABS(x) ((x) > 0 ? (x) : (-(x)))
 
 #define MIN(x, y) \
@@ -21,6 +25,21 @@
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
+
+/*
+ * Division rounding towards -inf, with a remainder in [0, d). Requires d > 0.
+ */
+static inline void floor_divmod(int64_t n, int64_t d, int64_t *q, int64_t *r)
+{
+   *q = n / d;
+   *r = n % d;
+
+   if (*r < 0) {
+      *q -= 1;
+      *r += d;
+   }
+}
 
 
 /*
@@ -0,0 +1,842 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+   #include <emmintrin.h>
+#endif
+
+#include <tfblib/tfblib.h>
+#include <tfblib/tfb_video.h>
+#include "utils.h"
+#include "raster.h"
+
+/*
+ * Video playback.
+ *
+ * Video files are mapped in memory: decoding a frame is just converting its
+ * rows, read straight from the mapping, to the native pixel format. The YUV
+ * rows are converted to XRGB8888 (with SSE2, 8 pixels at a time) and then to
+ * the native format with the pixel_ops kernels, exactly like the images.
+ *
+ * tfb_play_video() runs the conversion in a producer thread, which fills two
+ * frame buffers in turn, while the calling thread does the pacing and the
+ * presentation. The two never touch the same frame buffer at the same time.
+ */
+
+#define Y4M_MAGIC             "YUV4MPEG2 "
+#define Y4M_MAGIC_SIZE        10
+#define Y4M_MAX_HEADER        1024
+#define Y4M_MAX_FRAME_HEADER  256
+#define MAX_VIDEO_SIDE        (1 << 16)
+#define MAX_FPS_TERM          100000   /* See frame_deadline() */
+#define NSEC_PER_SEC          1000000000ull
+
+struct yuv_coeffs {
+   int y_off;
+   int y_mul;
+   int rv;
+   int gu;
+   int gv;
+   int bu;
+};
+
+/* BT.601, in 8.8 fixed point */
+static const struct yuv_coeffs bt601_limited = {
+   16, 298, 409, -100, -208, 516
+};
+
+static const struct yuv_coeffs bt601_full = {
+   0, 256, 359, -88, -183, 454
+};
+
+struct video {
+
+   struct tfb_video_info info;
+
+   const u8 *map;
+   size_t map_size;
+
+   size_t frame_size;
+   size_t *offsets;                 /* Y4M only: where each frame's data is */
+   const struct yuv_coeffs *coeffs;
+
+   volatile sig_atomic_t stop;
+};
+
+/*
+ * ----------------------------------------------------------------------------
+ * Opening
+ * ----------------------------------------------------------------------------
+ */
+
+static int map_file(struct video *v, const char *file)
+{
+   struct stat st;
+   void *map;
+   int fd;
+
+   if ((fd = open(file, O_RDONLY | O_CLOEXEC)) < 0)
+      return TFB_ERR_READ_FILE_FAILED;
+
+   if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+      close(fd);
+      return TFB_ERR_READ_FILE_FAILED;
+   }
+
+   map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+
+   if (map == MAP_FAILED)
+      return TFB_ERR_READ_FILE_FAILED;
+
+   madvise(map, st.st_size, MADV_SEQUENTIAL);
+   v->map = map;
+   v->map_size = st.st_size;
+   return TFB_SUCCESS;
+}
+
+static bool parse_uint(const u8 **pp, const u8 *end, u32 *val)
+{
+   const u8 *p = *pp;
+   u64 n = 0;
+
+   if (p == end || *p < '0' || *p > '9')
+      return false;
+
+   for (; p < end && *p >= '0' && *p <= '9'; p++) {
+
+      n = n * 10 + (*p - '0');
+
+      if (n > UINT32_MAX)
+         return false;
+   }
+
+   *pp = p;
+   *val = n;
+   return true;
+}
+
+static bool token_is(const u8 *p, const u8 *end, const char *str)
+{
+   const size_t len = strlen(str);
+   return (size_t)(end - p) >= len && !memcmp(p, str, len) &&
+          (p + len == end || p[len] == ' ' || p[len] == '\n');
+}
+
+/*
+ * Parse the stream header, e.g.:
+ *    YUV4MPEG2 W640 H480 F30000:1001 Ip A1:1 C420jpeg XYSCSS=420JPEG\n
+ * Returns the size of the header, or 0 if it's invalid.
+ */
+static size_t y4m_header(struct video *v)
+{
+   const u8 *p = v->map + Y4M_MAGIC_SIZE;
+   const u8 *end = v->map + MIN(v->map_size, (size_t)Y4M_MAX_HEADER);
+   struct tfb_video_info *info = &v->info;
+
+   if (p >= end || memcmp(v->map, Y4M_MAGIC, Y4M_MAGIC_SIZE))
+      return 0;
+
+   info->fps_num = 25;
+   info->fps_den = 1;
+   v->coeffs = &bt601_limited;
+
+   while (p < end && *p != '\n') {
+
+      const u8 tag = *p++;
+      bool ok = true;
+
+      switch (tag) {
+
+         case ' ':
+            continue;
+
+         case 'W':
+            ok = parse_uint(&p, end, &info->width);
+            break;
+
+         case 'H':
+            ok = parse_uint(&p, end, &info->height);
+            break;
+
+         case 'F':
+            ok = parse_uint(&p, end, &info->fps_num) &&
+                 p < end && *p++ == ':' &&
+                 parse_uint(&p, end, &info->fps_den);
+            break;
+
+         case 'C':
+            /* 420, 420jpeg, 420paldv, 420mpeg2: they differ only in siting */
+            ok = token_is(p, end, "420") || token_is(p, end, "420jpeg") ||
+                 token_is(p, end, "420paldv") || token_is(p, end, "420mpeg2");
+            break;
+
+         case 'X':
+            if (token_is(p, end, "COLORRANGE=FULL"))
+               v->coeffs = &bt601_full;
+            break;
+      }
+
+      if (!ok)
+         return 0;
+
+      /* Skip the rest of the parameter */
+      while (p < end && *p != ' ' && *p != '\n')
+         p++;
+   }
+
+   if (p == end)
+      return 0;
+
+   if (!info->fps_num || !info->fps_den ||
+       info->fps_num > MAX_FPS_TERM || info->fps_den > MAX_FPS_TERM)
+   {
+      return 0;
+   }
+
+   return p + 1 - v->map;
+}
+
+static int y4m_index_frames(struct video *v, size_t off)
+{
+   size_t cap = 0;
+
+   while (v->map_size - off >= 5 && !memcmp(v->map + off, "FRAME", 5)) {
+
+      const u8 *p = v->map + off + 5;
+      const u8 *end = v->map + MIN(v->map_size, off + Y4M_MAX_FRAME_HEADER);
+
+      while (p < end && *p != '\n')
+         p++;
+
+      if (p == end)
+         break;
+
+      off = p + 1 - v->map;
+
+      if (v->map_size - off < v->frame_size)
+         break;
+
+      if (v->info.frames == cap) {
+
+         size_t *offsets;
+         cap = MAX(cap * 2, (size_t)64);
+
+         if (!(offsets = realloc(v->offsets, cap * sizeof(size_t))))
+            return TFB_ERR_OUT_OF_MEMORY;
+
+         v->offsets = offsets;
+      }
+
+      v->offsets[v->info.frames++] = off;
+      off += v->frame_size;
+   }
+
+   return v->info.frames ? TFB_SUCCESS : TFB_ERR_INVALID_IMAGE;
+}
+
+static bool valid_size(u32 w, u32 h)
+{
+   return w && h && w <= MAX_VIDEO_SIDE && h <= MAX_VIDEO_SIDE;
+}
+
+int tfb_open_video(const char *file, tfb_video_t *video)
+{
+   struct video *v = calloc(1, sizeof(struct video));
+   size_t header_size;
+   u32 cw, ch;
+   int rc;
+
+   if (!v)
+      return TFB_ERR_OUT_OF_MEMORY;
+
+   if ((rc = map_file(v, file)) != TFB_SUCCESS)
+      goto err;
+
+   rc = TFB_ERR_INVALID_IMAGE;
+
+   if (!(header_size = y4m_header(v)))
+      goto err;
+
+   if (!valid_size(v->info.width, v->info.height))
+      goto err;
+
+   cw = (v->info.width + 1) / 2;
+   ch = (v->info.height + 1) / 2;
+
+   v->info.format = TFB_VIDEO_Y4M;
+   v->frame_size = (size_t)v->info.width * v->info.height + 2 * cw * ch;
+
+   if ((rc = y4m_index_frames(v, header_size)) != TFB_SUCCESS)
+      goto err;
+
+   *video = v;
+   return TFB_SUCCESS;
+
+err:
+   tfb_close_video(v);
+   return rc;
+}
+
+int tfb_open_raw_video(const char *file, u32 w, u32 h,
+                       u32 fps, tfb_video_t *video)
+{
+   struct video *v;
+   int rc;
+
+   if (!valid_size(w, h) || !fps || fps > MAX_FPS_TERM)
+      return TFB_ERR_INVALID_IMAGE;
+
+   if (!(v = calloc(1, sizeof(struct video))))
+      return TFB_ERR_OUT_OF_MEMORY;
+
+   if ((rc = map_file(v, file)) != TFB_SUCCESS) {
+      tfb_close_video(v);
+      return rc;
+   }
+
+   v->info = (struct tfb_video_info) {
+      .width = w,
+      .height = h,
+      .format = TFB_VIDEO_RAW_XRGB,
+      .fps_num = fps,
+      .fps_den = 1,
+   };
+
+   v->frame_size = (size_t)w * h * 4;
+   v->info.frames = MIN(v->map_size / v->frame_size, (size_t)UINT32_MAX);
+
+   if (!v->info.frames) {
+      tfb_close_video(v);
+      return TFB_ERR_INVALID_IMAGE;
+   }
+
+   *video = v;
+   return TFB_SUCCESS;
+}
+
+void tfb_close_video(tfb_video_t video)
+{
+   struct video *v = video;
+
+   if (!v)
+      return;
+
+   if (v->map)
+      munmap((void *)v->map, v->map_size);
+
+   free(v->offsets);
+   free(v);
+}
+
+void tfb_get_video_info(tfb_video_t video, struct tfb_video_info *info)
+{
+   *info = ((struct video *)video)->info;
+}
+
+void tfb_stop_video(tfb_video_t video)
+{
+   ((struct video *)video)->stop = 1;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Conversion
+ * ----------------------------------------------------------------------------
+ */
+
+static inline u32 clamp8(int v)
+{
+   return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static inline u32
+yuv_pixel(const struct yuv_coeffs *k, int y, int u, int v)
+{
+   const int t = (y - k->y_off) * k->y_mul + 128;
+   const int d = u - 128;
+   const int e = v - 128;
+
+   return clamp8((t + k->rv * e) >> 8) << 16 |
+          clamp8((t + k->gu * d + k->gv * e) >> 8) << 8 |
+          clamp8((t + k->bu * d) >> 8);
+}
+
+#ifdef __SSE2__
+
+static inline u32 load_u32(const u8 *p)
+{
+   u32 val;
+   memcpy(&val, p, sizeof(val));
+   return val;
+}
+
+/* Two 16-bit coefficients, for the (low, high) halves of _mm_madd_epi16() */
+static inline __m128i coeff_pair(int lo, int hi)
+{
+   return _mm_set1_epi32((int)(((u32)hi << 16) | (u16)lo));
+}
+
+/*
+ * The same math as yuv_pixel(), for 8 pixels sharing 4 chroma samples. Each
+ * sum of products is a single _mm_madd_epi16() on interleaved operands: (Y,
+ * 1) for the luma term plus the rounding and (U, V) for the chroma terms.
+ * Both the clamps come from the saturating packs.
+ */
+static inline void
+yuv8_sse2(u32 *dst, const u8 *y, const u8 *u, const u8 *v,
+          const struct yuv_coeffs *k)
+{
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i k_y = coeff_pair(k->y_mul, 128);
+   const __m128i k_r = coeff_pair(0, k->rv);
+   const __m128i k_g = coeff_pair(k->gu, k->gv);
+   const __m128i k_b = coeff_pair(k->bu, 0);
+
+   const __m128i y16 = _mm_sub_epi16(
+      _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)y), zero),
+      _mm_set1_epi16(k->y_off)
+   );
+
+   __m128i u16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(load_u32(u)), zero);
+   __m128i v16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(load_u32(v)), zero);
+
+   u16 = _mm_sub_epi16(_mm_unpacklo_epi16(u16, u16), _mm_set1_epi16(128));
+   v16 = _mm_sub_epi16(_mm_unpacklo_epi16(v16, v16), _mm_set1_epi16(128));
+
+   const __m128i one = _mm_set1_epi16(1);
+   const __m128i y_lo = _mm_madd_epi16(_mm_unpacklo_epi16(y16, one), k_y);
+   const __m128i y_hi = _mm_madd_epi16(_mm_unpackhi_epi16(y16, one), k_y);
+   const __m128i uv_lo = _mm_unpacklo_epi16(u16, v16);
+   const __m128i uv_hi = _mm_unpackhi_epi16(u16, v16);
+
+#define CHANNEL(kc)                                                        \
+   _mm_packs_epi32(                                                        \
+      _mm_srai_epi32(_mm_add_epi32(y_lo, _mm_madd_epi16(uv_lo, kc)), 8),   \
+      _mm_srai_epi32(_mm_add_epi32(y_hi, _mm_madd_epi16(uv_hi, kc)), 8)    \
+   )
+
+   const __m128i r = _mm_packus_epi16(CHANNEL(k_r), zero);
+   const __m128i g = _mm_packus_epi16(CHANNEL(k_g), zero);
+   const __m128i b = _mm_packus_epi16(CHANNEL(k_b), zero);
+
+#undef CHANNEL
+
+   const __m128i bg = _mm_unpacklo_epi8(b, g);
+   const __m128i r0 = _mm_unpacklo_epi8(r, zero);
+
+   _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(bg, r0));
+   _mm_storeu_si128((__m128i *)(dst + 4), _mm_unpackhi_epi16(bg, r0));
+}
+
+#endif
+
+/*
+ * Convert 'n' pixels of a 4:2:0 row, starting from the pixel 'x', to XRGB8888.
+ * 'u' and 'v' point to the beginning of the chroma rows.
+ */
+static void
+yuv_row(u32 *dst, const u8 *y, const u8 *u, const u8 *v,
+        u32 x, u32 n, const struct yuv_coeffs *k)
+{
+   u32 i = 0;
+
+   if ((x & 1) && n) {
+      dst[0] = yuv_pixel(k, y[x], u[x >> 1], v[x >> 1]);
+      i = 1;
+   }
+
+#ifdef __SSE2__
+   for (; i + 8 <= n; i += 8) {
+      const u32 c = (x + i) >> 1;
+      yuv8_sse2(dst + i, y + x + i, u + c, v + c, k);
+   }
+#endif
+
+   for (; i < n; i++) {
+      const u32 c = (x + i) >> 1;
+      dst[i] = yuv_pixel(k, y[x + i], u[c], v[c]);
+   }
+}
+
+static const u8 *frame_data(const struct video *v, u32 frame)
+{
+   if (v->info.format == TFB_VIDEO_Y4M)
+      return v->map + v->offsets[frame];
+
+   return v->map + (size_t)frame * v->frame_size;
+}
+
+/*
+ * Convert the part 'vis' (in video coordinates) of a frame to the native
+ * format, writing its rows at 'dst', 'pitch' bytes apart. 'tmp' must have
+ * room for 2 rows of XRGB8888 pixels.
+ */
+static void
+convert_frame(const struct video *v, u32 frame, const struct clip_rect *vis,
+              u8 *dst, size_t pitch, u32 *tmp)
+{
+   const u32 w = v->info.width;
+   const u32 n = vis->x1 - vis->x0;
+   const u8 *data = frame_data(v, frame);
+   u32 *const native = tmp + n;
+
+   for (int y = vis->y0; y < vis->y1; y++, dst += pitch) {
+
+      const u32 *xrgb;
+
+      if (v->info.format == TFB_VIDEO_Y4M) {
+
+         const size_t cw = (w + 1) / 2;
+         const size_t ch = (v->info.height + 1) / 2;
+         const u8 *u = data + (size_t)w * v->info.height + (y >> 1) * cw;
+
+         /* No intermediate row when the native format is XRGB8888 */
+         u32 *out = __fb_is_xrgb8888 ? (u32 *)dst : tmp;
+
+         yuv_row(out, data + (size_t)y * w, u, u + cw * ch,
+                 vis->x0, n, v->coeffs);
+
+         if (__fb_is_xrgb8888)
+            continue;
+
+         xrgb = tmp;
+
+      } else {
+
+         xrgb = (const u32 *)(data + ((size_t)y * w + vis->x0) * 4);
+
+         if (__fb_is_xrgb8888) {
+            __tfb_px.copy(dst, xrgb, n);
+            continue;
+         }
+      }
+
+      __tfb_px.from_xrgb(native, xrgb, n);
+      __tfb_px.copy(dst, native, n);
+   }
+}
+
+/* The clip rect of a video at (x, y) and its visible part */
+static bool video_clip(const struct video *v, int x, int y,
+                       struct clip_rect *clip, struct clip_rect *vis)
+{
+   const struct clip_rect win = win_clip();
+   const struct clip_rect rect = {
+      x + __fb_off_x,
+      y + __fb_off_y,
+      x + __fb_off_x + (int)v->info.width,
+      y + __fb_off_y + (int)v->info.height,
+   };
+
+   *clip = clip_intersect(&win, &rect);
+
+   *vis = (struct clip_rect) {
+      clip->x0 - rect.x0, clip->y0 - rect.y0,
+      clip->x1 - rect.x0, clip->y1 - rect.y0,
+   };
+
+   return !clip_is_empty(clip);
+}
+
+int tfb_draw_video_frame(int x, int y, tfb_video_t video, u32 frame)
+{
+   struct video *v = video;
+   struct clip_rect clip, vis;
+   u32 *tmp;
+
+   if (frame >= v->info.frames)
+      return TFB_ERR_INVALID_IMAGE;
+
+   tfb_int_deferred_sync();
+
+   if (!video_clip(v, x, y, &clip, &vis))
+      return TFB_SUCCESS;
+
+   if (!(tmp = malloc(2 * (vis.x1 - vis.x0) * sizeof(u32))))
+      return TFB_ERR_OUT_OF_MEMORY;
+
+   convert_frame(v, frame, &vis, fb_ptr(clip.x0, clip.y0), __fb_pitch, tmp);
+   free(tmp);
+   return TFB_SUCCESS;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Playback
+ * ----------------------------------------------------------------------------
+ */
+
+struct player {
+
+   struct video *v;
+   struct clip_rect clip;           /* absolute */
+   struct clip_rect vis;            /* video coordinates */
+   u32 flags;
+
+   size_t row_size;
+   u8 *frames[2];
+   u32 *tmp;
+
+   u64 start;                       /* CLOCK_MONOTONIC time of frame 0 */
+
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   bool full[2];
+   u64 seq[2];                      /* the frame in each full slot */
+   bool done;                       /* no more frames will be produced */
+   bool quit;
+};
+
+static inline bool seq_done(const struct player *p, u64 seq)
+{
+   return !(p->flags & TFB_VIDEO_LOOP) && seq >= p->v->info.frames;
+}
+
+/* Hint the kernel to read ahead a frame, while the current one is converted */
+static void prefetch_frame(const struct video *v, u32 frame)
+{
+   const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+   const uintptr_t start = (uintptr_t)frame_data(v, frame);
+   const uintptr_t aligned = start & ~(page - 1);
+
+   madvise((void *)aligned, start - aligned + v->frame_size, MADV_WILLNEED);
+}
+
+/*
+ * Deadline of the frame 'seq' since the start, in ns. To avoid overflows in
+ * endless loops, the whole seconds are moved into 'base' every fps_num
+ * frames: then (seq - base_seq) * fps_den * 1e9 < MAX_FPS_TERM^2 * 1e9 fits
+ * in 64 bits. 'seq' must never decrease between calls.
+ */
+static u64 frame_deadline(const struct tfb_video_info *info, u64 seq,
+                          u64 *base, u64 *base_seq)
+{
+   while (seq - *base_seq >= info->fps_num) {
+      *base += info->fps_den * NSEC_PER_SEC;
+      *base_seq += info->fps_num;
+   }
+
+   return *base + (seq - *base_seq) * info->fps_den * NSEC_PER_SEC /
+                  info->fps_num;
+}
+
+/*
+ * The frame due 'elapsed' ns after the start. Splitting the division by 1e9
+ * is exact, because floor(floor(a) / b) == floor(a / b) for any integer b.
+ */
+static u64 frame_at(const struct tfb_video_info *info, u64 elapsed)
+{
+   const u64 sec = elapsed / NSEC_PER_SEC;
+   const u64 rem = elapsed % NSEC_PER_SEC;
+
+   return (sec * info->fps_num + rem * info->fps_num / NSEC_PER_SEC) /
+          info->fps_den;
+}
+
+static u64 now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void sleep_until(u64 t)
+{
+   const struct timespec ts = {
+      .tv_sec = t / NSEC_PER_SEC,
+      .tv_nsec = t % NSEC_PER_SEC,
+   };
+
+   while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      ;
+}
+
+static void *producer_thread(void *arg)
+{
+   struct player *p = arg;
+   const struct tfb_video_info *info = &p->v->info;
+   u64 seq = 0;
+
+   for (u32 n = 0; !seq_done(p, seq); n++, seq++) {
+
+      const int s = n & 1;
+
+      bool quit;
+
+      pthread_mutex_lock(&p->lock);
+      {
+         while (p->full[s] && !p->quit)
+            pthread_cond_wait(&p->cond, &p->lock);
+
+         quit = p->quit;
+      }
+      pthread_mutex_unlock(&p->lock);
+
+      if (quit)
+         break;
+
+      /*
+       * Skip the frames already overdue: when the conversion is slower than
+       * the frame rate, the playback shows fewer frames instead of falling
+       * further and further behind (and dropping all of them).
+       */
+      seq = MAX(seq, frame_at(info, now_ns() - p->start));
+
+      if (!(p->flags & TFB_VIDEO_LOOP))
+         seq = MIN(seq, (u64)info->frames - 1);
+
+      if (!seq_done(p, seq + 1))
+         prefetch_frame(p->v, (seq + 1) % info->frames);
+
+      convert_frame(p->v, seq % info->frames, &p->vis,
+                    p->frames[s], p->row_size, p->tmp);
+
+      pthread_mutex_lock(&p->lock);
+      {
+         p->seq[s] = seq;
+         p->full[s] = true;
+         pthread_cond_broadcast(&p->cond);
+      }
+      pthread_mutex_unlock(&p->lock);
+   }
+
+   pthread_mutex_lock(&p->lock);
+   {
+      p->done = true;
+      pthread_cond_broadcast(&p->cond);
+   }
+   pthread_mutex_unlock(&p->lock);
+   return NULL;
+}
+
+static void present(const struct player *p, const u8 *frame)
+{
+   const struct clip_rect *c = &p->clip;
+
+   for (int y = c->y0; y < c->y1; y++, frame += p->row_size)
+      memcpy(fb_ptr(c->x0, y), frame, p->row_size);
+
+   tfb_flush_rect(c->x0 - __fb_off_x, c->y0 - __fb_off_y,
+                  c->x1 - c->x0, c->y1 - c->y0);
+}
+
+static void play(struct player *p)
+{
+   const struct tfb_video_info *info = &p->v->info;
+   u64 base = 0, base_seq = 0;
+
+   for (u32 n = 0; !p->v->stop; n++) {
+
+      const int s = n & 1;
+      bool ready, newer;
+      u64 seq, next;
+
+      pthread_mutex_lock(&p->lock);
+      {
+         while (!p->full[s] && !p->done)
+            pthread_cond_wait(&p->cond, &p->lock);
+
+         ready = p->full[s];
+         seq = p->seq[s];
+      }
+      pthread_mutex_unlock(&p->lock);
+
+      if (!ready)
+         break;
+
+      sleep_until(p->start + frame_deadline(info, seq, &base, &base_seq));
+
+      pthread_mutex_lock(&p->lock);
+      {
+         newer = p->full[!s];
+         next = p->seq[!s];
+      }
+      pthread_mutex_unlock(&p->lock);
+
+      /*
+       * Drop the frame only when a newer one is ready and already due: when
+       * nothing newer is ready, a late frame is better than a frozen screen.
+       */
+      if (!newer ||
+          now_ns() < p->start + frame_deadline(info, next, &base, &base_seq))
+      {
+         present(p, p->frames[s]);
+      }
+
+      pthread_mutex_lock(&p->lock);
+      {
+         p->full[s] = false;
+         pthread_cond_broadcast(&p->cond);
+      }
+      pthread_mutex_unlock(&p->lock);
+   }
+}
+
+int tfb_play_video(int x, int y, tfb_video_t video, u32 flags)
+{
+   struct video *v = video;
+   struct player p = {
+      .v = v,
+      .flags = flags,
+      .lock = PTHREAD_MUTEX_INITIALIZER,
+      .cond = PTHREAD_COND_INITIALIZER,
+   };
+
+   pthread_t producer;
+   size_t frame_size;
+   u32 n;
+   int rc = TFB_SUCCESS;
+
+   v->stop = 0;
+   tfb_int_deferred_sync();
+
+   if (!video_clip(v, x, y, &p.clip, &p.vis))
+      return TFB_SUCCESS;
+
+   n = p.vis.x1 - p.vis.x0;
+   p.row_size = n * __fb_bytespp;
+   frame_size = p.row_size * (p.vis.y1 - p.vis.y0);
+
+   p.frames[0] = malloc(frame_size);
+   p.frames[1] = malloc(frame_size);
+   p.tmp = malloc(2 * n * sizeof(u32));
+
+   if (!p.frames[0] || !p.frames[1] || !p.tmp) {
+      rc = TFB_ERR_OUT_OF_MEMORY;
+      goto out;
+   }
+
+   p.start = now_ns();
+
+   if (pthread_create(&producer, NULL, producer_thread, &p) != 0) {
+      rc = TFB_ERR_THREAD_CREATE_FAILED;
+      goto out;
+   }
+
+   play(&p);
+
+   pthread_mutex_lock(&p.lock);
+   {
+      p.quit = true;
+      pthread_cond_broadcast(&p.cond);
+   }
+   pthread_mutex_unlock(&p.lock);
+   pthread_join(producer, NULL);
+
+out:
+   free(p.tmp);
+   free(p.frames[1]);
+   free(p.frames[0]);
+   return rc;
+}
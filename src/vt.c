@@ -0,0 +1,228 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/vt.h>
+
+#include <tfblib/tfblib.h>
+#include "utils.h"
+#include "raster.h"
+#include "vt.h"
+
+/*
+ * VT switch handling.
+ *
+ * With VT_PROCESS, the kernel asks us to release the VT with a signal and
+ * waits for our VT_RELDISP before switching. We want to acknowledge as soon
+ * as possible (even if the application never flushes) but never while a
+ * flush is writing to the framebuffer. Therefore, the release handler marks
+ * the VT as inactive and then acknowledges immediately if no flush is in
+ * progress, otherwise it leaves that to the end of the flush. The pending
+ * release flag is cleared atomically by whoever acknowledges, so that the
+ * acknowledge happens exactly once.
+ *
+ * The signals can be delivered to any thread, including the library's own
+ * ones. So, both handlers also write a byte to a self-pipe, which the event
+ * loop waits on: the loop wakes up after every VT switch, no matter which
+ * thread ran the handler.
+ */
+
+#define VT_REL_SIGNAL         SIGUSR1
+#define VT_ACQ_SIGNAL         SIGUSR2
+
+#define VT_IN_FLUSH           (1 << 0)
+#define VT_RELEASE_PENDING    (1 << 1)
+
+extern int __tfb_ttyfd;
+
+static bool vt_process;
+static int vt_active = 1;
+static int vt_flags;
+static int vt_redraw_pending;
+static int vt_pipe[2] = { -1, -1 };
+
+static struct vt_mode saved_vt_mode;
+static struct sigaction saved_rel_sa;
+static struct sigaction saved_acq_sa;
+
+static tfb_redraw_cb redraw_cb;
+static void *redraw_arg;
+
+static void vt_ack_release(void)
+{
+   const int old = __atomic_fetch_and(&vt_flags, ~VT_RELEASE_PENDING,
+                                      __ATOMIC_SEQ_CST);
+
+   if (old & VT_RELEASE_PENDING)
+      ioctl(__tfb_ttyfd, VT_RELDISP, 1);
+}
+
+static void vt_wake_loop(void)
+{
+   const int saved_errno = errno;
+
+   if (write(vt_pipe[1], "", 1) < 0) {
+      /* The pipe is full: the loop has a wake-up pending already */
+   }
+
+   errno = saved_errno;
+}
+
+static void vt_release_handler(int sig)
+{
+   int old;
+
+   __atomic_store_n(&vt_active, 0, __ATOMIC_SEQ_CST);
+   old = __atomic_fetch_or(&vt_flags, VT_RELEASE_PENDING, __ATOMIC_SEQ_CST);
+
+   if (!(old & VT_IN_FLUSH))
+      vt_ack_release();
+
+   vt_wake_loop();
+}
+
+static void vt_acquire_handler(int sig)
+{
+   ioctl(__tfb_ttyfd, VT_RELDISP, VT_ACKACQ);
+   __atomic_store_n(&vt_redraw_pending, 1, __ATOMIC_SEQ_CST);
+   __atomic_store_n(&vt_active, 1, __ATOMIC_SEQ_CST);
+   vt_wake_loop();
+}
+
+static void close_pipe(void)
+{
+   close(vt_pipe[0]);
+   close(vt_pipe[1]);
+   vt_pipe[0] = vt_pipe[1] = -1;
+}
+
+int tfb_int_vt_setup(void)
+{
+   struct sigaction sa = { .sa_flags = SA_RESTART };
+   struct vt_mode mode;
+
+   if (ioctl(__tfb_ttyfd, VT_GETMODE, &saved_vt_mode) != 0)
+      return TFB_ERR_VT_SETMODE_FAILED;
+
+   if (pipe2(vt_pipe, O_NONBLOCK | O_CLOEXEC) != 0)
+      return TFB_ERR_VT_SETMODE_FAILED;
+
+   sigemptyset(&sa.sa_mask);
+   sa.sa_handler = vt_release_handler;
+   sigaction(VT_REL_SIGNAL, &sa, &saved_rel_sa);
+   sa.sa_handler = vt_acquire_handler;
+   sigaction(VT_ACQ_SIGNAL, &sa, &saved_acq_sa);
+
+   mode = saved_vt_mode;
+   mode.mode = VT_PROCESS;
+   mode.relsig = VT_REL_SIGNAL;
+   mode.acqsig = VT_ACQ_SIGNAL;
+   mode.frsig = 0;
+
+   if (ioctl(__tfb_ttyfd, VT_SETMODE, &mode) != 0) {
+      sigaction(VT_REL_SIGNAL, &saved_rel_sa, NULL);
+      sigaction(VT_ACQ_SIGNAL, &saved_acq_sa, NULL);
+      close_pipe();
+      return TFB_ERR_VT_SETMODE_FAILED;
+   }
+
+   vt_active = 1;
+   vt_process = true;
+   return TFB_SUCCESS;
+}
+
+void tfb_int_vt_restore(void)
+{
+   if (!vt_process)
+      return;
+
+   ioctl(__tfb_ttyfd, VT_SETMODE, &saved_vt_mode);
+   sigaction(VT_REL_SIGNAL, &saved_rel_sa, NULL);
+   sigaction(VT_ACQ_SIGNAL, &saved_acq_sa, NULL);
+   close_pipe();
+
+   vt_process = false;
+   vt_active = 1;
+   vt_flags = 0;
+   vt_redraw_pending = 0;
+}
+
+void tfb_set_redraw_callback(tfb_redraw_cb cb, void *user_arg)
+{
+   redraw_cb = cb;
+   redraw_arg = user_arg;
+}
+
+bool tfb_is_vt_active(void)
+{
+   return __atomic_load_n(&vt_active, __ATOMIC_SEQ_CST);
+}
+
+int tfb_int_vt_pollable_fd(void)
+{
+   return vt_pipe[0];
+}
+
+void tfb_int_vt_process_pending(void)
+{
+   char buf[64];
+
+   if (vt_process)
+      while (read(vt_pipe[0], buf, sizeof(buf)) > 0) { }
+
+   if (!vt_process || !__atomic_exchange_n(&vt_redraw_pending, 0,
+                                           __ATOMIC_SEQ_CST))
+   {
+      return;
+   }
+
+   /* No flush thread must be writing to the framebuffer meanwhile */
+   tfb_wait_flush();
+
+   /* Whatever was on the screen is gone: nothing can be skipped */
+   tfb_int_tilehash_invalidate();
+
+   if (redraw_cb) {
+      redraw_cb(redraw_arg);
+      return;
+   }
+
+   /*
+    * With triple buffering, __fb_buffer is the buffer being drawn: it holds an
+    * older frame, not the one last presented.
+    */
+   if (__fb_buffer != __fb_real_buffer && tfb_int_flush_begin()) {
+      tfb_int_copy_rect(tfb_int_screen_buffer(),
+                        0, 0, __fb_screen_w, __fb_screen_h);
+      tfb_int_flush_end();
+   }
+}
+
+bool tfb_int_flush_begin(void)
+{
+   if (!vt_process)
+      return true;
+
+   __atomic_fetch_or(&vt_flags, VT_IN_FLUSH, __ATOMIC_SEQ_CST);
+
+   if (!__atomic_load_n(&vt_active, __ATOMIC_SEQ_CST)) {
+      tfb_int_flush_end();
+      return false;
+   }
+
+   return true;
+}
+
+void tfb_int_flush_end(void)
+{
+   if (!vt_process)
+      return;
+
+   __atomic_fetch_and(&vt_flags, ~VT_IN_FLUSH, __ATOMIC_SEQ_CST);
+   vt_ack_release();
+}
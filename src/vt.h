@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include <tfblib/tfblib.h>
+#include "utils.h"
+
+/*
+ * VT switch handling (vt.c)
+ */
+int tfb_int_vt_setup(void);
+void tfb_int_vt_restore(void);
+
+/*
+ * Read end of the pipe written on every VT switch, for the event loop.
+ * Returns -1 when the VT switches are not handled (no VT_PROCESS).
+ */
+int tfb_int_vt_pollable_fd(void);
+
+/*
+ * Run the redraw requested by a VT re-acquire, if any. Must be called by the
+ * flush functions before tfb_int_flush_begin(), in the application's thread.
+ */
+void tfb_int_vt_process_pending(void);
+
+/*
+ * Every write to the framebuffer made by the flush functions must be wrapped
+ * by these two calls. tfb_int_flush_begin() returns false when the VT is not
+ * active: in that case, tfb_int_flush_end() must not be called. They can be
+ * called by the flush thread (see TFB_FL_ASYNC_FLUSH) as well.
+ */
+bool tfb_int_flush_begin(void);
+void tfb_int_flush_end(void);
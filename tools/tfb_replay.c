@@ -0,0 +1,325 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/*
+ * Replay the frame recordings made by tfb_start_recording() into an in-memory
+ * XRGB8888 screen, in order to inspect them or to compare two of them pixel
+ * by pixel (e.g. a reference recording with the one of a new build).
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "qoi.h"
+#include "record.h"
+
+struct replay {
+   FILE *fh;
+   struct rec_file_header hdr;
+   struct rec_frame_header frame;
+   u32 *screen;
+   u8 *data;
+   u32 data_size;
+   u32 count;                 /* records applied so far */
+};
+
+void show_help_and_exit(const char *appname)
+{
+   printf("Usage:\n");
+   printf("    %s info <RECORDING>\n", appname);
+   printf("    %s dump <RECORDING> <RECORD INDEX> <PPM FILE>\n", appname);
+   printf("    %s compare <RECORDING> <REFERENCE RECORDING>\n", appname);
+   printf("\n");
+   exit(1);
+}
+
+bool qoi_decode(const u8 *data, u32 size,
+                u32 *dst, u32 pitch, u32 w, u32 h)
+{
+   struct qoi_rgba index[64] = {0};
+   struct qoi_rgba px = { 0, 0, 0, 255 };
+   const u8 *p = data + QOI_HEADER_SIZE;
+   const u8 *end = data + size;
+   u32 run = 0;
+
+   if (size < QOI_HEADER_SIZE || memcmp(data, QOI_MAGIC, 4))
+      return false;
+
+   for (u32 y = 0; y < h; y++, dst += pitch) {
+
+      for (u32 x = 0; x < w; x++) {
+
+         if (run) {
+
+            run--;
+
+         } else {
+
+            u8 b, b2;
+
+            if (p == end)
+               return false;
+
+            b = *p++;
+
+            if (b == QOI_OP_RGB || b == QOI_OP_RGBA) {
+
+               const int n = b == QOI_OP_RGB ? 3 : 4;
+
+               if (end - p < n)
+                  return false;
+
+               px.r = p[0];
+               px.g = p[1];
+               px.b = p[2];
+
+               if (n == 4)
+                  px.a = p[3];
+
+               p += n;
+
+            } else if ((b & QOI_MASK_2) == QOI_OP_INDEX) {
+
+               px = index[b];
+
+            } else if ((b & QOI_MASK_2) == QOI_OP_DIFF) {
+
+               px.r += ((b >> 4) & 3) - 2;
+               px.g += ((b >> 2) & 3) - 2;
+               px.b += (b & 3) - 2;
+
+            } else if ((b & QOI_MASK_2) == QOI_OP_LUMA) {
+
+               const int vg = (b & 0x3f) - 32;
+
+               if (p == end)
+                  return false;
+
+               b2 = *p++;
+               px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+               px.g += vg;
+               px.b += vg - 8 + (b2 & 0x0f);
+
+            } else {
+
+               run = b & 0x3f;
+            }
+
+            index[qoi_hash(px)] = px;
+         }
+
+         dst[x] = qoi_rgba_to_xrgb(px);
+      }
+   }
+
+   return true;
+}
+
+bool replay_open(struct replay *r, const char *file)
+{
+   memset(r, 0, sizeof(*r));
+
+   if (!(r->fh = fopen(file, "rb"))) {
+      perror(file);
+      return false;
+   }
+
+   if (fread(&r->hdr, sizeof(r->hdr), 1, r->fh) != 1 ||
+       memcmp(r->hdr.magic, REC_MAGIC, REC_MAGIC_SIZE))
+   {
+      fprintf(stderr, "%s: not a tfblib recording\n", file);
+      return false;
+   }
+
+   r->screen = calloc((size_t)r->hdr.screen_w * r->hdr.screen_h, 4);
+
+   if (!r->screen) {
+      fprintf(stderr, "Out of memory\n");
+      return false;
+   }
+
+   return true;
+}
+
+void replay_close(struct replay *r)
+{
+   if (r->fh)
+      fclose(r->fh);
+
+   free(r->screen);
+   free(r->data);
+}
+
+/* Read and apply the next record. Returns false at the end of the file */
+bool replay_next(struct replay *r)
+{
+   struct rec_frame_header *f = &r->frame;
+
+   if (fread(f, sizeof(*f), 1, r->fh) != 1)
+      return false;
+
+   if (f->size > r->data_size) {
+
+      free(r->data);
+
+      if (!(r->data = malloc(f->size))) {
+         fprintf(stderr, "Out of memory\n");
+         return false;
+      }
+
+      r->data_size = f->size;
+   }
+
+   if (fread(r->data, 1, f->size, r->fh) != f->size) {
+      fprintf(stderr, "Truncated record #%u\n", r->count);
+      return false;
+   }
+
+   if ((u64)f->x + f->w > r->hdr.screen_w ||
+       (u64)f->y + f->h > r->hdr.screen_h ||
+       !qoi_decode(r->data, f->size,
+                   r->screen + (size_t)f->y * r->hdr.screen_w + f->x,
+                   r->hdr.screen_w, f->w, f->h))
+   {
+      fprintf(stderr, "Invalid record #%u\n", r->count);
+      return false;
+   }
+
+   r->count++;
+   return true;
+}
+
+int cmd_info(const char *file)
+{
+   struct replay r;
+   u64 pixels = 0, bytes = 0, duration = 0;
+   u32 keyframes = 0;
+
+   if (!replay_open(&r, file)) {
+      replay_close(&r);
+      return 1;
+   }
+
+   while (replay_next(&r)) {
+      pixels += (u64)r.frame.w * r.frame.h;
+      bytes += r.frame.size;
+      keyframes += !!(r.frame.flags & REC_FL_KEYFRAME);
+      duration = r.frame.time_ns;
+   }
+
+   printf("Screen:      %u x %u\n", r.hdr.screen_w, r.hdr.screen_h);
+   printf("Records:     %u (%u keyframes)\n", r.count, keyframes);
+   printf("Duration:    %.3f s\n", duration / 1e9);
+   printf("Pixels:      %llu\n", (unsigned long long)pixels);
+   printf("QOI data:    %llu bytes (%.2f bytes/pixel)\n",
+          (unsigned long long)bytes, pixels ? (double)bytes / pixels : 0.0);
+
+   replay_close(&r);
+   return 0;
+}
+
+int cmd_dump(const char *file, u32 index, const char *out)
+{
+   struct replay r;
+   FILE *fh;
+   int rc = 1;
+
+   if (!replay_open(&r, file))
+      goto out;
+
+   while (r.count <= index && replay_next(&r)) { }
+
+   if (r.count <= index) {
+      fprintf(stderr, "No record #%u (records: %u)\n", index, r.count);
+      goto out;
+   }
+
+   if (!(fh = fopen(out, "wb"))) {
+      perror(out);
+      goto out;
+   }
+
+   fprintf(fh, "P6\n%u %u\n255\n", r.hdr.screen_w, r.hdr.screen_h);
+
+   for (size_t i = 0; i < (size_t)r.hdr.screen_w * r.hdr.screen_h; i++) {
+      const u32 c = r.screen[i];
+      const u8 rgb[3] = { c >> 16, c >> 8, c };
+      fwrite(rgb, 1, 3, fh);
+   }
+
+   rc = fclose(fh) != 0;
+
+out:
+   replay_close(&r);
+   return rc;
+}
+
+int cmd_compare(const char *file, const char *ref_file)
+{
+   struct replay a = {0}, b = {0};
+   size_t n;
+   int rc = 1;
+
+   if (!replay_open(&a, file) || !replay_open(&b, ref_file))
+      goto out;
+
+   if (a.hdr.screen_w != b.hdr.screen_w || a.hdr.screen_h != b.hdr.screen_h) {
+      printf("Different screen sizes\n");
+      goto out;
+   }
+
+   n = (size_t)a.hdr.screen_w * a.hdr.screen_h;
+
+   while (true) {
+
+      const bool more_a = replay_next(&a);
+      const bool more_b = replay_next(&b);
+      size_t diff = 0, first = 0;
+
+      if (more_a != more_b) {
+         printf("Different number of records\n");
+         goto out;
+      }
+
+      if (!more_a)
+         break;
+
+      for (size_t i = 0; i < n; i++) {
+         if (a.screen[i] != b.screen[i]) {
+            first = diff ? first : i;
+            diff++;
+         }
+      }
+
+      if (diff) {
+         printf("Record #%u: %zu different pixels, the first at (%zu, %zu)\n",
+                a.count - 1, diff, first % a.hdr.screen_w,
+                first / a.hdr.screen_w);
+         goto out;
+      }
+   }
+
+   printf("Identical: %u records\n", a.count);
+   rc = 0;
+
+out:
+   replay_close(&a);
+   replay_close(&b);
+   return rc;
+}
+
+int main(int argc, char **argv)
+{
+   if (argc == 3 && !strcmp(argv[1], "info"))
+      return cmd_info(argv[2]);
+
+   if (argc == 5 && !strcmp(argv[1], "dump"))
+      return cmd_dump(argv[2], strtoul(argv[3], NULL, 10), argv[4]);
+
+   if (argc == 4 && !strcmp(argv[1], "compare"))
+      return cmd_compare(argv[2], argv[3]);
+
+   show_help_and_exit(argv[0]);
+   return 1;
+}
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/*
+ * Take a screenshot of a running tfblib application using the back buffer it
+ * shares with TFB_FL_SHARED_BUFFER, without disturbing it in any way. The
+ * application might be drawing while the pixels are copied: the screenshot
+ * can contain partly drawn content (see tfb_shared.h).
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <tfblib/tfb_shared.h>
+
+#define MAX_ATTEMPTS       100
+
+void show_help_and_exit(const char *appname)
+{
+   printf("Usage:\n");
+   printf("    %s <PID | SHARED BUFFER FILE> <PPM FILE>\n", appname);
+   printf("\n");
+   exit(1);
+}
+
+/* Find the shared back buffer among the open files of the given process */
+int open_by_pid(const char *pid)
+{
+   char path[300], link[300];
+   struct dirent *e;
+   DIR *d;
+   int fd = -1;
+
+   snprintf(path, sizeof(path), "/proc/%s/fd", pid);
+
+   if (!(d = opendir(path))) {
+      perror(path);
+      return -1;
+   }
+
+   while (fd < 0 && (e = readdir(d))) {
+
+      ssize_t rc;
+      snprintf(path, sizeof(path), "/proc/%s/fd/%s", pid, e->d_name);
+      rc = readlink(path, link, sizeof(link) - 1);
+
+      if (rc > 0) {
+         link[rc] = 0;
+         if (strstr(link, "memfd:tfblib-shared"))
+            fd = open(path, O_RDONLY);
+      }
+   }
+
+   closedir(d);
+
+   if (fd < 0)
+      fprintf(stderr, "No shared back buffer found in process %s\n", pid);
+
+   return fd;
+}
+
+static inline unsigned channel(uint32_t px, unsigned pos, unsigned len)
+{
+   unsigned v = (px >> pos) & ((1u << len) - 1);
+   v <<= 8 - len;
+   return v | (v >> len);
+}
+
+bool write_ppm(const char *file,
+               const struct tfb_shared_header *h, const uint8_t *pixels)
+{
+   const unsigned bytespp = h->bits_per_pixel / 8;
+   FILE *fh = fopen(file, "wb");
+
+   if (!fh) {
+      perror(file);
+      return false;
+   }
+
+   fprintf(fh, "P6\n%u %u\n255\n", h->width, h->height);
+
+   for (uint32_t y = 0; y < h->height; y++) {
+
+      const uint8_t *p = pixels + (size_t)y * h->pitch;
+
+      for (uint32_t x = 0; x < h->width; x++, p += bytespp) {
+
+         uint32_t px = 0;
+         uint8_t rgb[3];
+
+         memcpy(&px, p, bytespp);
+         rgb[0] = channel(px, h->red_pos, h->red_len);
+         rgb[1] = channel(px, h->green_pos, h->green_len);
+         rgb[2] = channel(px, h->blue_pos, h->blue_len);
+         fwrite(rgb, 1, 3, fh);
+      }
+   }
+
+   return fclose(fh) == 0;
+}
+
+int main(int argc, char **argv)
+{
+   const struct tfb_shared_header *h;
+   struct tfb_shared_header hdr;
+   size_t pixels_size;
+   struct stat st;
+   uint8_t *copy;
+   void *map;
+   int fd, attempt;
+
+   if (argc != 3)
+      show_help_and_exit(argv[0]);
+
+   if (isdigit((unsigned char)argv[1][0]))
+      fd = open_by_pid(argv[1]);
+   else if ((fd = open(argv[1], O_RDONLY)) < 0)
+      perror(argv[1]);
+
+   if (fd < 0)
+      return 1;
+
+   if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(hdr)) {
+      fprintf(stderr, "Invalid shared back buffer\n");
+      return 1;
+   }
+
+   map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+   if (map == MAP_FAILED) {
+      perror("mmap");
+      return 1;
+   }
+
+   h = map;
+   hdr = *h;
+   pixels_size = (size_t)hdr.pitch * hdr.height;
+
+   if (hdr.magic != TFB_SHARED_MAGIC ||
+       hdr.header_size + pixels_size > (size_t)st.st_size ||
+       (hdr.bits_per_pixel != 16 && hdr.bits_per_pixel != 24 &&
+        hdr.bits_per_pixel != 32) ||
+       (size_t)hdr.width * (hdr.bits_per_pixel / 8) > hdr.pitch ||
+       hdr.red_len > 8 || hdr.green_len > 8 || hdr.blue_len > 8)
+   {
+      fprintf(stderr, "Invalid shared back buffer\n");
+      return 1;
+   }
+
+   if (!(copy = malloc(pixels_size))) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+   }
+
+   /*
+    * Retry the copy until no flush happened while making it: that avoids
+    * mixing two flushed frames, but not seeing a frame being drawn, which
+    * 'seq' cannot tell. After too many attempts (an application flushing
+    * continuously), just keep the last copy.
+    */
+   for (attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+
+      const uint32_t seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+
+      if (seq & 1)
+         continue;
+
+      memcpy(copy, (const uint8_t *)map + hdr.header_size, pixels_size);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+      if (seq == __atomic_load_n(&h->seq, __ATOMIC_RELAXED))
+         break;
+   }
+
+   if (attempt == MAX_ATTEMPTS)
+      fprintf(stderr, "Warning: the snapshot spans several flushes\n");
+
+   return write_ppm(argv[2], &hdr, copy) ? 0 : 1;
+}